@@ -161,7 +161,11 @@ int main()
         // upload the custom color buffer to the GPU using the texture
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, bufferTexture);
+        // the tiles that were not drawn are still only marked as cleared, and the rows are P pixels apart
+        customBuffer.materialize();
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, customBuffer.P);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, max_W, max_H, 0, GL_RGBA, GL_UNSIGNED_BYTE, customBuffer.buffer);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 
         // set opengl frame buffer object to read from our texture, we will copy from it
         glBindFramebuffer(GL_READ_FRAMEBUFFER, oglFrameBuffer);
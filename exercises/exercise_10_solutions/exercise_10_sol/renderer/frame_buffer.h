@@ -5,35 +5,185 @@
 #ifndef ITU_GRAPHICS_PROGRAMMING_FRAME_BUFFER_H
 #define ITU_GRAPHICS_PROGRAMMING_FRAME_BUFFER_H
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
 
+#if defined(__AVX__)
+#define FRAME_BUFFER_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRAME_BUFFER_SSE
+#include <emmintrin.h>
+#endif
+
+
+// the values are stored in rows of P values (the pitch), which start 64 bytes aligned.
+// The buffer is split in tiles of tileSize x tileSize pixels, and clearBuffer only marks the tiles as cleared:
+// a cleared tile receives the clear value the first time one of its pixels is read or written through paintAt or
+// valueAt, so a clear doesn't depend on the resolution. Code that reads buffer directly must call materialize first
 template<class T>
 class FrameBuffer {
 public:
-    unsigned int W, H;
+    // width, height and pitch (P >= W, the padding at the end of the rows can be read and written)
+    unsigned int W, H, P;
     T *buffer;
 
+    // width and height of the tiles that are cleared together, in pixels
+    static const unsigned int tileSize = 32;
+
     FrameBuffer(unsigned int width, unsigned int height) : W(width), H(height) {
-        buffer = new T[W * H];
+        static_assert(alignment % sizeof(T) == 0, "frame buffer values must divide the alignment");
+        P = (W + padding - 1) / padding * padding;
+        m_buffer.reset(new T[P * H + padding]);
+        buffer = m_buffer.get() + (padding - (std::uintptr_t(m_buffer.get()) / sizeof(T)) % padding) % padding;
+        m_tilesX = (W + tileSize - 1) / tileSize;
+        m_tilesY = (H + tileSize - 1) / tileSize;
+        m_cleared.assign(m_tilesX * m_tilesY, 0);
     }
 
-    ~FrameBuffer() { delete[] buffer; } // clean our memory
-
+    // mark every tile as cleared to value
     void clearBuffer(T value) {
-        int size = W * H;
-        for (int i = 0; i < size; i++)
-            buffer[i] = value;
+        m_clearValue = value;
+        std::fill(m_cleared.begin(), m_cleared.end(), 1);
+    }
+
+    // clear the whole buffer to value now, with non-temporal SIMD stores
+    void fill(T value) {
+        m_clearValue = value;
+        fillValues(buffer, P * H, value, true);
+        std::fill(m_cleared.begin(), m_cleared.end(), 0);
+    }
+
+    // whether pixel (x, y) still has the clear value because its tile was not materialized yet
+    bool cleared(unsigned int x, unsigned int y) const {
+        return m_cleared[x / tileSize + y / tileSize * m_tilesX];
+    }
+
+    T clearValue() const { return m_clearValue; }
+
+    // give the clear value to the cleared tiles that overlap the rectangle [xMin, xMax] x [yMin, yMax]
+    void materialize(unsigned int xMin, unsigned int yMin, unsigned int xMax, unsigned int yMax) {
+        assert(xMin <= xMax && xMax < W && yMin <= yMax && yMax < H);
+        for (unsigned int ty = yMin / tileSize; ty <= yMax / tileSize; ty++)
+            for (unsigned int tx = xMin / tileSize; tx <= xMax / tileSize; tx++)
+                if (m_cleared[tx + ty * m_tilesX])
+                    materializeTile(tx, ty);
+    }
+
+    void materialize() {
+        materialize(0, 0, W - 1, H - 1);
     }
 
     void paintAt(unsigned int x, unsigned int y, T value) {
         assert(x < W && y < H); // ensure valid position, crash if not (sooo dramatic!)
-        buffer[x + y * W] = value;
+        if (cleared(x, y))
+            materializeTile(x / tileSize, y / tileSize);
+        buffer[x + y * P] = value;
     }
 
     T valueAt(unsigned int x, unsigned int y) {
         assert(x < W && y < H);
-        return buffer[x + y * W];
+        if (cleared(x, y))
+            materializeTile(x / tileSize, y / tileSize);
+        return buffer[x + y * P];
+    }
+
+    // copy the W x H values to dst, in rows of dstRowLength values, without materializing the cleared tiles
+    void copyTo(T *dst, unsigned int dstRowLength) const {
+        forEachSpan([&](unsigned int x0, unsigned int x1, unsigned int y, bool isCleared) {
+            T *out = dst + x0 + y * dstRowLength;
+            if (isCleared)
+                fillValues(out, x1 - x0, m_clearValue, false);
+            else
+                std::memcpy(out, buffer + x0 + y * P, (x1 - x0) * sizeof(T));
+        });
+    }
+
+    // write convert(value) of the W x H values to dst, in rows of dstRowLength values, without materializing the
+    // cleared tiles (the clear value is converted once)
+    template<class U, class Convert>
+    void convertTo(U *dst, unsigned int dstRowLength, Convert &&convert) const {
+        U clearConverted = convert(m_clearValue);
+        forEachSpan([&](unsigned int x0, unsigned int x1, unsigned int y, bool isCleared) {
+            U *out = dst + y * dstRowLength;
+            if (isCleared) {
+                std::fill(out + x0, out + x1, clearConverted);
+            } else {
+                const T *in = buffer + y * P;
+                for (unsigned int x = x0; x < x1; x++)
+                    out[x] = convert(in[x]);
+            }
+        });
+    }
+
+private:
+    // alignment of the rows, in bytes, and in values
+    static const unsigned int alignment = 64;
+    static const unsigned int padding = alignment / sizeof(T);
+
+    // set count values from dst to value, 4 bytes values are stored 8 (AVX) or 4 (SSE) at a time.
+    // Non-temporal stores skip the cache, for buffers larger than it, and need a 16 (SSE) or 32 (AVX) bytes
+    // aligned dst
+    static void fillValues(T *dst, unsigned int count, T value, bool nonTemporal) {
+        unsigned int i = 0;
+#if defined(FRAME_BUFFER_AVX) || defined(FRAME_BUFFER_SSE)
+        if (sizeof(T) == 4) {
+            std::int32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+#if defined(FRAME_BUFFER_AVX)
+            __m256i values = _mm256_set1_epi32(bits);
+            if (nonTemporal) {
+                assert(std::uintptr_t(dst) % 32 == 0);
+                for (; i + 8 <= count; i += 8)
+                    _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + i), values);
+                _mm_sfence();
+            } else {
+                for (; i + 8 <= count; i += 8)
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), values);
+            }
+#else
+            __m128i values = _mm_set1_epi32(bits);
+            if (nonTemporal) {
+                assert(std::uintptr_t(dst) % 16 == 0);
+                for (; i + 4 <= count; i += 4)
+                    _mm_stream_si128(reinterpret_cast<__m128i *>(dst + i), values);
+                _mm_sfence();
+            } else {
+                for (; i + 4 <= count; i += 4)
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), values);
+            }
+#endif
+        }
+#endif
+        std::fill(dst + i, dst + count, value);
+    }
+
+    // the last tiles of the rows include the padding, so the rows of a tile are whole multiples of 64 bytes
+    void materializeTile(unsigned int tx, unsigned int ty) {
+        unsigned int x0 = tx * tileSize, x1 = std::min(x0 + tileSize, P);
+        unsigned int y0 = ty * tileSize, y1 = std::min(y0 + tileSize, H);
+        for (unsigned int y = y0; y < y1; y++)
+            fillValues(buffer + x0 + y * P, x1 - x0, m_clearValue, false);
+        m_cleared[tx + ty * m_tilesX] = 0;
+    }
+
+    // call spanFunc(x0, x1, y, isCleared) for the spans [x0, x1) of each row that belong to the same tile
+    template<class SpanFunc>
+    void forEachSpan(SpanFunc &&spanFunc) const {
+        for (unsigned int y = 0; y < H; y++)
+            for (unsigned int tx = 0; tx < m_tilesX; tx++) {
+                unsigned int x0 = tx * tileSize, x1 = std::min(x0 + tileSize, W);
+                spanFunc(x0, x1, y, m_cleared[tx + y / tileSize * m_tilesX] != 0);
+            }
     }
 
+    std::unique_ptr<T[]> m_buffer;
+    std::vector<std::uint8_t> m_cleared;
+    unsigned int m_tilesX, m_tilesY;
+    T m_clearValue = T();
 };
 
 
@@ -0,0 +1,948 @@
+// headless benchmark of the software rendering library: renders meshes with srl::PointRenderer, LineRenderer and
+// TriangleRenderer along a camera path, without a window or an OpenGL context, and reports the throughput of each
+// configuration. The last frame of each configuration can be saved as a reference image, and later compared
+// against the references to catch changes in the output of the renderers.
+//
+// usage: exercise_7_sol_benchmark [options]
+//   --renderer point|line|triangle|all   renderers to run (default triangle)
+//   --resolution WxH[,WxH...]            frame buffer sizes, 64x64 to 3840x2160 (default 64x64,640x480,1920x1080)
+//   --mesh cube|sphere[:N]|particles[:N]|points[:N]|file.obj
+//                                        mesh, the sphere has N stacks and 2N slices, the particles are N
+//                                        translucent quads, the points are N points on a sphere (default cube)
+//   --camera static|orbit|dolly          camera path (default orbit)
+//   --frames N                           frames measured per configuration, after 2 warm up frames (default 30)
+//   --instances N                        draws N copies of the mesh, scaled down on a grid (default 1)
+//   --options a,b,...                    triangle renderer options: tiled, edge, stream, hiz, visibility,
+//                                        oit, nosubpixel, noplane, nosmall. Line renderer options: batched,
+//                                        aa.
+//                                        Point renderer options: cloud (draws the vertices as a point cloud),
+//                                        holes (fills the holes of the point cloud).
+//                                        indexed draws the mesh with shared vertices and an index buffer,
+//                                        commands draws the instances with a srl::CommandBuffer, geometry runs
+//                                        the geometry stages on the worker threads. Depth buffer options: depth24,
+//                                        depth16 (unorm formats), planes (plane compression of the blocks).
+//                                        msaa2, msaa4, msaa8 render with 2, 4 or 8 samples per pixel
+//   --threads N                          worker threads of the tiled rasterization (default one per core)
+//   --save-references DIR                write the last frame of each configuration to DIR/<name>.ppm
+//   --references DIR                     compare the last frame with DIR/<name>.ppm (or .png), exit code 1 if
+//                                        any image differs
+//   --tolerance T                        largest difference of a channel that is not counted (default 0)
+//   --max-different F                    fraction of the pixels that may differ (default 0.001)
+//   --stats FILE                         write the srl::RenderStats of every measured frame to FILE, one JSON
+//                                        object per line
+//   --check-coverage N                   instead of the benchmark, rasterize N sets of jittered meshes that share
+//                                        their edges with each rasterization path (sub-pixel, edge function,
+//                                        scanline, small triangles, tiled), exit code 1 if a pixel is covered
+//                                        twice or left as a hole
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include "srl_point_renderer.h"
+#include "srl_line_renderer.h"
+#include "srl_triangle_renderer.h"
+#include "srl_command_buffer.h"
+#include "primitives.h"
+
+struct BenchmarkSettings {
+    std::vector<std::string> renderers = {"triangle"};
+    std::vector<glm::ivec2> resolutions = {{64, 64}, {640, 480}, {1920, 1080}};
+    std::string mesh = "cube";
+    std::string camera = "orbit";
+    int frames = 30;
+    int instances = 1;
+    std::vector<std::string> options;
+    unsigned int threads = 0;
+    std::string saveReferences, references;
+    int tolerance = 0;
+    double maxDifferent = 0.001;
+    std::string stats;
+    int checkCoverage = 0;
+};
+
+// 8 bits RGB image, top row first
+struct Image {
+    int width = 0, height = 0;
+    std::vector<unsigned char> rgb;
+};
+
+
+// meshes
+// ------
+
+// the vertices of a triangle list, colored by their normal if they have no color
+std::vector<srl::vertex> makeVertices(const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &normals,
+                                      const std::vector<glm::vec2> &uvs, const std::vector<glm::vec4> &colors) {
+    std::vector<srl::vertex> vts;
+    vts.reserve(positions.size());
+    for (unsigned int i = 0; i < positions.size(); i++) {
+        glm::vec4 color = i < colors.size() ? colors[i] : glm::vec4(normals[i] * .5f + .5f, 1.0f);
+        vts.push_back(srl::vertex{glm::vec4(positions[i], 1.0f), glm::vec4(normals[i], 0.0f), color,
+                                  i < uvs.size() ? uvs[i] : glm::vec2(0.0f)});
+    }
+    return vts;
+}
+
+// sphere of radius 1 with stacks rows and 2 * stacks columns of quads, 4 * stacks^2 triangles
+std::vector<srl::vertex> makeSphere(int stacks) {
+    const float pi = 3.14159265358979f;
+    int slices = 2 * stacks;
+    auto point = [&](int stack, int slice) {
+        float theta = pi * float(stack) / float(stacks), phi = 2.0f * pi * float(slice) / float(slices);
+        return glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), -std::sin(theta) * std::sin(phi));
+    };
+    std::vector<glm::vec3> positions, normals;
+    std::vector<glm::vec2> uvs;
+    for (int i = 0; i < stacks; i++) {
+        for (int j = 0; j < slices; j++) {
+            // counterclockwise seen from outside of the sphere
+            glm::ivec2 corners[6] = {{i, j}, {i + 1, j}, {i + 1, j + 1}, {i, j}, {i + 1, j + 1}, {i, j + 1}};
+            for (auto c : corners) {
+                positions.push_back(point(c.x, c.y));
+                normals.push_back(positions.back());
+                uvs.push_back(glm::vec2(float(c.y) / float(slices), 1.0f - float(c.x) / float(stacks)));
+            }
+        }
+    }
+    return makeVertices(positions, normals, uvs, {});
+}
+
+// count translucent squares at random positions in a cube of side 2, with random orientations and colors, to
+// test transparency. Each square is drawn from both sides (4 triangles), so back face culling never removes it
+std::vector<srl::vertex> makeParticles(int count) {
+    // a fixed linear congruential generator, so every run makes the same particles
+    std::uint32_t state = 12345u;
+    auto random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return float(state >> 8) / float(1u << 24);
+    };
+    std::vector<glm::vec3> positions, normals;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec4> colors;
+    for (int i = 0; i < count; i++) {
+        glm::vec3 center(random() * 2.0f - 1.0f, random() * 2.0f - 1.0f, random() * 2.0f - 1.0f);
+        glm::vec3 normal = glm::normalize(glm::vec3(random() - .5f, random() - .5f, random() - .5f) + glm::vec3(1e-3f));
+        glm::vec3 u = glm::normalize(glm::cross(normal, std::abs(normal.y) < .9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0)));
+        glm::vec3 v = glm::cross(normal, u);
+        float size = .1f + .1f * random();
+        glm::vec3 corners[4] = {center - (u + v) * size, center + (u - v) * size, center + (u + v) * size,
+                                center - (u - v) * size};
+        glm::vec4 color(random(), random(), random(), .25f + .5f * random());
+        int order[12] = {0, 1, 2, 0, 2, 3, 0, 2, 1, 0, 3, 2};
+        for (int k = 0; k < 12; k++) {
+            positions.push_back(corners[order[k]]);
+            normals.push_back(k < 6 ? normal : -normal);
+            uvs.push_back(glm::vec2(order[k] == 1 || order[k] == 2, order[k] >= 2));
+            colors.push_back(color);
+        }
+    }
+    return makeVertices(positions, normals, uvs, colors);
+}
+
+// count points at random positions on a sphere of radius 1, colored by their normal, to test point clouds
+std::vector<srl::vertex> makePoints(int count) {
+    // a fixed linear congruential generator, so every run makes the same points
+    std::uint32_t state = 54321u;
+    auto random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return float(state >> 8) / float(1u << 24);
+    };
+    std::vector<srl::vertex> vts(count);
+    for (auto &v : vts) {
+        // uniform on the sphere: uniform height and angle around the y axis
+        float y = random() * 2.0f - 1.0f, angle = 6.2831853f * random();
+        float radius = std::sqrt(std::max(0.0f, 1.0f - y * y));
+        glm::vec3 normal(radius * std::cos(angle), y, radius * std::sin(angle));
+        v = srl::vertex{glm::vec4(normal, 1.0f), glm::vec4(normal, 0.0f), glm::vec4(normal * .5f + .5f, 1.0f),
+                        glm::vec2(0.0f)};
+    }
+    return vts;
+}
+
+// triangles of a Wavefront OBJ file (positions, normals and texture coordinates, polygons are split into fans)
+// faces without normals get the normal of the face. Returns false if the file can't be read
+bool loadObj(const std::string &path, std::vector<srl::vertex> &vts) {
+    std::ifstream file(path);
+    if (!file)
+        return false;
+    std::vector<glm::vec3> filePositions, fileNormals;
+    std::vector<glm::vec2> fileUvs;
+    std::vector<glm::vec3> positions, normals;
+    std::vector<glm::vec2> uvs;
+
+    // OBJ indices start at 1, negative indices count from the end
+    auto resolve = [](int index, size_t size) { return index < 0 ? int(size) + index : index - 1; };
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream in(line);
+        std::string type;
+        in >> type;
+        if (type == "v") {
+            glm::vec3 p;
+            in >> p.x >> p.y >> p.z;
+            filePositions.push_back(p);
+        }
+        else if (type == "vn") {
+            glm::vec3 n;
+            in >> n.x >> n.y >> n.z;
+            fileNormals.push_back(n);
+        }
+        else if (type == "vt") {
+            glm::vec2 uv;
+            in >> uv.x >> uv.y;
+            fileUvs.push_back(uv);
+        }
+        else if (type == "f") {
+            // each corner is v, v/vt, v//vn or v/vt/vn
+            std::vector<glm::ivec3> corners;
+            std::string corner;
+            while (in >> corner) {
+                glm::ivec3 c(0);
+                std::istringstream cornerIn(corner);
+                std::string index;
+                for (int k = 0; k < 3 && std::getline(cornerIn, index, '/'); k++)
+                    c[k] = index.empty() ? 0 : std::atoi(index.c_str());
+                corners.push_back(c);
+            }
+            for (unsigned int k = 2; k < corners.size(); k++) {
+                glm::ivec3 tri[3] = {corners[0], corners[k - 1], corners[k]};
+                glm::vec3 p[3];
+                bool valid = true;
+                for (int v = 0; v < 3; v++) {
+                    int i = resolve(tri[v].x, filePositions.size());
+                    valid = valid && i >= 0 && i < int(filePositions.size());
+                    p[v] = valid ? filePositions[i] : glm::vec3(0.0f);
+                }
+                if (!valid)
+                    continue;
+                glm::vec3 faceNormal = glm::cross(p[1] - p[0], p[2] - p[0]);
+                float length = glm::length(faceNormal);
+                faceNormal = length > 0.0f ? faceNormal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+                for (int v = 0; v < 3; v++) {
+                    int t = resolve(tri[v].y, fileUvs.size()), n = resolve(tri[v].z, fileNormals.size());
+                    positions.push_back(p[v]);
+                    uvs.push_back(tri[v].y != 0 && t >= 0 && t < int(fileUvs.size()) ? fileUvs[t] : glm::vec2(0.0f));
+                    normals.push_back(tri[v].z != 0 && n >= 0 && n < int(fileNormals.size()) ? fileNormals[n] : faceNormal);
+                }
+            }
+        }
+    }
+    vts = makeVertices(positions, normals, uvs, {});
+    return true;
+}
+
+// center the mesh at the origin and scale it to fit in a sphere of radius 1, so all meshes fit the camera paths
+void normalizeMesh(std::vector<srl::vertex> &vts) {
+    if (vts.empty())
+        return;
+    glm::vec3 bMin(vts[0].pos), bMax(vts[0].pos);
+    for (auto &v : vts) {
+        bMin = glm::min(bMin, glm::vec3(v.pos));
+        bMax = glm::max(bMax, glm::vec3(v.pos));
+    }
+    glm::vec3 center = (bMin + bMax) * .5f;
+    float radius = 0.0f;
+    for (auto &v : vts)
+        radius = std::max(radius, glm::length(glm::vec3(v.pos) - center));
+    for (auto &v : vts)
+        v.pos = glm::vec4((glm::vec3(v.pos) - center) / std::max(radius, 1e-6f), 1.0f);
+}
+
+bool makeMesh(const std::string &name, std::vector<srl::vertex> &vts) {
+    if (name == "cube") {
+        std::vector<glm::vec3> positions, normals;
+        std::vector<glm::vec2> uvs;
+        std::vector<glm::vec4> colors;
+        Primitives::makeCube(2.0f, positions, normals, uvs, colors);
+        vts = makeVertices(positions, normals, uvs, colors);
+    }
+    else if (name.compare(0, 6, "sphere") == 0) {
+        int stacks = name.size() > 7 ? std::atoi(name.c_str() + 7) : 128;
+        if (stacks < 2)
+            return false;
+        vts = makeSphere(stacks);
+    }
+    else if (name.compare(0, 9, "particles") == 0) {
+        int count = name.size() > 10 ? std::atoi(name.c_str() + 10) : 1000;
+        if (count < 1)
+            return false;
+        vts = makeParticles(count);
+    }
+    else if (name.compare(0, 6, "points") == 0) {
+        int count = name.size() > 7 ? std::atoi(name.c_str() + 7) : 1000000;
+        if (count < 1)
+            return false;
+        vts = makePoints(count);
+    }
+    else if (!loadObj(name, vts))
+        return false;
+    normalizeMesh(vts);
+    return true;
+}
+
+// the triangle list vts as an indexed triangle list, identical vertices are shared
+void indexMesh(const std::vector<srl::vertex> &vts, std::vector<srl::vertex> &shared,
+               std::vector<std::uint32_t> &indices) {
+    std::unordered_map<std::string, std::uint32_t> slots;
+    shared.clear();
+    indices.clear();
+    indices.reserve(vts.size());
+    for (auto &v : vts) {
+        std::string key(reinterpret_cast<const char *>(&v), sizeof(v));
+        auto slot = slots.emplace(key, std::uint32_t(shared.size()));
+        if (slot.second)
+            shared.push_back(v);
+        indices.push_back(slot.first->second);
+    }
+}
+
+// model matrices of count copies of a mesh of radius 1, on the cells of a grid that fills the cube of side 2.
+// The copies are in the order of z, so with the camera in front of the grid they go from back to front
+std::vector<glm::mat4> instanceMatrices(int count) {
+    int cells = 1;
+    while (cells * cells * cells < count)
+        cells++;
+    float cellSize = 2.0f / float(cells);
+    std::vector<glm::mat4> matrices;
+    for (int i = 0; i < count; i++) {
+        glm::vec3 cell(i % cells, i / cells % cells, i / (cells * cells));
+        glm::vec3 center = glm::vec3(-1.0f) + (cell + .5f) * cellSize;
+        matrices.push_back(glm::translate(center) * glm::scale(glm::vec3(count > 1 ? .4f * cellSize : 1.0f)));
+    }
+    return matrices;
+}
+
+
+
+// camera paths
+// ------------
+
+// view projection matrix of frame frame out of frameCount. The paths are functions of the frame, so every run
+// renders the same images
+glm::mat4 cameraAt(const std::string &path, int frame, int frameCount, int width, int height) {
+    float t = frameCount > 1 ? float(frame) / float(frameCount - 1) : 0.0f;
+    glm::vec3 eye(0.0f, 0.5f, 2.5f), target(0.0f);
+    if (path == "orbit") {
+        // a full turn around the mesh
+        float angle = 6.2831853f * t;
+        eye = glm::vec3(2.5f * std::sin(angle), 0.5f, 2.5f * std::cos(angle));
+    }
+    else if (path == "dolly") {
+        // from far away into the mesh, looking down -z, so the triangles grow and end up clipped by the near plane
+        eye = glm::vec3(0.1f, 0.3f, 4.5f - 4.0f * t);
+        target = eye - glm::vec3(0.0f, 0.0f, 1.0f);
+    }
+    return glm::perspectiveFov<float>(glm::radians(70.0f), float(width), float(height), .5f, 10.0f)
+           * glm::lookAt<float>(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+
+// images
+// ------
+
+// the color buffer has its first row at the bottom of the screen
+Image toImage(const srl::CustomFrameBuffer<std::uint32_t> &fb) {
+    Image image;
+    image.width = fb.W;
+    image.height = fb.H;
+    image.rgb.resize(fb.W * fb.H * 3);
+    std::vector<std::uint32_t> colors(fb.W * fb.H);
+    fb.copyTo(colors.data(), fb.W);
+    for (unsigned int y = 0; y < fb.H; y++) {
+        for (unsigned int x = 0; x < fb.W; x++) {
+            std::uint32_t color = colors[x + (fb.H - 1 - y) * fb.W];
+            for (int c = 0; c < 3; c++)
+                image.rgb[(x + y * fb.W) * 3 + c] = (unsigned char) (color >> (8 * c));
+        }
+    }
+    return image;
+}
+
+bool writePpm(const std::string &path, const Image &image) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    file << "P6\n" << image.width << " " << image.height << "\n255\n";
+    file.write((const char *) image.rgb.data(), image.rgb.size());
+    return bool(file);
+}
+
+// binary PPM (P6) with 8 bits channels
+bool readPpm(const std::string &path, Image &image) {
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    int maxValue = 0;
+    if (!(file >> magic >> image.width >> image.height >> maxValue) || magic != "P6" || maxValue != 255)
+        return false;
+    file.get(); // the single whitespace after the header
+    image.rgb.resize(image.width * image.height * 3);
+    return bool(file.read((char *) image.rgb.data(), image.rgb.size()));
+}
+
+bool readPng(const std::string &path, Image &image) {
+    int channels;
+    unsigned char *data = stbi_load(path.c_str(), &image.width, &image.height, &channels, 3);
+    if (!data)
+        return false;
+    image.rgb.assign(data, data + image.width * image.height * 3);
+    stbi_image_free(data);
+    return true;
+}
+
+// number of pixels with a channel that differs by more than tolerance, and the largest difference,
+// returns -1 if the images don't have the same size
+int countDifferentPixels(const Image &a, const Image &b, int tolerance, int &maxDifference) {
+    maxDifference = 0;
+    if (a.width != b.width || a.height != b.height)
+        return -1;
+    int count = 0;
+    for (int i = 0, size = a.width * a.height; i < size; i++) {
+        int difference = 0;
+        for (int c = 0; c < 3; c++)
+            difference = std::max(difference, std::abs(int(a.rgb[i * 3 + c]) - int(b.rgb[i * 3 + c])));
+        maxDifference = std::max(maxDifference, difference);
+        count += difference > tolerance;
+    }
+    return count;
+}
+
+
+// benchmark
+// ---------
+
+std::vector<std::string> split(const std::string &text, char separator) {
+    std::vector<std::string> parts;
+    std::istringstream in(text);
+    std::string part;
+    while (std::getline(in, part, separator))
+        if (!part.empty())
+            parts.push_back(part);
+    return parts;
+}
+
+bool hasOption(const BenchmarkSettings &settings, const std::string &option) {
+    return std::find(settings.options.begin(), settings.options.end(), option) != settings.options.end();
+}
+
+void configureTriangleRenderer(srl::TriangleRenderer &renderer, const BenchmarkSettings &settings) {
+    renderer.m_tiledRasterization = hasOption(settings, "tiled");
+    renderer.m_edgeFunctionRasterizer = hasOption(settings, "edge");
+    renderer.m_streamFragments = hasOption(settings, "stream");
+    renderer.m_hierarchicalZ = hasOption(settings, "hiz");
+    renderer.m_visibilityBuffer = hasOption(settings, "visibility");
+    renderer.m_orderIndependentTransparency = hasOption(settings, "oit");
+    renderer.m_subpixelRasterization = !hasOption(settings, "nosubpixel");
+    renderer.m_planeInterpolation = !hasOption(settings, "noplane");
+    renderer.m_smallTriangles = !hasOption(settings, "nosmall");
+}
+
+// file name of the reference image of a configuration
+std::string configurationName(const std::string &renderer, const std::string &mesh, const std::string &camera,
+                              glm::ivec2 resolution) {
+    std::string meshName = mesh.substr(mesh.find_last_of("/\\") + 1);
+    std::string name = renderer + "_" + meshName + "_" + camera + "_" + std::to_string(resolution.x) + "x" +
+                       std::to_string(resolution.y);
+    for (auto &c : name)
+        if (!std::isalnum((unsigned char) c) && c != '_' && c != 'x')
+            c = '_';
+    return name;
+}
+
+// render the frames of one configuration, print its throughput, and save or compare its last frame.
+// Returns false if the comparison fails
+bool runConfiguration(srl::Renderer &renderer, const std::string &rendererName, const std::vector<srl::vertex> &vts,
+                      const std::vector<std::uint32_t> *indices, const srl::PointCloud *cloud,
+                      glm::ivec2 resolution, const BenchmarkSettings &settings, std::ostream *statsOut) {
+    srl::CustomFrameBuffer<std::uint32_t> fb(resolution.x, resolution.y);
+    srl::CustomFrameBuffer<float> db(resolution.x, resolution.y);
+    if (hasOption(settings, "depth24"))
+        db.setDepthFormat(srl::DepthFormat::unorm24);
+    else if (hasOption(settings, "depth16"))
+        db.setDepthFormat(srl::DepthFormat::unorm16);
+    db.setPlaneCompression(hasOption(settings, "planes"));
+    unsigned int sampleCount = hasOption(settings, "msaa8") ? 8 : hasOption(settings, "msaa4") ? 4 :
+                               hasOption(settings, "msaa2") ? 2 : 1;
+    if (sampleCount > 1) {
+        fb.setSampleCount(sampleCount);
+        db.setSampleCount(sampleCount);
+    }
+    auto *triangleRenderer = dynamic_cast<srl::TriangleRenderer *>(&renderer);
+    auto *pointRenderer = dynamic_cast<srl::PointRenderer *>(&renderer);
+    const std::vector<glm::mat4> models = instanceMatrices(settings.instances);
+    srl::CommandBuffer commands;
+    // point clouds are not drawn with the command buffer
+    bool useCommands = hasOption(settings, "commands") && !(cloud && pointRenderer);
+    const int warmUpFrames = 2;
+
+    std::string name = configurationName(rendererName, settings.mesh, settings.camera, resolution);
+    double totalMs = 0.0, bestMs = 1e30;
+    long long coveredPixels = 0, compressedBlocks = 0, decompressedBlocks = 0;
+    std::vector<std::uint8_t> covered(db.W * db.H);
+    srl::RenderStats stats;
+    for (int frame = -warmUpFrames; frame < settings.frames; frame++) {
+        glm::mat4 viewProj = cameraAt(settings.camera, std::max(frame, 0), settings.frames, resolution.x, resolution.y);
+        fb.clearBuffer(srl::Colors::toRGBA32(srl::Colors::black));
+        db.clearBuffer(1.0f);
+
+        // the statistics of the draws of the frame
+        srl::RenderStats frameStats;
+        auto start = std::chrono::steady_clock::now();
+        if (useCommands) {
+            commands.clear();
+            for (auto &model : models) {
+                if (indices)
+                    commands.draw(renderer, vts, *indices, srl::Topology::triangleList, model);
+                else
+                    commands.draw(renderer, vts, model);
+            }
+            commands.execute(viewProj, fb, db);
+            frameStats = commands.stats();
+        }
+        else {
+            for (auto &model : models) {
+                if (cloud && pointRenderer)
+                    pointRenderer->render(*cloud, model, viewProj, fb, db);
+                else if (indices)
+                    renderer.render(vts, *indices, srl::Topology::triangleList, model, viewProj, fb, db);
+                else
+                    renderer.render(vts, model, viewProj, fb, db);
+                frameStats.add(renderer.stats());
+            }
+            frameStats.pixelCount = fb.W * fb.H;
+        }
+        if (triangleRenderer) {
+            triangleRenderer->resolveVisibility(fb);
+            triangleRenderer->resolveTransparency(fb, db);
+        }
+        fb.resolve();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (frame >= 0) {
+            compressedBlocks += db.compressedBlockCount();
+            decompressedBlocks += db.decompressedBlockCount();
+        }
+
+        if (frame < 0)
+            continue;
+        totalMs += ms;
+        bestMs = std::min(bestMs, ms);
+        stats.add(frameStats);
+        if (statsOut)
+            *statsOut << "{\"configuration\": \"" << name << "\", \"frame\": " << frame << ", \"stats\": "
+                      << frameStats.toJson() << "}\n";
+        // the pixels with a covered sample
+        db.resolve();
+        db.convertTo(covered.data(), db.W, [](float depth) { return std::uint8_t(depth < 1.0f); });
+        for (std::uint8_t c : covered)
+            coveredPixels += c;
+    }
+
+    double seconds = totalMs / 1000.0;
+    long long triangles = (long long) ((indices ? indices->size() : vts.size()) / 3) * models.size() * settings.frames;
+    std::printf("%-44s %9.3f ms/frame (best %9.3f)  %10.3f Mtriangles/s  %10.3f Mpixels/s\n", name.c_str(),
+                totalMs / settings.frames, bestMs, triangles / seconds * 1e-6, coveredPixels / seconds * 1e-6);
+    // average time of the stages, and what the primitives and fragments became
+    double msPerFrame = 1e-6 / settings.frames;
+    std::printf("    stages ms: vertices %.3f  assembly %.3f  culling %.3f  clipping %.3f  divide %.3f  screen %.3f  "
+                "raster %.3f  fragments %.3f  write %.3f\n",
+                stats.processVerticesNs * msPerFrame, stats.assemblePrimitivesNs * msPerFrame,
+                stats.backfaceCullingNs * msPerFrame, stats.clipPrimitivesNs * msPerFrame,
+                stats.divideByWNs * msPerFrame, stats.toScreenSpaceNs * msPerFrame,
+                stats.rasterPrimitivesNs * msPerFrame, stats.processFragmentsNs * msPerFrame,
+                stats.writeToFrameBufferNs * msPerFrame);
+    std::printf("    primitives %d in, %d clipped, %d culled, %d rejected, %d out  fragments %.3f M/s, %.1f%% depth "
+                "rejected, overdraw %.2f\n", stats.primitivesIn / settings.frames,
+                stats.primitivesClipped / settings.frames, stats.primitivesCulled / settings.frames,
+                stats.primitivesRejected / settings.frames, stats.primitivesOut() / settings.frames,
+                stats.fragments.generated / seconds * 1e-6,
+                100.0 * stats.fragments.depthRejected / std::max(stats.fragments.generated, 1LL), stats.overdraw());
+    {
+        // the fragments of the blocks written as planes don't read or write the depth buffer, a decompression
+        // writes a whole block, and a plane costs 3 floats
+        const long long blockPixels = srl::CustomFrameBuffer<float>::planeBlockSize * srl::CustomFrameBuffer<float>::planeBlockSize;
+        long long planePixels = stats.fragments.planeBlocks * blockPixels;
+        double bytes = double(stats.fragments.generated - planePixels + stats.fragments.written - planePixels +
+                              decompressedBlocks * blockPixels) * db.bytesPerValue() +
+                       stats.fragments.planeBlocks * 3.0 * sizeof(float);
+        std::printf("    depth %u bytes/value: %.1f%% blocks compressed at the end of the frame, %lld planes written, "
+                    "%lld blocks decompressed, depth traffic about %.3f MB/frame\n", db.bytesPerValue(),
+                    100.0 * compressedBlocks / (double(db.blockCount()) * settings.frames),
+                    stats.fragments.planeBlocks / settings.frames, decompressedBlocks / settings.frames,
+                    bytes / settings.frames * 1e-6);
+    }
+
+    Image image = toImage(fb);
+    if (!settings.saveReferences.empty()) {
+        std::string path = settings.saveReferences + "/" + name + ".ppm";
+        if (!writePpm(path, image))
+            std::printf("    could not write %s\n", path.c_str());
+    }
+    if (settings.references.empty())
+        return true;
+
+    Image reference;
+    std::string path = settings.references + "/" + name;
+    if (!readPpm(path + ".ppm", reference) && !readPng(path + ".png", reference)) {
+        std::printf("    FAIL no reference image %s.ppm or .png\n", path.c_str());
+        return false;
+    }
+    int maxDifference;
+    int different = countDifferentPixels(image, reference, settings.tolerance, maxDifference);
+    if (different < 0) {
+        std::printf("    FAIL reference is %dx%d\n", reference.width, reference.height);
+        return false;
+    }
+    bool pass = different <= settings.maxDifferent * image.width * image.height;
+    std::printf("    %s %d different pixels, largest difference %d\n", pass ? "pass" : "FAIL", different, maxDifference);
+    return pass;
+}
+
+// fill rule check
+// ---------------
+
+// a mesh in window coordinates, on the grid of positions of the rasterizer (1/16 of a pixel with sub-pixel
+// rasterization, whole pixels otherwise), so that the orientation of its triangles can be computed exactly
+struct WindowMesh {
+    std::vector<glm::dvec2> positions;
+    std::vector<int> indices;
+};
+
+// a fixed linear congruential generator, so every run checks the same meshes
+struct Random {
+    std::uint32_t state;
+    explicit Random(std::uint32_t seed) : state(seed * 2654435761u + 12345u) {}
+    // in [0, 1)
+    double operator()() {
+        state = state * 1664525u + 1013904223u;
+        return double(state >> 8) / double(1u << 24);
+    }
+};
+
+// twice the signed area of triangle t of the mesh, positive if it is counterclockwise
+double signedArea(const WindowMesh &mesh, int t) {
+    glm::dvec2 a = mesh.positions[mesh.indices[3 * t]];
+    glm::dvec2 b = mesh.positions[mesh.indices[3 * t + 1]];
+    glm::dvec2 c = mesh.positions[mesh.indices[3 * t + 2]];
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+// quads of side spacing that cover the rectangle [0, width] x [0, height] and go past its borders, split along a
+// random diagonal into two triangles with random orientations. The vertices are moved at random, except every
+// fourth row and column which stay straight (on the centers of the pixels when the spacing is a whole number), and
+// rounded to the grid of subpixels positions per pixel. Each coordinate moves by at most a fifth of the spacing,
+// rounding included, so the triangles never fold over each other
+WindowMesh makeWindowGrid(int width, int height, double spacing, int subpixels, Random &random) {
+    WindowMesh mesh;
+    int columns = int(std::ceil(width / spacing)) + 2, rows = int(std::ceil(height / spacing)) + 2;
+    double jitter = std::max(0.0, .2 * spacing - .5 / subpixels);
+    for (int j = 0; j <= rows; j++) {
+        for (int i = 0; i <= columns; i++) {
+            glm::dvec2 p((i - 1) * spacing, (j - 1) * spacing);
+            double jitterX = (random() - .5) * 2.0 * jitter, jitterY = (random() - .5) * 2.0 * jitter;
+            if (i % 4 != 0)
+                p.x += jitterX;
+            if (j % 4 != 0)
+                p.y += jitterY;
+            mesh.positions.push_back(glm::round(p * double(subpixels)) / double(subpixels));
+        }
+    }
+    for (int j = 0; j < rows; j++) {
+        for (int i = 0; i < columns; i++) {
+            int v00 = i + j * (columns + 1), v10 = v00 + 1, v01 = v00 + columns + 1, v11 = v01 + 1;
+            int quad[6] = {v00, v10, v11, v00, v11, v01};
+            if (random() < .5) {
+                int other[6] = {v00, v10, v01, v10, v11, v01};
+                std::copy(other, other + 6, quad);
+            }
+            for (int t = 0; t < 2; t++) {
+                if (random() < .5)
+                    std::swap(quad[3 * t + 1], quad[3 * t + 2]);
+                mesh.indices.insert(mesh.indices.end(), quad + 3 * t, quad + 3 * t + 3);
+            }
+        }
+    }
+    return mesh;
+}
+
+// closed sphere with stacks rows and 2 * stacks columns of quads, with a random rotation, projected orthographically
+// to a disc in the middle of the rectangle [0, width] x [0, height]. Each vertex is shared by its triangles, moved by
+// up to a fifth of a pixel and rounded to the grid of subpixels positions per pixel
+WindowMesh makeWindowSphere(int width, int height, int stacks, int subpixels, Random &random) {
+    const double pi = 3.14159265358979;
+    int slices = 2 * stacks;
+    glm::dvec3 axis = glm::normalize(glm::dvec3(random() - .5, random() - .5, random() - .5) + glm::dvec3(1e-3));
+    double angle = 2.0 * pi * random();
+    glm::dvec2 center(width * (.4 + .2 * random()), height * (.4 + .2 * random()));
+    double radius = std::min(width, height) * (.3 + .15 * random());
+
+    WindowMesh mesh;
+    auto addVertex = [&](double theta, double phi) {
+        glm::dvec3 p(std::sin(theta) * std::cos(phi), std::cos(theta), -std::sin(theta) * std::sin(phi));
+        // Rodrigues' rotation formula
+        p = p * std::cos(angle) + glm::cross(axis, p) * std::sin(angle) + axis * glm::dot(axis, p) * (1.0 - std::cos(angle));
+        glm::dvec2 w = center + radius * glm::dvec2(p) + (glm::dvec2(random(), random()) - .5) * .4;
+        mesh.positions.push_back(glm::round(w * double(subpixels)) / double(subpixels));
+    };
+    // the poles, then the rows between them
+    addVertex(0.0, 0.0);
+    addVertex(pi, 0.0);
+    for (int i = 1; i < stacks; i++)
+        for (int j = 0; j < slices; j++)
+            addVertex(pi * i / stacks, 2.0 * pi * j / slices);
+    auto vertex = [&](int stack, int slice) {
+        return stack == 0 ? 0 : stack == stacks ? 1 : 2 + (stack - 1) * slices + slice % slices;
+    };
+
+    for (int i = 0; i < stacks; i++) {
+        for (int j = 0; j < slices; j++) {
+            int quad[6] = {vertex(i, j), vertex(i + 1, j), vertex(i + 1, j + 1),
+                           vertex(i, j), vertex(i + 1, j + 1), vertex(i, j + 1)};
+            for (int t = 0; t < 2; t++) {
+                // the triangles at the poles that collapse to a line
+                if (quad[3 * t] == quad[3 * t + 1] || quad[3 * t + 1] == quad[3 * t + 2] || quad[3 * t] == quad[3 * t + 2])
+                    continue;
+                mesh.indices.insert(mesh.indices.end(), quad + 3 * t, quad + 3 * t + 3);
+            }
+        }
+    }
+    return mesh;
+}
+
+// rasterize the triangles of mesh with renderer, in screen tiles of renderer.m_tileSize pixels with tiled, and add
+// to counts, for each pixel, 1 for each counterclockwise triangle and -1 for each clockwise triangle that covers it
+// (1 for every triangle without signedCoverage)
+void coverMesh(srl::TriangleRenderer &renderer, const WindowMesh &mesh, int width, int height, bool tiled,
+               bool signedCoverage, std::vector<int> &counts) {
+    int tileSize = tiled ? renderer.m_tileSize : std::max(width, height);
+    for (int t = 0, count = int(mesh.indices.size() / 3); t < count; t++) {
+        int sign = signedCoverage && signedArea(mesh, t) < 0 ? -1 : 1;
+        glm::dvec2 p[3];
+        glm::vec4 window[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = mesh.positions[mesh.indices[3 * t + k]];
+            window[k] = glm::vec4(float(p[k].x), float(p[k].y), 0.0f, 1.0f);
+        }
+        glm::dvec2 bMin = glm::min(glm::min(p[0], p[1]), p[2]), bMax = glm::max(glm::max(p[0], p[1]), p[2]);
+        int xBegin = std::max(0, int(std::floor(bMin.x)) / tileSize), xEnd = std::min(width - 1, int(std::ceil(bMax.x))) / tileSize;
+        int yBegin = std::max(0, int(std::floor(bMin.y)) / tileSize), yEnd = std::min(height - 1, int(std::ceil(bMax.y))) / tileSize;
+        for (int ty = yBegin; ty <= yEnd; ty++) {
+            for (int tx = xBegin; tx <= xEnd; tx++) {
+                int xMin = tx * tileSize, yMin = ty * tileSize;
+                int xMax = std::min(width, xMin + tileSize) - 1, yMax = std::min(height, yMin + tileSize) - 1;
+                renderer.forEachCoveredPixel(window[0], window[1], window[2], xMin, yMin, xMax, yMax, [&](glm::ivec2 pxl) {
+                    counts[pxl.x + pxl.y * width] += sign;
+                });
+            }
+        }
+    }
+}
+
+// check that the rasterizers cover every pixel exactly once with meshes of triangles that share their edges: the
+// jittered grids that cover the screen must cover each pixel once (not twice, and without holes), and a closed mesh
+// must cover each pixel with as many counterclockwise triangles as clockwise ones. Each rasterization path is
+// checked with the grids and spheres made from seeds random seeds. Returns false if any pixel is wrong
+bool checkCoverage(int seeds) {
+    struct Configuration {
+        const char *name;
+        bool subpixel, edge, small, tiled;
+    };
+    const Configuration configurations[] = {
+            {"subpixel", true, true, false, false},
+            {"subpixel,small", true, true, true, false},
+            {"subpixel,tiled", true, true, false, true},
+            {"subpixel,small,tiled", true, true, true, true},
+            {"edge", false, true, false, false},
+            {"edge,small", false, true, true, false},
+            {"edge,small,tiled", false, true, true, true},
+            {"scanline", false, false, false, false},
+            {"scanline,small,tiled", false, false, true, true},
+    };
+    // not a multiple of the tile size
+    const int width = 253, height = 189;
+    const double subpixelSpacings[] = {1.3, 2.0, 3.7, 8.0, 21.3, 64.0};
+    const double pixelSpacings[] = {3.0, 5.0, 8.0, 21.0};
+    const int stacks[] = {12, 48, 160};
+
+    bool pass = true;
+    std::vector<int> counts(width * height);
+    for (auto &configuration : configurations) {
+        srl::TriangleRenderer renderer;
+        renderer.m_subpixelRasterization = configuration.subpixel;
+        renderer.m_edgeFunctionRasterizer = configuration.edge;
+        renderer.m_smallTriangles = configuration.small;
+        int subpixels = configuration.subpixel ? 1 << srl::TriangleRenderer::subpixelBits : 1;
+
+        long long triangles = 0, pixels = 0, twice = 0, holes = 0, unbalanced = 0;
+        for (int seed = 0; seed < seeds; seed++) {
+            Random random((std::uint32_t) seed);
+            int spacingCount = configuration.subpixel ? 6 : 4;
+            for (int s = 0; s < spacingCount; s++) {
+                double spacing = configuration.subpixel ? subpixelSpacings[s] : pixelSpacings[s];
+                WindowMesh grid = makeWindowGrid(width, height, spacing, subpixels, random);
+                std::fill(counts.begin(), counts.end(), 0);
+                coverMesh(renderer, grid, width, height, configuration.tiled, false, counts);
+                triangles += grid.indices.size() / 3;
+                for (int count : counts) {
+                    pixels += count;
+                    twice += count > 1;
+                    holes += count == 0;
+                }
+            }
+            for (int stack : stacks) {
+                WindowMesh sphere = makeWindowSphere(width, height, stack, subpixels, random);
+                std::fill(counts.begin(), counts.end(), 0);
+                coverMesh(renderer, sphere, width, height, configuration.tiled, true, counts);
+                triangles += sphere.indices.size() / 3;
+                for (int count : counts)
+                    unbalanced += count != 0;
+            }
+        }
+        bool configurationPass = twice == 0 && holes == 0 && unbalanced == 0;
+        std::printf("%s %-24s %lld triangles, %lld pixels, %lld covered twice, %lld holes, %lld unbalanced pixels of "
+                    "closed meshes\n", configurationPass ? "pass" : "FAIL", configuration.name, triangles, pixels,
+                    twice, holes, unbalanced);
+        pass = configurationPass && pass;
+    }
+    return pass;
+}
+
+bool parseArguments(int argc, char **argv, BenchmarkSettings &settings) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "missing value of " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--renderer")
+            settings.renderers = value == "all" ? std::vector<std::string>{"point", "line", "triangle"}
+                                                : split(value, ',');
+        else if (arg == "--resolution") {
+            settings.resolutions.clear();
+            for (auto &size : split(value, ',')) {
+                glm::ivec2 resolution(0);
+                if (std::sscanf(size.c_str(), "%dx%d", &resolution.x, &resolution.y) != 2 ||
+                    resolution.x < 1 || resolution.y < 1 || resolution.x > 3840 || resolution.y > 2160) {
+                    std::cerr << "invalid resolution " << size << std::endl;
+                    return false;
+                }
+                settings.resolutions.push_back(resolution);
+            }
+        }
+        else if (arg == "--mesh")
+            settings.mesh = value;
+        else if (arg == "--camera")
+            settings.camera = value;
+        else if (arg == "--frames")
+            settings.frames = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--instances")
+            settings.instances = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--options")
+            settings.options = split(value, ',');
+        else if (arg == "--threads")
+            settings.threads = (unsigned int) std::max(0, std::atoi(value.c_str()));
+        else if (arg == "--save-references")
+            settings.saveReferences = value;
+        else if (arg == "--references")
+            settings.references = value;
+        else if (arg == "--tolerance")
+            settings.tolerance = std::atoi(value.c_str());
+        else if (arg == "--max-different")
+            settings.maxDifferent = std::atof(value.c_str());
+        else if (arg == "--stats")
+            settings.stats = value;
+        else if (arg == "--check-coverage")
+            settings.checkCoverage = std::max(1, std::atoi(value.c_str()));
+        else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    BenchmarkSettings settings;
+    if (!parseArguments(argc, argv, settings))
+        return 2;
+    if (settings.checkCoverage > 0)
+        return checkCoverage(settings.checkCoverage) ? 0 : 1;
+
+    std::vector<srl::vertex> vts;
+    if (!makeMesh(settings.mesh, vts)) {
+        std::cerr << "could not make mesh " << settings.mesh << std::endl;
+        return 2;
+    }
+    std::printf("mesh %s, %d triangles, camera %s, %d frames\n", settings.mesh.c_str(), int(vts.size() / 3),
+                settings.camera.c_str(), settings.frames);
+
+    std::vector<std::uint32_t> indices;
+    bool indexed = hasOption(settings, "indexed");
+    if (indexed) {
+        std::vector<srl::vertex> shared;
+        indexMesh(vts, shared, indices);
+        vts.swap(shared);
+        std::printf("indexed, %d vertices\n", int(vts.size()));
+    }
+
+    // the vertices as a point cloud, for the point renderer
+    srl::PointCloud cloud;
+    bool drawCloud = hasOption(settings, "cloud");
+    if (drawCloud) {
+        cloud.positions.reserve(vts.size());
+        cloud.colors.reserve(vts.size());
+        for (auto &v : vts) {
+            cloud.positions.push_back(glm::vec3(v.pos));
+            cloud.colors.push_back(srl::Colors::toRGBA32(v.col));
+        }
+    }
+
+    srl::PointRenderer pointRenderer;
+    srl::LineRenderer lineRenderer;
+    srl::TriangleRenderer triangleRenderer;
+    configureTriangleRenderer(triangleRenderer, settings);
+    lineRenderer.m_batchedLines = hasOption(settings, "batched");
+    lineRenderer.m_antialiasing = hasOption(settings, "aa");
+    pointRenderer.m_fillHoles = hasOption(settings, "holes");
+
+    std::ofstream statsFile;
+    if (!settings.stats.empty()) {
+        statsFile.open(settings.stats);
+        if (!statsFile) {
+            std::cerr << "could not write " << settings.stats << std::endl;
+            return 2;
+        }
+    }
+
+    bool pass = true;
+    for (auto &rendererName : settings.renderers) {
+        srl::Renderer *renderer = rendererName == "point" ? (srl::Renderer *) &pointRenderer
+                                : rendererName == "line" ? (srl::Renderer *) &lineRenderer
+                                : rendererName == "triangle" ? (srl::Renderer *) &triangleRenderer : nullptr;
+        if (!renderer) {
+            std::cerr << "unknown renderer " << rendererName << std::endl;
+            return 2;
+        }
+        renderer->m_threadCount = settings.threads;
+        renderer->m_parallelGeometry = hasOption(settings, "geometry");
+        for (auto resolution : settings.resolutions)
+            pass = runConfiguration(*renderer, rendererName, vts, indexed ? &indices : nullptr,
+                                    drawCloud ? &cloud : nullptr, resolution, settings,
+                                    statsFile.is_open() ? &statsFile : nullptr) && pass;
+    }
+    return pass ? 0 : 1;
+}
@@ -8,6 +8,9 @@
 #include "srl_point_renderer.h"
 #include "srl_line_renderer.h"
 #include "srl_triangle_renderer.h"
+#include "srl_frame_pipeline.h"
+#include "srl_shader_pipeline.h"
+#include "srl_texture.h"
 #include "primitives.h"
 
 // glfw callbacks
@@ -33,6 +36,62 @@ srl::PointRenderer pRenderer;
 srl::LineRenderer lRenderer;
 srl::TriangleRenderer tRenderer;
 srl::Renderer* srlRenderer = &tRenderer;
+// render from the structure of arrays copy of the model
+bool useVertexStream = false;
+// render from the indexed copy of the model
+bool useIndices = false;
+
+// example of a shader pipeline, with per pixel diffuse lighting and an optional texture.
+// Only the color, the normal and the texture coordinates are interpolated
+struct LitVaryings {
+    glm::vec4 col;
+    glm::vec3 normal;
+    glm::vec2 uv;
+};
+
+struct LitVertexShader {
+    glm::mat4 model, viewProj;
+
+    glm::vec4 operator()(const srl::vertex &in, LitVaryings &out) const {
+        out.col = in.col;
+        out.normal = glm::vec3(model * in.norm);
+        out.uv = in.uv;
+        return viewProj * model * in.pos;
+    }
+};
+
+struct LitFragmentShader {
+    glm::vec3 lightDirection = glm::normalize(glm::vec3(.5f, 1.f, 1.f));
+    // multiplies the vertex color if not null
+    const srl::Texture *texture = nullptr;
+
+    // takes the derivatives of the varyings, to choose the mip map of the texture
+    srl::Colors::color operator()(const LitVaryings &in, const srl::FragmentDerivatives<LitVaryings> &d) const {
+        glm::vec4 col = in.col;
+        if (texture)
+            col *= texture->sample(in.uv, d.ddx(&LitVaryings::uv), d.ddy(&LitVaryings::uv));
+        float diffuse = glm::max(glm::dot(glm::normalize(in.normal), lightDirection), 0.f);
+        return glm::vec4(glm::vec3(col) * (.3f + .7f * diffuse), col.a);
+    }
+};
+
+srl::ShaderPipeline<LitVaryings, LitVertexShader, LitFragmentShader> litPipeline;
+// render with litPipeline instead of srlRenderer
+bool useShaderPipeline = false;
+// texture of litPipeline, and whether it is used
+srl::Texture checkerTexture;
+std::vector<std::uint32_t> checkerImage;
+bool useTexture = false;
+// samples per pixel of the frame buffers
+unsigned int sampleCount = 1;
+// format of the depth buffers, and whether their blocks are compressed to planes (with one sample per pixel)
+srl::DepthFormat depthFormat = srl::DepthFormat::float32;
+bool planeCompression = false;
+
+// the frames are recorded and shown by the main loop, their vertices are processed and they are rasterized on two
+// other threads. With a latency of one frame, a frame is shown while the next one is rendered. It is created by
+// main, so that its threads don't start before main
+srl::FramePipeline *framePipeline = nullptr;
 
 int main()
 {
@@ -89,6 +148,43 @@ int main()
         };
         vtsCube.push_back(v);
     }
+    srl::VertexStream streamCube(vtsCube);
+
+    // translucent version of the cube for order-independent transparency, with the faces in both windings so that
+    // the back faces show through the front ones
+    std::vector<srl::vertex> vtsGlass;
+    for (unsigned int i = 0; i < vtsCube.size(); i++) {
+        srl::vertex v = vtsCube[i];
+        v.col.a = .4f;
+        vtsGlass.push_back(v);
+    }
+    for (unsigned int i = 0; i < vtsCube.size(); i += 3) {
+        for (int k = 2; k >= 0; k--) {
+            srl::vertex v = vtsGlass[i + k];
+            v.norm = -v.norm;
+            vtsGlass.push_back(v);
+        }
+    }
+
+    // checkerboard texture for the shader pipeline, 8x8 squares on a 256x256 image
+    checkerImage.resize(256 * 256);
+    for (int y = 0; y < 256; y++)
+        for (int x = 0; x < 256; x++)
+            checkerImage[x + y * 256] = srl::Colors::toRGBA32(((x / 32 + y / 32) % 2) ? srl::Colors::white : srl::Colors::grey);
+    checkerTexture.setImage(256, 256, checkerImage.data());
+
+    // indexed version of the cube, vertices with the same attributes are only stored once
+    std::vector<srl::vertex> vtsCubeShared;
+    std::vector<std::uint16_t> idxCube;
+    for (auto &v : vtsCube){
+        unsigned int i = 0;
+        while (i < vtsCubeShared.size() && !(vtsCubeShared[i].pos == v.pos && vtsCubeShared[i].norm == v.norm &&
+                                             vtsCubeShared[i].col == v.col && vtsCubeShared[i].uv == v.uv))
+            i++;
+        if (i == vtsCubeShared.size())
+            vtsCubeShared.push_back(v);
+        idxCube.push_back(i);
+    }
 
 
     // camera
@@ -101,11 +197,12 @@ int main()
                                               glm::vec3(.0f, 1.f, .0f));
 
 
-    // initialize our custom frame buffer
-    // ----------------------------------
-    // every frame we will: draw to it, upload it to a texture, and copy the texture to the window frame buffer.
-    srl::CustomFrameBuffer<std::uint32_t> customBuffer(max_W, max_H);
-    srl::CustomFrameBuffer<float> customZBuffer(max_W, max_H);
+    // our custom frame buffers are the frames of framePipeline
+    // --------------------------------------------------------
+    // every frame we will: draw to one of them, upload it to a texture, and copy the texture to the window frame
+    // buffer.
+    srl::FramePipeline pipeline(max_W, max_H, 1);
+    framePipeline = &pipeline;
 
 
     // initialize texture we will use to upload our buffer to GPU
@@ -137,6 +234,26 @@ int main()
     std::cout << "1 - use point renderer" << std::endl;
     std::cout << "2 - use line renderer" << std::endl;
     std::cout << "3 - use triangle renderer" << std::endl;
+    std::cout << "4 - toggle tiled multithreaded rasterization (triangle renderer)" << std::endl;
+    std::cout << "5 - toggle edge function (block) rasterizer (triangle renderer)" << std::endl;
+    std::cout << "6 - toggle streaming fragments with early depth test (triangle renderer)" << std::endl;
+    std::cout << "7 - toggle hierarchical z-buffer (triangle renderer)" << std::endl;
+    std::cout << "8 - toggle structure of arrays vertex stream with SIMD vertex processing" << std::endl;
+    std::cout << "9 - toggle indexed drawing" << std::endl;
+    std::cout << "0 - toggle sub-pixel (fixed point) rasterization (triangle renderer)" << std::endl;
+    std::cout << "P - toggle plane equation interpolation (triangle renderer)" << std::endl;
+    std::cout << "V - toggle visibility buffer, each visible pixel is shaded once (triangle renderer)" << std::endl;
+    std::cout << "O - toggle order-independent transparency, with translucent cubes (triangle renderer)" << std::endl;
+    std::cout << "B - toggle batched line rasterization (line renderer)" << std::endl;
+    std::cout << "A - toggle antialiased (Wu) lines (line renderer)" << std::endl;
+    std::cout << "L - toggle shader pipeline with per pixel lighting" << std::endl;
+    std::cout << "T - cycle texture filtering of the shader pipeline (off, nearest, bilinear, trilinear)" << std::endl;
+    std::cout << "C - cycle texture format (RGBA8, BC1, BC3 block compression)" << std::endl;
+    std::cout << "M - cycle multisample anti-aliasing (1, 2, 4, 8 samples per pixel)" << std::endl;
+    std::cout << "D - cycle depth buffer format (float32, unorm24, unorm16)" << std::endl;
+    std::cout << "Z - toggle plane compression of the depth buffer blocks" << std::endl;
+    std::cout << "F - toggle the latency of the frame pipeline (0 or 1 frame)" << std::endl;
+    std::cout << "I - print the statistics of the last frame (stage timers and counters) as JSON" << std::endl;
 
     while (!glfwWindowShouldClose(window))
     {
@@ -145,34 +262,93 @@ int main()
         std::chrono::duration<float> appTime = frameStart - begin;
 
 
-        // render to our custom frame buffer
-        // ---------------------------------
-        customBuffer.clearBuffer(srl::Colors::toRGBA32(srl::Colors::black));
-        customZBuffer.clearBuffer(1.0f);
-
-        srlRenderer->render(vtsCube, trackballRotation() * storedRotation, viewProj, customBuffer, customZBuffer);
-
-        // show our rendered image
-        // -----------------------
-        // upload the custom color buffer to the GPU using the texture
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, bufferTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, max_W, max_H, 0, GL_RGBA, GL_UNSIGNED_BYTE, customBuffer.buffer);
-
-        // set opengl frame buffer object to read from our texture, we will copy from it
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, oglFrameBuffer);
-        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bufferTexture, 0);
-
-        // bind the window frame buffer, where we want to copy the contents of the texture to
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-
-        // copy from the frame buffer object (access the texture) to the window frame buffer
-        int size_W, size_H;
-        glfwGetFramebufferSize(window, &size_W, &size_H);
-        glBlitFramebuffer(0,0, max_W, max_H, 0, 0, size_W, size_H, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        // record the next frame
+        // ---------------------
+        // the frame is rendered by the other threads of framePipeline, while this thread shows the previous one
+        srl::FramePipeline::Frame &frame = framePipeline->beginFrame();
+        if (frame.colorBuffer.S != sampleCount) {
+            frame.colorBuffer.setSampleCount(sampleCount);
+            frame.depthBuffer.setSampleCount(sampleCount);
+        }
+        if (frame.depthBuffer.depthFormat() != depthFormat)
+            frame.depthBuffer.setDepthFormat(depthFormat);
+        frame.depthBuffer.setPlaneCompression(planeCompression);
+        frame.clearColor = srl::Colors::toRGBA32(srl::Colors::black);
+        frame.clearDepth = 1.0f;
+        frame.viewProj = viewProj;
+
+        glm::mat4 model = trackballRotation() * storedRotation;
+        if (!useShaderPipeline && useIndices)
+            frame.commands.draw(*srlRenderer, vtsCubeShared, idxCube, srl::Topology::triangleList, model);
+        else if (!useShaderPipeline && !useVertexStream)
+            frame.commands.draw(*srlRenderer, vtsCube, model);
+
+        // translucent cubes around the model, drawn in any order and blended in depth order
+        if (tRenderer.m_orderIndependentTransparency && srlRenderer == &tRenderer && !useShaderPipeline) {
+            for (int i = 0; i < 4; i++) {
+                glm::mat4 glassModel = model * glm::rotate(glm::radians(90.0f * i), glm::vec3(0.0f, 1.0f, 0.0f)) *
+                                       glm::translate(glm::vec3(1.2f, 0.0f, 0.0f)) * glm::scale(glm::vec3(.4f));
+                frame.commands.draw(tRenderer, vtsGlass, glassModel);
+            }
+        }
 
-        // display frame buffer
-        glfwSwapBuffers(window);
+        // the draws that don't go through the command buffer, and the resolves, run on the rasterization thread
+        // after the commands, with a copy of the settings of this frame
+        srl::Renderer *renderer = srlRenderer;
+        bool shaderPipeline = useShaderPipeline, vertexStream = useVertexStream && !useIndices;
+        const srl::Texture *texture = useTexture ? &checkerTexture : nullptr;
+        frame.finish = [=, &vtsCube, &streamCube](srl::FramePipeline::Frame &rendered) {
+            if (shaderPipeline) {
+                litPipeline.m_vertexShader.model = model;
+                litPipeline.m_vertexShader.viewProj = viewProj;
+                litPipeline.m_fragmentShader.texture = texture;
+                litPipeline.render(vtsCube, rendered.colorBuffer, rendered.depthBuffer);
+            }
+            else if (vertexStream)
+                renderer->render(streamCube, model, viewProj, rendered.colorBuffer, rendered.depthBuffer);
+
+            // shade the pixels of the visibility buffer and blend the translucent fragments
+            // (does nothing if they are not used)
+            tRenderer.resolveVisibility(rendered.colorBuffer);
+            tRenderer.resolveTransparency(rendered.colorBuffer, rendered.depthBuffer);
+
+            // average the samples of each pixel (does nothing without multisampling)
+            rendered.colorBuffer.resolve();
+        };
+        framePipeline->submitFrame(frame);
+
+        // show our rendered images
+        // ------------------------
+        // the frames that are done and must be shown to keep the latency, usually one (none for the first frame
+        // with a latency of one frame)
+        while (srl::FramePipeline::Frame *shown = framePipeline->acquirePresentFrame()) {
+            srl::CustomFrameBuffer<std::uint32_t> &customBuffer = shown->colorBuffer;
+
+            // upload the custom color buffer to the GPU using the texture
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, bufferTexture);
+            // the tiles that were not drawn are still only marked as cleared, and the rows are P pixels apart
+            customBuffer.materialize();
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, customBuffer.P);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, max_W, max_H, 0, GL_RGBA, GL_UNSIGNED_BYTE, customBuffer.buffer);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            framePipeline->releaseFrame(*shown);
+
+            // set opengl frame buffer object to read from our texture, we will copy from it
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, oglFrameBuffer);
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bufferTexture, 0);
+
+            // bind the window frame buffer, where we want to copy the contents of the texture to
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+            // copy from the frame buffer object (access the texture) to the window frame buffer
+            int size_W, size_H;
+            glfwGetFramebufferSize(window, &size_W, &size_H);
+            glBlitFramebuffer(0,0, max_W, max_H, 0, 0, size_W, size_H, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+            // display frame buffer
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
 
         // control render loop frequency (busy wait)
@@ -183,6 +359,9 @@ int main()
         glfwSetWindowTitle(window, ("Exercise 9 - FPS: " + std::to_string(int(1.0f/elapsed.count() + .5f))).c_str());
     }
 
+    // the frames in flight draw the vertices of this function
+    framePipeline->flush();
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -256,6 +435,10 @@ void button_input_callback(GLFWwindow* window, int button, int action, int mods)
 }
 
 void key_input_callback(GLFWwindow* window, int button, int other,int action, int mods){
+    // the renderers and the texture are used by the frame that is being rendered
+    if (action == GLFW_PRESS)
+        framePipeline->flush();
+
     if (button == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
@@ -268,6 +451,97 @@ void key_input_callback(GLFWwindow* window, int button, int other,int action, in
     if (button == GLFW_KEY_3 && action == GLFW_PRESS){
         srlRenderer = &tRenderer;
     }
+    if (button == GLFW_KEY_4 && action == GLFW_PRESS){
+        tRenderer.m_tiledRasterization = !tRenderer.m_tiledRasterization;
+        std::cout << "tiled rasterization " << (tRenderer.m_tiledRasterization ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_5 && action == GLFW_PRESS){
+        tRenderer.m_edgeFunctionRasterizer = !tRenderer.m_edgeFunctionRasterizer;
+        std::cout << "edge function rasterizer " << (tRenderer.m_edgeFunctionRasterizer ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_6 && action == GLFW_PRESS){
+        tRenderer.m_streamFragments = !tRenderer.m_streamFragments;
+        std::cout << "streaming fragments " << (tRenderer.m_streamFragments ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_7 && action == GLFW_PRESS){
+        tRenderer.m_hierarchicalZ = !tRenderer.m_hierarchicalZ;
+        std::cout << "hierarchical z-buffer " << (tRenderer.m_hierarchicalZ ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_8 && action == GLFW_PRESS){
+        useVertexStream = !useVertexStream;
+        std::cout << "vertex stream " << (useVertexStream ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_9 && action == GLFW_PRESS){
+        useIndices = !useIndices;
+        std::cout << "indexed drawing " << (useIndices ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_0 && action == GLFW_PRESS){
+        tRenderer.m_subpixelRasterization = !tRenderer.m_subpixelRasterization;
+        std::cout << "sub-pixel rasterization " << (tRenderer.m_subpixelRasterization ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_P && action == GLFW_PRESS){
+        tRenderer.m_planeInterpolation = !tRenderer.m_planeInterpolation;
+        std::cout << "plane equation interpolation " << (tRenderer.m_planeInterpolation ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_V && action == GLFW_PRESS){
+        tRenderer.m_visibilityBuffer = !tRenderer.m_visibilityBuffer;
+        std::cout << "visibility buffer " << (tRenderer.m_visibilityBuffer ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_O && action == GLFW_PRESS){
+        tRenderer.m_orderIndependentTransparency = !tRenderer.m_orderIndependentTransparency;
+        std::cout << "order-independent transparency " << (tRenderer.m_orderIndependentTransparency ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_M && action == GLFW_PRESS){
+        sampleCount = sampleCount == 8 ? 1 : sampleCount * 2;
+        std::cout << "multisample anti-aliasing " << sampleCount << "x" << std::endl;
+    }
+    if (button == GLFW_KEY_L && action == GLFW_PRESS){
+        useShaderPipeline = !useShaderPipeline;
+        std::cout << "shader pipeline " << (useShaderPipeline ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_T && action == GLFW_PRESS){
+        const char *names[] = {"nearest", "bilinear", "trilinear"};
+        if (!useTexture) {
+            useTexture = true;
+            checkerTexture.m_filter = srl::Texture::Filter::nearest;
+        }
+        else if (checkerTexture.m_filter == srl::Texture::Filter::trilinear)
+            useTexture = false;
+        else
+            checkerTexture.m_filter = srl::Texture::Filter(int(checkerTexture.m_filter) + 1);
+        std::cout << "texture " << (useTexture ? names[int(checkerTexture.m_filter)] : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_C && action == GLFW_PRESS){
+        const char *names[] = {"RGBA8", "BC1", "BC3"};
+        auto format = srl::Texture::Format((int(checkerTexture.format()) + 1) % 3);
+        checkerTexture.setImage(256, 256, checkerImage.data(), format);
+        std::cout << "texture format " << names[int(format)] << ", " << checkerTexture.sizeInBytes() / 1024
+                  << " KB" << std::endl;
+    }
+    if (button == GLFW_KEY_D && action == GLFW_PRESS){
+        const char *names[] = {"float32", "unorm24", "unorm16"};
+        depthFormat = srl::DepthFormat((int(depthFormat) + 1) % 3);
+        std::cout << "depth buffer format " << names[int(depthFormat)] << std::endl;
+    }
+    if (button == GLFW_KEY_Z && action == GLFW_PRESS){
+        planeCompression = !planeCompression;
+        std::cout << "depth plane compression " << (planeCompression ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_B && action == GLFW_PRESS){
+        lRenderer.m_batchedLines = !lRenderer.m_batchedLines;
+        std::cout << "batched lines " << (lRenderer.m_batchedLines ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_A && action == GLFW_PRESS){
+        lRenderer.m_antialiasing = !lRenderer.m_antialiasing;
+        std::cout << "antialiased lines " << (lRenderer.m_antialiasing ? "on" : "off") << std::endl;
+    }
+    if (button == GLFW_KEY_F && action == GLFW_PRESS){
+        framePipeline->setLatency(1 - framePipeline->latency());
+        std::cout << "frame pipeline latency " << framePipeline->latency() << " frame" << std::endl;
+    }
+    if (button == GLFW_KEY_I && action == GLFW_PRESS){
+        std::cout << srlRenderer->stats().toJson() << std::endl;
+    }
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -0,0 +1,368 @@
+#include "edgefunctionrasterizer.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EDGE_FUNCTION_RASTERIZER_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+ * \class edge_function_rasterizer
+ * A class which scanconverts a triangle using edge functions (half-spaces).
+ */
+
+namespace {
+    const std::uint64_t all_pixels_mask = ~std::uint64_t(0);
+
+    // index of the lowest bit set in a non-zero mask
+    inline int lowest_bit(std::uint64_t mask)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(mask);
+#else
+        int i = 0;
+        while (!(mask & 1)) { mask >>= 1; i++; }
+        return i;
+#endif
+    }
+
+    // mask with the columns [i_lo, i_hi] of every row of a block
+    inline std::uint64_t column_mask(int i_lo, int i_hi)
+    {
+        std::uint64_t row = ((2u << i_hi) - 1u) & ~((1u << i_lo) - 1u);
+        return row * 0x0101010101010101ull;
+    }
+
+    // mask with the rows [j_lo, j_hi] of a block
+    inline std::uint64_t row_mask(int j_lo, int j_hi)
+    {
+        std::uint64_t mask = 0;
+        for (int j = j_lo; j <= j_hi; j++)
+            mask |= std::uint64_t(0xFF) << (8 * j);
+        return mask;
+    }
+}
+
+/*
+ * Parameterized constructor creates an instance of an edge function rasterizer
+ */
+edge_function_rasterizer::edge_function_rasterizer(int x1, int y1, int x2, int y2, int x3, int y3) : valid(false)
+{
+    this->initialize_triangle(x1, y1, x2, y2, x3, y3, INT_MIN, INT_MIN, INT_MAX, INT_MAX, 0);
+}
+
+/*
+ * Parameterized constructor creates an instance of an edge function rasterizer which only generates the
+ * pixels inside the rectangle [x_min, x_max] x [y_min, y_max] (scissor test)
+ */
+edge_function_rasterizer::edge_function_rasterizer(int x1, int y1, int x2, int y2, int x3, int y3,
+                                                   int x_min, int y_min, int x_max, int y_max) : valid(false)
+{
+    this->initialize_triangle(x1, y1, x2, y2, x3, y3, x_min, y_min, x_max, y_max, 0);
+}
+
+/*
+ * Parameterized constructor creates an instance of an edge function rasterizer with sub-pixel precision,
+ * the coordinates of the vertices are fixed point numbers with subpixel_bits fractional bits
+ */
+edge_function_rasterizer::edge_function_rasterizer(int x1, int y1, int x2, int y2, int x3, int y3,
+                                                   int x_min, int y_min, int x_max, int y_max,
+                                                   int subpixel_bits) : valid(false)
+{
+    this->initialize_triangle(x1, y1, x2, y2, x3, y3, x_min, y_min, x_max, y_max, subpixel_bits);
+}
+
+/*
+ * Destroys the current instance of the edge function rasterizer
+ */
+edge_function_rasterizer::~edge_function_rasterizer()
+{}
+
+/*
+ * Returns a vector which contains all the pixels inside the triangle
+ */
+std::vector<glm::ivec2> edge_function_rasterizer::all_pixels()
+{
+    std::vector<glm::ivec2> points;
+
+    while (this->more_fragments()) {
+        points.push_back(glm::ivec2(this->x(), this->y()));
+        this->next_fragment();
+    }
+
+    return points;
+}
+
+/*
+ * Checks if there are fragments/pixels inside the triangle ready for use
+ */
+bool edge_function_rasterizer::more_fragments() const
+{
+    return this->valid;
+}
+
+/*
+ * Computes the next fragment inside the triangle
+ */
+void edge_function_rasterizer::next_fragment()
+{
+    // clear the lowest bit, which is the current fragment
+    this->remaining &= this->remaining - 1;
+    if (this->remaining == 0)
+        this->next_block();
+}
+
+/*
+ * Returns the current x-coordinate of the current fragment/pixel inside the triangle
+ */
+int edge_function_rasterizer::x() const
+{
+    if (!this->valid) {
+        throw std::runtime_error("edge_function_rasterizer::x(): Invalid State/Not Initialized");
+    }
+    return this->block_x_current + (lowest_bit(this->remaining) & (block_size - 1));
+}
+
+/*
+ * Returns the current y-coordinate of the current fragment/pixel inside the triangle
+ */
+int edge_function_rasterizer::y() const
+{
+    if (!this->valid) {
+        throw std::runtime_error("edge_function_rasterizer::y(): Invalid State/Not Initialized");
+    }
+    return this->block_y_current + lowest_bit(this->remaining) / block_size;
+}
+
+/*
+ * Checks if there is a block with at least one pixel inside the triangle ready for use
+ */
+bool edge_function_rasterizer::more_blocks() const
+{
+    return this->valid;
+}
+
+/*
+ * Computes the next block with at least one pixel inside the triangle
+ */
+void edge_function_rasterizer::next_block()
+{
+    int bx = this->block_x_current;
+    int by = this->block_y_current;
+    int bx_first = this->x_lo & ~(block_size - 1);
+
+    do {
+        bx += block_size;
+        if (bx > this->x_hi) {
+            bx = bx_first;
+            by += block_size;
+            if (by > this->y_hi) {
+                this->valid = false;
+                this->block_coverage = this->remaining = 0;
+                return;
+            }
+        }
+        this->block_coverage = this->coverage(bx, by);
+    } while (this->block_coverage == 0);
+
+    this->block_x_current = bx;
+    this->block_y_current = by;
+    this->remaining = this->block_coverage;
+    this->valid = true;
+}
+
+/*
+ * Returns the x-coordinate of the lower left pixel of the current block
+ */
+int edge_function_rasterizer::block_x() const
+{
+    if (!this->valid) {
+        throw std::runtime_error("edge_function_rasterizer::block_x(): Invalid State/Not Initialized");
+    }
+    return this->block_x_current;
+}
+
+/*
+ * Returns the y-coordinate of the lower left pixel of the current block
+ */
+int edge_function_rasterizer::block_y() const
+{
+    if (!this->valid) {
+        throw std::runtime_error("edge_function_rasterizer::block_y(): Invalid State/Not Initialized");
+    }
+    return this->block_y_current;
+}
+
+/*
+ * Returns the coverage mask of the current block
+ */
+std::uint64_t edge_function_rasterizer::block_mask() const
+{
+    return this->block_coverage;
+}
+
+/*
+ * Checks if all the pixels of the current block are inside the triangle
+ */
+bool edge_function_rasterizer::block_fully_covered() const
+{
+    return this->block_coverage == all_pixels_mask;
+}
+
+/*
+ * Sets up the edge functions of the triangle and finds the first block
+ */
+void edge_function_rasterizer::initialize_triangle(int x1, int y1, int x2, int y2, int x3, int y3,
+                                                   int x_min, int y_min, int x_max, int y_max, int subpixel_bits)
+{
+    this->block_coverage = this->remaining = 0;
+
+    // twice the signed area of the triangle, positive if the vertices are in counterclockwise order
+    std::int64_t area = std::int64_t(x2 - x1) * (y3 - y1) - std::int64_t(y2 - y1) * (x3 - x1);
+    if (area == 0) {
+        // degenerated triangle, no pixels
+        this->valid = false;
+        return;
+    }
+    // the edge functions below assume counterclockwise order, swapping two vertices doesn't change the pixels
+    if (area < 0) {
+        std::swap(x2, x3);
+        std::swap(y2, y3);
+    }
+
+    const int vx[3] = {x1, x2, x3};
+    const int vy[3] = {y1, y2, y3};
+    for (int i = 0; i < 3; i++) {
+        int j = (i + 1) % 3;
+        std::int64_t dx = std::int64_t(vx[j]) - vx[i];
+        std::int64_t dy = std::int64_t(vy[j]) - vy[i];
+
+        // E(x, y) = (x_j - x_i) * (y - y_i) - (y_j - y_i) * (x - x_i) is positive to the left of the edge i->j
+        // pixel (x, y) is at the fixed point coordinates (x << subpixel_bits, y << subpixel_bits), so a and b are
+        // scaled to step one pixel at a time
+        this->a[i] = -dy * (std::int64_t(1) << subpixel_bits);
+        this->b[i] = dx * (std::int64_t(1) << subpixel_bits);
+        this->c[i] = dy * vx[i] - dx * vy[i];
+
+        // fill rule: with counterclockwise order, edges going down are left edges and horizontal edges going
+        // right are bottom edges. Pixels exactly on those edges are inside (E >= 0), pixels on the other
+        // edges are outside (E > 0, or E - 1 >= 0 since E is an integer)
+        bool left_or_bottom = dy < 0 || (dy == 0 && dx > 0);
+        if (!left_or_bottom)
+            this->c[i] -= 1;
+    }
+
+    // pixels that can be inside the triangle, the first pixel at or after the smallest coordinate
+    // and the last pixel at or before the largest one (>> rounds down, also for negative numbers)
+    const int one = 1 << subpixel_bits;
+    this->x_lo = std::max((std::min({x1, x2, x3}) + one - 1) >> subpixel_bits, x_min);
+    this->y_lo = std::max((std::min({y1, y2, y3}) + one - 1) >> subpixel_bits, y_min);
+    this->x_hi = std::min(std::max({x1, x2, x3}) >> subpixel_bits, x_max);
+    this->y_hi = std::min(std::max({y1, y2, y3}) >> subpixel_bits, y_max);
+    if (this->x_lo > this->x_hi || this->y_lo > this->y_hi) {
+        this->valid = false;
+        return;
+    }
+
+    // start one block before the first block, next_block will move to the first block with coverage
+    this->block_x_current = (this->x_lo & ~(block_size - 1)) - block_size;
+    this->block_y_current = this->y_lo & ~(block_size - 1);
+    this->next_block();
+}
+
+/*
+ * Computes the coverage mask of the block at (bx, by)
+ */
+std::uint64_t edge_function_rasterizer::coverage(int bx, int by) const
+{
+    const int last = block_size - 1;
+
+    std::int64_t e[3];
+    int edge_list[3];
+    int edge_count = 0;
+
+    for (int i = 0; i < 3; i++) {
+        e[i] = this->a[i] * bx + this->b[i] * by + this->c[i];
+
+        // smallest and largest values of the edge function in the block (which are at two of its corners)
+        std::int64_t e_min = e[i] + std::min<std::int64_t>(0, this->a[i] * last) + std::min<std::int64_t>(0, this->b[i] * last);
+        std::int64_t e_max = e[i] + std::max<std::int64_t>(0, this->a[i] * last) + std::max<std::int64_t>(0, this->b[i] * last);
+
+        if (e_max < 0) {
+            // the whole block is outside this edge (trivial reject)
+            return 0;
+        }
+        if (e_min < 0) {
+            // the edge crosses the block, so we need to test its pixels
+            edge_list[edge_count++] = i;
+        }
+        // else the whole block is inside this edge (trivial accept)
+    }
+
+    std::uint64_t mask = edge_count == 0 ? all_pixels_mask : this->test_pixels(e, edge_list, edge_count);
+
+    // remove the pixels outside the bounds (only needed for the blocks on the border of the scissor rectangle)
+    if (bx < this->x_lo || bx + last > this->x_hi)
+        mask &= column_mask(std::max(this->x_lo - bx, 0), std::min(this->x_hi - bx, last));
+    if (by < this->y_lo || by + last > this->y_hi)
+        mask &= row_mask(std::max(this->y_lo - by, 0), std::min(this->y_hi - by, last));
+
+    return mask;
+}
+
+/*
+ * Tests all the pixels of a block against the edges in edge_list
+ * The edges cross the block, so the values inside the block are small enough for 32 bits integers
+ */
+std::uint64_t edge_function_rasterizer::test_pixels(const std::int64_t e[3], const int edge_list[3], int edge_count) const
+{
+    std::uint64_t mask = 0;
+
+#ifdef EDGE_FUNCTION_RASTERIZER_SSE2
+    // two groups of four pixels per row, one lane per pixel
+    __m128i row_lo[3], row_hi[3], step_y[3];
+    for (int k = 0; k < edge_count; k++) {
+        int i = edge_list[k];
+        int ea = int(this->a[i]);
+        row_lo[k] = _mm_add_epi32(_mm_set1_epi32(int(e[i])), _mm_set_epi32(3 * ea, 2 * ea, ea, 0));
+        row_hi[k] = _mm_add_epi32(row_lo[k], _mm_set1_epi32(4 * ea));
+        step_y[k] = _mm_set1_epi32(int(this->b[i]));
+    }
+
+    for (int j = 0; j < block_size; j++) {
+        // a pixel is outside if the sign bit of any of the edge functions is set
+        __m128i outside_lo = row_lo[0];
+        __m128i outside_hi = row_hi[0];
+        for (int k = 1; k < edge_count; k++) {
+            outside_lo = _mm_or_si128(outside_lo, row_lo[k]);
+            outside_hi = _mm_or_si128(outside_hi, row_hi[k]);
+        }
+        int outside = _mm_movemask_ps(_mm_castsi128_ps(outside_lo)) | (_mm_movemask_ps(_mm_castsi128_ps(outside_hi)) << 4);
+        mask |= std::uint64_t(~outside & 0xFF) << (j * block_size);
+
+        for (int k = 0; k < edge_count; k++) {
+            row_lo[k] = _mm_add_epi32(row_lo[k], step_y[k]);
+            row_hi[k] = _mm_add_epi32(row_hi[k], step_y[k]);
+        }
+    }
+#else
+    int row[3];
+    for (int k = 0; k < edge_count; k++)
+        row[k] = int(e[edge_list[k]]);
+
+    for (int j = 0; j < block_size; j++) {
+        for (int i = 0; i < block_size; i++) {
+            int outside = 0;
+            for (int k = 0; k < edge_count; k++)
+                outside |= row[k] + int(this->a[edge_list[k]]) * i;
+            if (outside >= 0)
+                mask |= std::uint64_t(1) << (i + j * block_size);
+        }
+        for (int k = 0; k < edge_count; k++)
+            row[k] += int(this->b[edge_list[k]]);
+    }
+#endif
+
+    return mask;
+}
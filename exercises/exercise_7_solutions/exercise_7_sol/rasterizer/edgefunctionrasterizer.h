@@ -0,0 +1,206 @@
+#ifndef __EDGE_FUNCTION_RASTERIZER_H__
+#define __EDGE_FUNCTION_RASTERIZER_H__
+
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdint>
+#include <climits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/**
+ * \class edge_function_rasterizer
+ * A class which scanconverts a triangle using edge functions (half-spaces).
+ * Instead of walking the edges one scanline at a time, it tests square blocks of pixels against the three
+ * edge functions of the triangle. Blocks that are completely inside or outside the triangle are decided from
+ * the values at their corners, and the remaining blocks are tested several pixels at a time (with SSE2 when
+ * available). The coverage of each block is returned as a bit mask.
+ *
+ * It covers exactly the same pixels as the triangle_rasterizer: a pixel is inside if it is inside the three
+ * half-spaces, or on a left or bottom edge of the triangle (pixels on right and top edges belong to the
+ * neighbour triangle).
+ */
+class edge_function_rasterizer {
+public:
+    /**
+     * Width and height of the blocks of pixels, in pixels
+     */
+    static const int block_size = 8;
+
+    /**
+     * Parameterized constructor creates an instance of an edge function rasterizer
+     * \param x1 - the x-coordinate of the first vertex
+     * \param y1 - the y-coordinate of the first vertex
+     * \param x2 - the x-coordinate of the second vertex
+     * \param y2 - the y-coordinate of the second vertex
+     * \param x3 - the x-coordinate of the third vertex
+     * \param y3 - the y-coordinate of the third vertex
+     */
+    edge_function_rasterizer(int x1, int y1, int x2, int y2, int x3, int y3);
+
+    /**
+     * Parameterized constructor creates an instance of an edge function rasterizer which only generates the
+     * pixels inside the rectangle [x_min, x_max] x [y_min, y_max] (scissor test)
+     * \param x1 - the x-coordinate of the first vertex
+     * \param y1 - the y-coordinate of the first vertex
+     * \param x2 - the x-coordinate of the second vertex
+     * \param y2 - the y-coordinate of the second vertex
+     * \param x3 - the x-coordinate of the third vertex
+     * \param y3 - the y-coordinate of the third vertex
+     * \param x_min - the smallest x-coordinate of the scissor rectangle
+     * \param y_min - the smallest y-coordinate of the scissor rectangle
+     * \param x_max - the largest x-coordinate of the scissor rectangle
+     * \param y_max - the largest y-coordinate of the scissor rectangle
+     */
+    edge_function_rasterizer(int x1, int y1, int x2, int y2, int x3, int y3,
+                             int x_min, int y_min, int x_max, int y_max);
+
+    /**
+     * Parameterized constructor creates an instance of an edge function rasterizer with sub-pixel precision.
+     * The coordinates of the vertices are fixed point numbers with subpixel_bits fractional bits (e.g. 4 for 28.4
+     * fixed point), and pixel (x, y) is inside the triangle if the point (x, y) is inside it. The fill rule is the
+     * same as with integer coordinates, so triangles that share an edge never share a pixel
+     * \param x1 - the x-coordinate of the first vertex, in fixed point
+     * \param y1 - the y-coordinate of the first vertex, in fixed point
+     * \param x2 - the x-coordinate of the second vertex, in fixed point
+     * \param y2 - the y-coordinate of the second vertex, in fixed point
+     * \param x3 - the x-coordinate of the third vertex, in fixed point
+     * \param y3 - the y-coordinate of the third vertex, in fixed point
+     * \param x_min - the smallest x-coordinate of the scissor rectangle, in pixels
+     * \param y_min - the smallest y-coordinate of the scissor rectangle, in pixels
+     * \param x_max - the largest x-coordinate of the scissor rectangle, in pixels
+     * \param y_max - the largest y-coordinate of the scissor rectangle, in pixels
+     * \param subpixel_bits - the number of fractional bits of the coordinates of the vertices
+     */
+    edge_function_rasterizer(int x1, int y1, int x2, int y2, int x3, int y3,
+                             int x_min, int y_min, int x_max, int y_max, int subpixel_bits);
+
+    /**
+     * Destroys the current instance of the edge function rasterizer
+     */
+    virtual ~edge_function_rasterizer();
+
+    /**
+     * Returns a vector which contains all the pixels inside the triangle
+     */
+    std::vector<glm::ivec2> all_pixels();
+
+    /**
+     * Checks if there are fragments/pixels inside the triangle ready for use
+     * \return true if there are more fragments in the triangle, else false is returned
+     */
+    bool more_fragments() const;
+
+    /**
+     * Computes the next fragment inside the triangle
+     */
+    void next_fragment();
+
+    /**
+     * Returns the current x-coordinate of the current fragment/pixel inside the triangle
+     * It is only valid to call this function if "more_fragments()" returns true,
+     * else a "runtime_error" exception is thrown
+     * \return The x-coordinate of the current triangle fragment/pixel
+     */
+    int x() const;
+
+    /**
+     * Returns the current y-coordinate of the current fragment/pixel inside the triangle
+     * It is only valid to call this function if "more_fragments()" returns true,
+     * else a "runtime_error" exception is thrown
+     * \return The y-coordinate of the current triangle fragment/pixel
+     */
+    int y() const;
+
+    /**
+     * Checks if there is a block with at least one pixel inside the triangle ready for use
+     * \return true if there are more blocks in the triangle, else false is returned
+     */
+    bool more_blocks() const;
+
+    /**
+     * Computes the next block with at least one pixel inside the triangle.
+     * Blocks are aligned to multiples of block_size and visited from bottom to top, left to right
+     */
+    void next_block();
+
+    /**
+     * Returns the x-coordinate of the lower left pixel of the current block
+     * \return The x-coordinate of the current block
+     */
+    int block_x() const;
+
+    /**
+     * Returns the y-coordinate of the lower left pixel of the current block
+     * \return The y-coordinate of the current block
+     */
+    int block_y() const;
+
+    /**
+     * Returns the coverage mask of the current block.
+     * Bit (i + j * block_size) is set if pixel (block_x() + i, block_y() + j) is inside the triangle
+     * \return The coverage mask of the current block
+     */
+    std::uint64_t block_mask() const;
+
+    /**
+     * Checks if all the pixels of the current block are inside the triangle
+     * \return true if the block is fully covered, else false is returned
+     */
+    bool block_fully_covered() const;
+
+private:
+    /**
+     * Sets up the edge functions of the triangle and finds the first block
+     */
+    void initialize_triangle(int x1, int y1, int x2, int y2, int x3, int y3,
+                             int x_min, int y_min, int x_max, int y_max, int subpixel_bits);
+
+    /**
+     * Computes the coverage mask of the block at (bx, by)
+     * \return the coverage mask of the block, 0 if no pixel in the block is inside the triangle
+     */
+    std::uint64_t coverage(int bx, int by) const;
+
+    /**
+     * Tests all the pixels of a block against the edges in edge_list
+     * \param e - the value of the edge functions at the lower left pixel of the block
+     * \param edge_list - the indices of the edges that cross the block
+     * \param edge_count - the number of edges in edge_list
+     * \return the coverage mask of the block
+     */
+    std::uint64_t test_pixels(const std::int64_t e[3], const int edge_list[3], int edge_count) const;
+
+    /**
+     * The edge functions E(x, y) = a * x + b * y + c, one per edge, with x and y in pixels.
+     * A pixel is inside the triangle if the three functions are >= 0 at the pixel.
+     * c already includes the bias of the fill rule (-1 for right and top edges)
+     */
+    std::int64_t a[3];
+    std::int64_t b[3];
+    std::int64_t c[3];
+
+    /**
+     * The pixels that can be inside the triangle (bounding box of the triangle and scissor rectangle)
+     */
+    int x_lo; int y_lo;
+    int x_hi; int y_hi;
+
+    /**
+     * The lower left pixel of the current block, and the coverage of the current block
+     */
+    int block_x_current;
+    int block_y_current;
+    std::uint64_t block_coverage;
+
+    /**
+     * The pixels of the current block that have not been visited by next_fragment yet
+     */
+    std::uint64_t remaining;
+
+    bool valid;
+};
+
+#endif
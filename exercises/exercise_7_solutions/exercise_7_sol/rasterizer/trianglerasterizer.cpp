@@ -66,6 +66,29 @@ void triangle_rasterizer::next_fragment()
     }
 }
 
+/*
+ * Skips the remaining fragments/pixels of the current scanline and computes the first fragment of the next one
+ */
+void triangle_rasterizer::next_span()
+{
+    this->x_current = this->x_stop;
+    this->next_fragment();
+}
+
+/*
+ * Returns the x-coordinate of the last fragment/pixel in the current scanline of the triangle
+ * It is only valid to call this function if "more_fragments()" returns true,
+ * else a "runtime_error" exception is thrown
+ * \return The x-coordinate of the last fragment/pixel in the current scanline
+ */
+int triangle_rasterizer::x_span_end() const
+{
+    if (!this->valid) {
+        throw std::runtime_error("triangle_rasterizer::x_span_end(): Invalid State/Not Initialized");
+    }
+    return this->x_stop;
+}
+
 /*
  * Returns the current x-coordinate of the current fragment/pixel inside the triangle
  * It is only valid to call this function if "more_fragments()" returns true,
@@ -51,6 +51,19 @@ public:
      */
     void next_fragment();
 
+    /**
+     * Skips the remaining fragments/pixels of the current scanline and computes the first fragment of the next one
+     */
+    void next_span();
+
+    /**
+     * Returns the x-coordinate of the last fragment/pixel in the current scanline of the triangle
+     * It is only valid to call this function if "more_fragments()" returns true,
+     * else a "runtime_error" exception is thrown
+     * \return The x-coordinate of the last fragment/pixel in the current scanline
+     */
+    int x_span_end() const;
+
     /**
      * Returns the current x-coordinate of the current fragment/pixel inside the triangle
      * It is only valid to call this function if "more_fragments()" returns true,
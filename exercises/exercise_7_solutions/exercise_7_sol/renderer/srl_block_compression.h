@@ -0,0 +1,239 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_SRL_BLOCK_COMPRESSION_H
+#define ITU_GRAPHICS_PROGRAMMING_SRL_BLOCK_COMPRESSION_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+namespace srl {
+
+    // encoder and decoder of the BC1 and BC3 (also known as DXT1 and DXT5) block compression formats.
+    // A block holds 4x4 texels, in rows, as 8 bits RGBA colors in the format of Colors::toRGBA32, and is stored as
+    // 32 bits words in the byte order of the GPU formats (on little endian machines):
+    //  - BC1, 2 words (8 bytes): two RGB565 end point colors c0 and c1, and 2 bits per texel to pick one of 4 colors
+    //    on the line between them. If c0 <= c1 there are only 3 colors, and the 4th is transparent black
+    //  - BC3, 4 words (16 bytes): an alpha block, two 8 bits end point alphas and 3 bits per texel to pick one of the
+    //    8 alphas between them, followed by a BC1 color block that always has 4 colors
+    // The encoder fits the line of the colors of a block with its principal axis, which is slower than the
+    // bounding box of the colors but handles blocks where the channels don't grow together (e.g. red to green)
+    struct BlockCompression {
+        static const int bc1Words = 2, bc3Words = 4;
+
+        static void encodeBC1(const std::uint32_t texels[16], std::uint32_t out[bc1Words]) {
+            encodeColors(texels, true, out);
+        }
+
+        static void encodeBC3(const std::uint32_t texels[16], std::uint32_t out[bc3Words]) {
+            encodeAlphas(texels, out);
+            encodeColors(texels, false, out + 2);
+        }
+
+        static void decodeBC1(const std::uint32_t block[bc1Words], std::uint32_t texels[16]) {
+            decodeColors(block, true, texels);
+        }
+
+        static void decodeBC3(const std::uint32_t block[bc3Words], std::uint32_t texels[16]) {
+            decodeColors(block + 2, false, texels);
+            decodeAlphas(block, texels);
+        }
+
+    private:
+        static int channel(std::uint32_t texel, int c) { return int(texel >> (8 * c)) & 0xFF; }
+
+        // colors of a color block, 3 colors and transparent black if c0 <= c1 and the block can have transparent
+        // texels (BC1), 4 colors otherwise
+        static void palette(std::uint32_t endPoints, bool transparency, std::uint32_t colors[4]) {
+            std::uint32_t c0 = endPoints & 0xFFFFu, c1 = endPoints >> 16;
+            int e0[3], e1[3];
+            expand565(c0, e0);
+            expand565(c1, e1);
+            bool threeColors = transparency && c0 <= c1;
+            for (int k = 0; k < 4; k++) {
+                colors[k] = 0xFF000000u;
+                for (int c = 0; c < 3; c++) {
+                    int v;
+                    if (k < 2)
+                        v = k == 0 ? e0[c] : e1[c];
+                    else if (threeColors)
+                        v = (e0[c] + e1[c] + 1) / 2;
+                    else
+                        v = k == 2 ? (2 * e0[c] + e1[c] + 1) / 3 : (e0[c] + 2 * e1[c] + 1) / 3;
+                    colors[k] |= std::uint32_t(v) << (8 * c);
+                }
+            }
+            if (threeColors)
+                colors[3] = 0;
+        }
+
+        static void expand565(std::uint32_t c, int rgb[3]) {
+            int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+            rgb[0] = (r << 3) | (r >> 2);
+            rgb[1] = (g << 2) | (g >> 4);
+            rgb[2] = (b << 3) | (b >> 2);
+        }
+
+        static std::uint32_t pack565(const float rgb[3]) {
+            auto quantize = [](float v, int max) {
+                return std::uint32_t(std::min(std::max(v, 0.0f), 255.0f) * max / 255.0f + .5f);
+            };
+            return (quantize(rgb[0], 31) << 11) | (quantize(rgb[1], 63) << 5) | quantize(rgb[2], 31);
+        }
+
+        static void decodeColors(const std::uint32_t block[2], bool transparency, std::uint32_t texels[16]) {
+            std::uint32_t colors[4];
+            palette(block[0], transparency, colors);
+            for (int i = 0; i < 16; i++)
+                texels[i] = colors[(block[1] >> (2 * i)) & 3u];
+        }
+
+        static void encodeColors(const std::uint32_t texels[16], bool transparency, std::uint32_t out[2]) {
+            // with BC1, texels with alpha < 128 become transparent, and the others opaque
+            bool transparent[16], anyTransparent = false;
+            for (int i = 0; i < 16; i++) {
+                transparent[i] = transparency && channel(texels[i], 3) < 128;
+                anyTransparent = anyTransparent || transparent[i];
+            }
+
+            // mean and covariance of the colors
+            float mean[3] = {0, 0, 0}, cov[6] = {0, 0, 0, 0, 0, 0};
+            int count = 0;
+            for (int i = 0; i < 16; i++) {
+                if (transparent[i])
+                    continue;
+                for (int c = 0; c < 3; c++)
+                    mean[c] += channel(texels[i], c);
+                count++;
+            }
+            if (count == 0) {
+                // fully transparent block, c0 == c1 and every texel uses the transparent color
+                out[0] = 0;
+                out[1] = 0xFFFFFFFFu;
+                return;
+            }
+            for (int c = 0; c < 3; c++)
+                mean[c] /= count;
+            for (int i = 0; i < 16; i++) {
+                if (transparent[i])
+                    continue;
+                float d[3] = {channel(texels[i], 0) - mean[0], channel(texels[i], 1) - mean[1], channel(texels[i], 2) - mean[2]};
+                cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+                cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+            }
+
+            // principal axis, by power iteration from the diagonal of the color space
+            float axis[3] = {1, 1, 1};
+            for (int iteration = 0; iteration < 8; iteration++) {
+                float a[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                              cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                              cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+                float length = std::max(std::max(std::abs(a[0]), std::abs(a[1])), std::abs(a[2]));
+                if (length == 0.0f)
+                    break;
+                for (int c = 0; c < 3; c++)
+                    axis[c] = a[c] / length;
+            }
+
+            // end points: the extreme projections of the colors on the axis
+            float tMin = 1e30f, tMax = -1e30f;
+            for (int i = 0; i < 16; i++) {
+                if (transparent[i])
+                    continue;
+                float t = 0;
+                for (int c = 0; c < 3; c++)
+                    t += (channel(texels[i], c) - mean[c]) * axis[c];
+                tMin = std::min(tMin, t);
+                tMax = std::max(tMax, t);
+            }
+            float axisLength2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+            float p0[3], p1[3];
+            for (int c = 0; c < 3; c++) {
+                p0[c] = mean[c] + axis[c] * tMax / axisLength2;
+                p1[c] = mean[c] + axis[c] * tMin / axisLength2;
+            }
+            std::uint32_t c0 = pack565(p0), c1 = pack565(p1);
+            // 4 colors need c0 > c1, and 3 colors with transparency c0 <= c1
+            if (anyTransparent ? c0 > c1 : c0 < c1)
+                std::swap(c0, c1);
+            out[0] = c0 | (c1 << 16);
+
+            // each texel gets the nearest color of the palette
+            std::uint32_t colors[4];
+            palette(out[0], transparency, colors);
+            int choices = anyTransparent || c0 == c1 ? 3 : 4;
+            out[1] = 0;
+            for (int i = 0; i < 16; i++) {
+                int best = 3;
+                if (!transparent[i]) {
+                    int bestError = 1 << 30;
+                    for (int k = 0; k < choices; k++) {
+                        int error = 0;
+                        for (int c = 0; c < 3; c++) {
+                            int d = channel(texels[i], c) - channel(colors[k], c);
+                            error += d * d;
+                        }
+                        if (error < bestError) {
+                            bestError = error;
+                            best = k;
+                        }
+                    }
+                }
+                out[1] |= std::uint32_t(best) << (2 * i);
+            }
+        }
+
+        // the 8 alphas of an alpha block, from the end points a0 > a1
+        static void alphaPalette(int a0, int a1, int alphas[8]) {
+            alphas[0] = a0;
+            alphas[1] = a1;
+            for (int k = 1; k < 7; k++)
+                alphas[k + 1] = ((7 - k) * a0 + k * a1 + 3) / 7;
+        }
+
+        // alpha blocks are two end point bytes and 16 3 bits indices, in the first 64 bits of the block
+        static void decodeAlphas(const std::uint32_t block[2], std::uint32_t texels[16]) {
+            std::uint64_t bits = block[0] | (std::uint64_t(block[1]) << 32);
+            int a0 = int(bits & 0xFF), a1 = int((bits >> 8) & 0xFF);
+            int alphas[8];
+            if (a0 > a1)
+                alphaPalette(a0, a1, alphas);
+            else {
+                // 6 alphas, 0 and 255 (the encoder never makes these blocks, but they are valid BC3)
+                alphas[0] = a0;
+                alphas[1] = a1;
+                for (int k = 1; k < 5; k++)
+                    alphas[k + 1] = ((5 - k) * a0 + k * a1 + 2) / 5;
+                alphas[6] = 0;
+                alphas[7] = 255;
+            }
+            for (int i = 0; i < 16; i++) {
+                int index = int((bits >> (16 + 3 * i)) & 7u);
+                texels[i] = (texels[i] & 0x00FFFFFFu) | (std::uint32_t(alphas[index]) << 24);
+            }
+        }
+
+        static void encodeAlphas(const std::uint32_t texels[16], std::uint32_t out[2]) {
+            int a0 = 0, a1 = 255;
+            for (int i = 0; i < 16; i++) {
+                a0 = std::max(a0, channel(texels[i], 3));
+                a1 = std::min(a1, channel(texels[i], 3));
+            }
+            std::uint64_t bits = std::uint64_t(a0) | (std::uint64_t(a1) << 8);
+            if (a0 > a1) {
+                int alphas[8];
+                alphaPalette(a0, a1, alphas);
+                for (int i = 0; i < 16; i++) {
+                    int a = channel(texels[i], 3), best = 0;
+                    for (int k = 1; k < 8; k++)
+                        if (std::abs(alphas[k] - a) < std::abs(alphas[best] - a))
+                            best = k;
+                    bits |= std::uint64_t(best) << (16 + 3 * i);
+                }
+            }
+            out[0] = std::uint32_t(bits);
+            out[1] = std::uint32_t(bits >> 32);
+        }
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SRL_BLOCK_COMPRESSION_H
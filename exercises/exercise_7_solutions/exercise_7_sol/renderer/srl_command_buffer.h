@@ -0,0 +1,182 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_SRL_COMMAND_BUFFER_H
+#define ITU_GRAPHICS_PROGRAMMING_SRL_COMMAND_BUFFER_H
+
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+#include "glm/glm.hpp"
+#include "srl_types.h"
+#include "srl_parallel.h"
+#include "srl_renderer.h"
+
+namespace srl {
+
+    // records many draws and executes them as a batch. execute runs the vertex shader of all the draws in parallel
+    // (one draw per task, on the worker threads of the renderer of the first draw), sorts the draws front to back by
+    // the distance of their nearest vertex to the camera (the smallest w in clipping space, clamped to the near
+    // plane), so that the depth test rejects as many of the fragments of the later draws as possible, and then runs
+    // the rest of the pipeline of each draw, in that order, with the renderer it was recorded with (so draws with
+    // different settings use different renderers). The transformed vertices of each draw and the fragments of each
+    // renderer are kept from frame to frame, so a draw doesn't allocate memory once the sizes of the draws stop
+    // growing.
+    // The vertices, the indices and the renderers of the draws are referenced, not copied: they must not change or
+    // be destroyed until execute returns
+    class CommandBuffer {
+    public:
+        // sort the draws front to back, otherwise they are executed in the order they were recorded (e.g. for
+        // renderers that blend in the order the fragments are drawn)
+        bool m_sortFrontToBack = true;
+        // run the vertex shader of the draws on the worker threads of the renderer of the first draw, the command
+        // buffer has no threads of its own. Otherwise the draws are transformed one after the other, on the thread
+        // that calls prepare (e.g. by FramePipeline, whose rasterization thread uses the threads of the renderers)
+        bool m_parallelVertices = true;
+
+        // remove all the draws, the memory of the commands is kept
+        void clear() {
+            m_commandCount = 0;
+            m_order.clear();
+        }
+
+        int size() const { return m_commandCount; }
+
+        // record the draw of the vertices vts with model matrix m
+        void draw(Renderer &renderer, const std::vector<vertex> &vts, const glm::mat4 &m) {
+            Command &command = addCommand(renderer, vts, m);
+            command.indices16 = nullptr;
+            command.indices32 = nullptr;
+        }
+
+        // record the draw of the triangles made by the indices to the vertices vts, with model matrix m
+        void draw(Renderer &renderer, const std::vector<vertex> &vts, const std::vector<std::uint16_t> &indices,
+                  Topology topology, const glm::mat4 &m) {
+            Command &command = addCommand(renderer, vts, m);
+            command.indices16 = &indices;
+            command.indices32 = nullptr;
+            command.topology = topology;
+        }
+
+        void draw(Renderer &renderer, const std::vector<vertex> &vts, const std::vector<std::uint32_t> &indices,
+                  Topology topology, const glm::mat4 &m) {
+            Command &command = addCommand(renderer, vts, m);
+            command.indices16 = nullptr;
+            command.indices32 = &indices;
+            command.topology = topology;
+        }
+
+        // execute the draws with view projection vp in the fb framebuffer. The draws stay recorded, so the same
+        // commands can be executed again (e.g. with another camera)
+        void execute(const glm::mat4 &vp, CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) {
+            prepare(vp);
+            submit(fb, db);
+        }
+
+        // the two halves of execute, so that they can run on different threads (see FramePipeline): prepare runs
+        // the vertex shader of the draws with view projection vp and sorts them, submit runs the rest of the
+        // pipeline of the prepared draws. The renderers are only used by submit
+        void prepare(const glm::mat4 &vp) {
+            m_stats = RenderStats();
+            {
+                StageTimer timer(m_stats.processVerticesNs);
+                float nearW = nearPlaneW(vp);
+                if (m_parallelVertices && m_commandCount > 0) {
+                    m_commands[0].renderer->workerPool().parallelFor(m_commandCount, [&](int index, int) {
+                        transform(m_commands[index], vp, nearW);
+                    });
+                }
+                else {
+                    for (int index = 0; index < m_commandCount; index++)
+                        transform(m_commands[index], vp, nearW);
+                }
+            }
+
+            m_order.resize(m_commandCount);
+            for (int i = 0; i < m_commandCount; i++)
+                m_order[i] = i;
+            // draws at the same distance keep the order they were recorded in
+            if (m_sortFrontToBack) {
+                std::stable_sort(m_order.begin(), m_order.end(), [this](int a, int b) {
+                    return m_commands[a].depthKey < m_commands[b].depthKey;
+                });
+            }
+        }
+
+        void submit(CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) {
+            for (int index : m_order) {
+                Command &command = m_commands[index];
+                if (command.indices16)
+                    command.renderer->renderTransformed(command.clipVertices, *command.indices16, command.topology, fb, db);
+                else if (command.indices32)
+                    command.renderer->renderTransformed(command.clipVertices, *command.indices32, command.topology, fb, db);
+                else
+                    command.renderer->renderTransformed(command.clipVertices, fb, db);
+                m_stats.add(command.renderer->stats());
+            }
+            // the draws cover the same pixels
+            m_stats.pixelCount = fb.W * fb.H;
+        }
+
+        // statistics of the last call to execute (or prepare and submit), the sum of the statistics of its draws.
+        // processVerticesNs is the time of the parallel vertex stage of all the draws
+        const RenderStats &stats() const { return m_stats; }
+
+    private:
+        struct Command {
+            Renderer *renderer;
+            const std::vector<vertex> *vertices;
+            const std::vector<std::uint16_t> *indices16;
+            const std::vector<std::uint32_t> *indices32;
+            Topology topology;
+            glm::mat4 model;
+            // smallest w of the transformed vertices, not nearer than the near plane
+            float depthKey;
+            // the vertices in clipping space, reused by the command that takes this slot in the next frames
+            std::vector<vertex> clipVertices;
+        };
+
+        Command &addCommand(Renderer &renderer, const std::vector<vertex> &vts, const glm::mat4 &m) {
+            if (m_commandCount == (int) m_commands.size())
+                m_commands.emplace_back();
+            Command &command = m_commands[m_commandCount++];
+            command.renderer = &renderer;
+            command.vertices = &vts;
+            command.model = m;
+            return command;
+        }
+
+        // the vertex shader of a draw, the same one Renderer::render runs. The vertices behind the near plane (w is
+        // negative behind the camera) are clipped, so the key of a draw that crosses it is the near plane
+        static void transform(Command &command, const glm::mat4 &vp, float nearW) {
+            command.clipVertices.assign(command.vertices->begin(), command.vertices->end());
+            Renderer::processVertices(vp * command.model, command.clipVertices);
+            float nearest = std::numeric_limits<float>::max();
+            for (auto &vtx : command.clipVertices)
+                nearest = std::min(nearest, vtx.pos.w);
+            command.depthKey = std::max(nearest, nearW);
+        }
+
+        // w on the near plane (z = -w in clipping space) of the projection in vp. With a perspective projection z
+        // is a linear function of w, z = a * w + b, so the near plane is at w = -b / (a + 1). The w of an orthographic
+        // projection doesn't depend on the position, there is nothing to clamp
+        static float nearPlaneW(const glm::mat4 &vp) {
+            glm::vec4 zRow(vp[0][2], vp[1][2], vp[2][2], vp[3][2]);
+            glm::vec4 wRow(vp[0][3], vp[1][3], vp[2][3], vp[3][3]);
+            glm::vec3 wDir(wRow);
+            float wLength2 = glm::dot(wDir, wDir);
+            if (wLength2 == 0.0f)
+                return -std::numeric_limits<float>::max();
+            float a = glm::dot(glm::vec3(zRow), wDir) / wLength2;
+            float b = zRow.w - a * wRow.w;
+            return a + 1.0f != 0.0f ? -b / (a + 1.0f) : -std::numeric_limits<float>::max();
+        }
+
+        // the commands, only the first m_commandCount are recorded, and the order they are executed in
+        std::vector<Command> m_commands;
+        int m_commandCount = 0;
+        std::vector<int> m_order;
+
+        RenderStats m_stats;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SRL_COMMAND_BUFFER_H
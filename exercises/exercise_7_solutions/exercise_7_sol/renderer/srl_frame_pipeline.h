@@ -0,0 +1,236 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_SRL_FRAME_PIPELINE_H
+#define ITU_GRAPHICS_PROGRAMMING_SRL_FRAME_PIPELINE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "glm/glm.hpp"
+#include "srl_types.h"
+#include "srl_renderer.h"
+#include "srl_command_buffer.h"
+
+namespace srl {
+
+    // runs the frames of an application as a pipeline, so that the work of consecutive frames overlaps. There are
+    // three stages, each on its own thread:
+    // - geometry: runs the vertex shader of the draws of a frame (CommandBuffer::prepare)
+    // - rasterization: clears the frame buffers of the frame and runs the rest of the pipeline of the draws
+    //   (CommandBuffer::submit), then the finish callback of the frame
+    // Only the vertex processing overlaps with the rasterization of the other frame: the primitive assembly, the
+    // culling, the clipping and the triangle setup run on the rasterization thread, with the rasterization, because
+    // they keep their primitives in the renderer, which is shared by the frames.
+    // - presentation: the thread that owns the pipeline, which records the frames and shows them once they are
+    //   rasterized (e.g. uploads them to an OpenGL texture and swaps the window buffers)
+    // There are two frames, each with its own color and depth buffers and command buffer, so one frame can be
+    // presented (or recorded) while the other one is being rendered.
+    //
+    // The latency is the number of frames that are rendered ahead of the frame being presented. With a latency of
+    // 0 a frame is presented as soon as it is rasterized, and the renderer is idle while the frame is presented.
+    // With a latency of 1 a frame is presented while the next one is rendered, so a frame takes about as long as
+    // the slowest stage instead of the sum of the stages, but the image on screen is one frame older.
+    //
+    // a frame of the main loop:
+    //     FramePipeline::Frame &frame = pipeline.beginFrame();
+    //     frame.viewProj = ...; frame.commands.draw(...);
+    //     pipeline.submitFrame(frame);
+    //     while (FramePipeline::Frame *shown = pipeline.acquirePresentFrame()) {
+    //         ... show shown->colorBuffer ...
+    //         pipeline.releaseFrame(*shown);
+    //     }
+    //
+    // the renderers of the draws are used by the rasterization thread while the next frame is recorded: their
+    // settings (and anything the draws reference) must only change after flush
+    class FramePipeline {
+    public:
+        struct Frame {
+            Frame(unsigned int width, unsigned int height) : colorBuffer(width, height), depthBuffer(width, height) {
+                // the geometry stage already runs next to the rasterization, which uses the worker threads of the
+                // renderers, its vertices are processed serially
+                commands.m_parallelVertices = false;
+            }
+
+            CustomFrameBuffer<std::uint32_t> colorBuffer;
+            CustomFrameBuffer<float> depthBuffer;
+            // values the buffers are cleared with at the start of the rasterization stage
+            std::uint32_t clearColor = 0;
+            float clearDepth = 1.0f;
+
+            // the draws of the frame, executed with viewProj. beginFrame removes the draws of the last time the
+            // frame was used
+            CommandBuffer commands;
+            glm::mat4 viewProj = glm::mat4(1.0f);
+            // called by the rasterization stage after the draws, e.g. for draws that don't go through a command
+            // buffer and to resolve the visibility buffer or the samples. It runs on the rasterization thread, so
+            // it should capture by value the state that the recording thread keeps changing
+            std::function<void(Frame &frame)> finish;
+
+            // number of the frame since the pipeline was created
+            unsigned long long number = 0;
+            // time spent in the geometry and rasterization stages
+            std::int64_t geometryNs = 0, rasterizationNs = 0;
+        };
+
+        FramePipeline(unsigned int width, unsigned int height, unsigned int latency = 1) {
+            setLatency(latency);
+            for (int i = 0; i < frameCount; i++) {
+                m_frames.emplace_back(new Frame(width, height));
+                m_free.push_back(m_frames.back().get());
+            }
+            m_geometryThread = std::thread(&FramePipeline::geometryLoop, this);
+            m_rasterizationThread = std::thread(&FramePipeline::rasterizationLoop, this);
+        }
+
+        // finishes the frames that were submitted, without presenting them
+        ~FramePipeline() {
+            flush();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_quit = true;
+            }
+            m_changed.notify_all();
+            m_geometryThread.join();
+            m_rasterizationThread.join();
+        }
+
+        FramePipeline(FramePipeline const&) = delete;
+        void operator=(FramePipeline const&) = delete;
+
+        // the number of frames rendered ahead of the frame being presented, 0 or 1. A lower latency takes effect
+        // for the frames submitted after the change, acquirePresentFrame returns the older frames first
+        void setLatency(unsigned int latency) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_latency = std::min(latency, (unsigned int) frameCount - 1);
+        }
+
+        unsigned int latency() const { return m_latency; }
+
+        // a frame to record, waits until one has been presented and released if both are in use. The frame buffers
+        // keep their size and sample count, and are cleared by the rasterization stage
+        Frame &beginFrame() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this] { return !m_free.empty(); });
+            Frame *frame = m_free.front();
+            m_free.pop_front();
+            frame->commands.clear();
+            frame->finish = nullptr;
+            frame->number = m_frameNumber++;
+            return *frame;
+        }
+
+        // render the frame returned by beginFrame, it must not be changed until it is presented
+        void submitFrame(Frame &frame) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_geometryQueue.push_back(&frame);
+            }
+            m_changed.notify_all();
+        }
+
+        // the oldest frame, if it must be presented to keep the latency (waits until it is rasterized), otherwise
+        // nullptr. The frame must be given back with releaseFrame
+        Frame *acquirePresentFrame() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_geometryQueue.size() + m_rasterizationQueue.size() + m_presentQueue.size() <= m_latency)
+                return nullptr;
+            m_changed.wait(lock, [this] { return !m_presentQueue.empty(); });
+            Frame *frame = m_presentQueue.front();
+            m_presentQueue.pop_front();
+            return frame;
+        }
+
+        // the frame was presented, it can be recorded again
+        void releaseFrame(Frame &frame) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_free.push_back(&frame);
+            }
+            m_changed.notify_all();
+        }
+
+        // wait until the submitted frames are rasterized, after which the renderers can be changed. The frames
+        // still have to be presented (or released)
+        void flush() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this] { return m_geometryQueue.empty() && m_rasterizationQueue.empty(); });
+        }
+
+    private:
+        static const int frameCount = 2;
+
+        // a frame stays at the front of the queue of its stage while the stage runs, so that flush waits for it
+        void geometryLoop() {
+            for (;;) {
+                Frame *frame;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_changed.wait(lock, [this] { return m_quit || !m_geometryQueue.empty(); });
+                    if (m_geometryQueue.empty())
+                        return;
+                    frame = m_geometryQueue.front();
+                }
+
+                frame->geometryNs = 0;
+                {
+                    StageTimer timer(frame->geometryNs);
+                    frame->commands.prepare(frame->viewProj);
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_geometryQueue.pop_front();
+                    m_rasterizationQueue.push_back(frame);
+                }
+                m_changed.notify_all();
+            }
+        }
+
+        void rasterizationLoop() {
+            for (;;) {
+                Frame *frame;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_changed.wait(lock, [this] { return m_quit || !m_rasterizationQueue.empty(); });
+                    if (m_rasterizationQueue.empty())
+                        return;
+                    frame = m_rasterizationQueue.front();
+                }
+
+                frame->rasterizationNs = 0;
+                {
+                    StageTimer timer(frame->rasterizationNs);
+                    frame->colorBuffer.clearBuffer(frame->clearColor);
+                    frame->depthBuffer.clearBuffer(frame->clearDepth);
+                    frame->commands.submit(frame->colorBuffer, frame->depthBuffer);
+                    if (frame->finish)
+                        frame->finish(*frame);
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_rasterizationQueue.pop_front();
+                    m_presentQueue.push_back(frame);
+                }
+                m_changed.notify_all();
+            }
+        }
+
+        std::vector<std::unique_ptr<Frame>> m_frames;
+        // the frames in each state, oldest first. Recorded frames are in none of them
+        std::deque<Frame *> m_free, m_geometryQueue, m_rasterizationQueue, m_presentQueue;
+        unsigned int m_latency = 1;
+        unsigned long long m_frameNumber = 0;
+
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        bool m_quit = false;
+        std::thread m_geometryThread, m_rasterizationThread;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SRL_FRAME_PIPELINE_H
@@ -0,0 +1,197 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_SRL_HIERARCHICAL_Z_H
+#define ITU_GRAPHICS_PROGRAMMING_SRL_HIERARCHICAL_Z_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "glm/glm.hpp"
+#include "srl_types.h"
+
+namespace srl {
+
+    // min/max depth pyramid of a depth buffer, used to reject geometry hidden behind what is already drawn
+    // level 0 stores the min and max depth of each 8x8 tile of pixels, and each level above covers 2x2 tiles
+    // of the level below. Tiles are marked as out of date when a depth is written, and recomputed when queried
+    class HierarchicalZBuffer {
+    public:
+        // width and height of the tiles in level 0, in pixels
+        static const int tileSize = 8;
+        static_assert(CustomFrameBuffer<float>::tileSize % tileSize == 0,
+                      "the tiles of level 0 must be inside the tiles the depth buffer clears");
+        static_assert(CustomFrameBuffer<float>::planeBlockSize == tileSize,
+                      "the tiles of level 0 must be the blocks the depth buffer compresses");
+
+        // match the size of the depth buffer and mark every tile as out of date
+        // must be called whenever the depth buffer may have been changed outside depthWritten (e.g. cleared)
+        void reset(CustomFrameBuffer <float> &db) {
+            m_db = &db;
+            if (m_width != (int) db.W || m_height != (int) db.H) {
+                m_width = db.W;
+                m_height = db.H;
+                m_levels.clear();
+                int size = tileSize;
+                do {
+                    Level level;
+                    level.countX = (m_width + size - 1) / size;
+                    level.countY = (m_height + size - 1) / size;
+                    level.minDepth.resize(level.countX * level.countY);
+                    level.maxDepth.resize(level.countX * level.countY);
+                    level.dirty.resize(level.countX * level.countY);
+                    m_levels.push_back(level);
+                    size *= 2;
+                } while (m_levels.back().countX > 1 || m_levels.back().countY > 1);
+            }
+            for (auto &level : m_levels)
+                std::fill(level.dirty.begin(), level.dirty.end(), 1);
+            m_maxLevel = levelCount() - 1;
+        }
+
+        int levelCount() const { return (int) m_levels.size(); }
+
+        // only use and update the levels up to maxLevel
+        // this allows threads to work on separate parts of the depth buffer, as long as each thread owns
+        // whole tiles of maxLevel. Call reset before using the levels above maxLevel again
+        void setMaxLevel(int maxLevel) {
+            m_maxLevel = std::min(maxLevel, levelCount() - 1);
+        }
+
+        // tell the pyramid that the depth at pixel (x, y) has changed
+        void depthWritten(int x, int y) {
+            int tx = x / tileSize, ty = y / tileSize;
+            for (int l = 0; l <= m_maxLevel; l++, tx /= 2, ty /= 2) {
+                std::uint8_t &dirty = m_levels[l].dirty[tx + ty * m_levels[l].countX];
+                // the levels above a tile that is out of date are always out of date too
+                if (dirty)
+                    return;
+                dirty = 1;
+            }
+        }
+
+        float minDepth(int level, int tx, int ty) {
+            Level &lvl = m_levels[level];
+            update(level, tx, ty);
+            return lvl.minDepth[tx + ty * lvl.countX];
+        }
+
+        float maxDepth(int level, int tx, int ty) {
+            Level &lvl = m_levels[level];
+            update(level, tx, ty);
+            return lvl.maxDepth[tx + ty * lvl.countX];
+        }
+
+        // true if no pixel in the rectangle [xMin, xMax] x [yMin, yMax] can pass a "less than" depth test
+        // with a depth >= depth, i.e. all the depths stored in the rectangle are <= depth
+        bool occluded(int xMin, int yMin, int xMax, int yMax, float depth) {
+            bool result = true;
+            forEachTile(xMin, yMin, xMax, yMax, [&](int level, int tx, int ty) {
+                if (maxDepth(level, tx, ty) > depth) {
+                    result = false;
+                    return false;
+                }
+                return true;
+            });
+            return result;
+        }
+
+        // true if every pixel in the rectangle [xMin, xMax] x [yMin, yMax] passes a "less than" depth test
+        // with a depth <= depth, i.e. all the depths stored in the rectangle are > depth
+        bool visible(int xMin, int yMin, int xMax, int yMax, float depth) {
+            bool result = true;
+            forEachTile(xMin, yMin, xMax, yMax, [&](int level, int tx, int ty) {
+                if (!(minDepth(level, tx, ty) > depth)) {
+                    result = false;
+                    return false;
+                }
+                return true;
+            });
+            return result;
+        }
+
+    private:
+        struct Level {
+            int countX, countY;
+            std::vector<float> minDepth;
+            std::vector<float> maxDepth;
+            std::vector<std::uint8_t> dirty;
+        };
+
+        // call tileFunc(level, tx, ty) for the tiles that overlap the rectangle, in the finest level where they are
+        // at most 2x2 tiles (or in maxLevel), stops when tileFunc returns false
+        template<class TileFunc>
+        void forEachTile(int xMin, int yMin, int xMax, int yMax, TileFunc &&tileFunc) {
+            xMin = std::max(xMin, 0);
+            yMin = std::max(yMin, 0);
+            xMax = std::min(xMax, m_width - 1);
+            yMax = std::min(yMax, m_height - 1);
+            if (xMin > xMax || yMin > yMax)
+                return;
+
+            // pick the finest level where the rectangle overlaps at most 2x2 tiles
+            int level = 0, size = tileSize;
+            while (level < m_maxLevel && (xMax / size - xMin / size > 1 || yMax / size - yMin / size > 1)) {
+                level++;
+                size *= 2;
+            }
+            for (int ty = yMin / size; ty <= yMax / size; ty++)
+                for (int tx = xMin / size; tx <= xMax / size; tx++)
+                    if (!tileFunc(level, tx, ty))
+                        return;
+        }
+
+        // recompute the min and max depth of a tile if it is out of date
+        void update(int level, int tx, int ty) {
+            Level &lvl = m_levels[level];
+            int i = tx + ty * lvl.countX;
+            if (!lvl.dirty[i])
+                return;
+
+            float minZ, maxZ;
+            if (level == 0) {
+                int x0 = tx * tileSize, x1 = std::min(x0 + tileSize, m_width);
+                int y0 = ty * tileSize, y1 = std::min(y0 + tileSize, m_height);
+                // a tile that is still cleared, or compressed to a plane, has a known range, without reading (or
+                // materializing) it
+                bool known = m_db->blockRange(x0, y0, minZ, maxZ);
+                if (!known && !m_db->buffer) {
+                    // compact formats don't store floats in buffer, valueAt decodes them
+                    minZ = maxZ = m_db->valueAt(x0, y0);
+                    for (int y = y0; y < y1; y++)
+                        for (int x = x0; x < x1; x++) {
+                            float depth = m_db->valueAt(x, y);
+                            minZ = std::min(minZ, depth);
+                            maxZ = std::max(maxZ, depth);
+                        }
+                } else if (!known) {
+                    minZ = maxZ = m_db->buffer[x0 + y0 * m_db->P];
+                    for (int y = y0; y < y1; y++) {
+                        const float *row = m_db->buffer + y * m_db->P;
+                        for (int x = x0; x < x1; x++) {
+                            minZ = std::min(minZ, row[x]);
+                            maxZ = std::max(maxZ, row[x]);
+                        }
+                    }
+                }
+            } else {
+                // combine the (up to) 2x2 tiles of the level below
+                const Level &below = m_levels[level - 1];
+                minZ = minDepth(level - 1, tx * 2, ty * 2);
+                maxZ = maxDepth(level - 1, tx * 2, ty * 2);
+                for (int cy = ty * 2; cy < std::min(ty * 2 + 2, below.countY); cy++)
+                    for (int cx = tx * 2; cx < std::min(tx * 2 + 2, below.countX); cx++) {
+                        minZ = std::min(minZ, minDepth(level - 1, cx, cy));
+                        maxZ = std::max(maxZ, maxDepth(level - 1, cx, cy));
+                    }
+            }
+            lvl.minDepth[i] = minZ;
+            lvl.maxDepth[i] = maxZ;
+            lvl.dirty[i] = 0;
+        }
+
+        CustomFrameBuffer <float> *m_db = nullptr;
+        int m_width = 0, m_height = 0;
+        int m_maxLevel = 0;
+        std::vector<Level> m_levels;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SRL_HIERARCHICAL_Z_H
@@ -10,36 +10,127 @@
 #include "srl_renderer.h"
 #include "rasterizer/linerasterizer.h"
 #include "srl_types.h"
+#include <algorithm>
 
 namespace srl {
     class LineRenderer : public Renderer {
+    public:
+        // batched rasterization: the lines of a draw are binned into horizontal bands of the screen, and each band
+        // is rasterized, depth tested, shaded and written straight to the frame buffer by a worker thread, without
+        // storing the fragments first. The lines of a band are drawn in submission order, so the image doesn't
+        // depend on the number of threads. The end points keep their sub-pixel position (the line rasterizer
+        // rounds them to pixels). Ignored with multisampling
+        bool m_batchedLines = false;
+        // height of the bands, in pixels
+        int m_bandHeight = 16;
+
+        // Wu antialiasing: each step along the major axis of a line covers the two pixels on either side of it,
+        // in proportion to how close the line passes to their centers. The fragments are blended over the frame
+        // buffer with their coverage as alpha, and only the pixel nearest to the line writes depth.
+        // Always uses the batched rasterization
+        bool m_antialiasing = false;
+
+    protected:
+        void drawPrimitives(std::vector<fragment> &frs, CustomFrameBuffer <uint32_t> &fb,
+                            CustomFrameBuffer <float> &db) override {
+            assert(fb.S == db.S);
+            if ((!m_batchedLines && !m_antialiasing) || db.S > 1) {
+                Renderer::drawPrimitives(frs, fb, db);
+                return;
+            }
+
+            // the rasterization, the fragment shader and the writes to the frame buffer are interleaved
+            StageTimer timer(m_stats.rasterPrimitivesNs);
+            setupLines(fb.W, fb.H);
+            WorkerPool &pool = workerPool();
+            m_workerCounters.assign(pool.threadCount(), FragmentCounters());
+            pool.parallelFor((int) m_bandBins.size(), [&](int band, int worker) {
+                rasterBand(band, worker, fb, db);
+            });
+            for (auto &counters : m_workerCounters)
+                m_stats.fragments.add(counters);
+        }
+
     private:
         // create line primitives
         void assemblePrimitives(const std::vector<vertex> &vts) {
+            m_vertices.assign(vts.begin(), vts.end());
             m_primitives.clear();
             // make sure a single allocation will happen
             m_primitives.reserve(vts.size()/3 * (wireframe ? 3 : 1));
             int increment =  wireframe ? 3 : 2;
             for(int i = 0, size = vts.size()-1; i < size; i += increment){
-                line l;
-                l.v1 = vts[i];
-                l.v2 = vts[i+1];
+                indexedLine l;
+                l.v1 = i;
+                l.v2 = i+1;
                 m_primitives.push_back(l);
                 if(wireframe) {
-                    l.v1 = vts[i + 1];
-                    l.v2 = vts[i + 2];
+                    l.v1 = i + 1;
+                    l.v2 = i + 2;
                     m_primitives.push_back(l);
-                    l.v1 = vts[i + 2];
-                    l.v2 = vts[i];
+                    l.v1 = i + 2;
+                    l.v2 = i;
                     m_primitives.push_back(l);
                 }
             }
+            m_stats.primitivesIn = m_primitives.size();
         }
 
-        void clipLine(line &l, int side){
-            vertex &v1 = l.v1;
-            vertex &v2 = l.v2;
+        // create one line per edge of the triangles made by indices, lines refer to the shared vertices vts, and
+        // edges shared by several triangles are only drawn once. The edges are grouped by their lowest vertex (a
+        // counting sort), so finding the duplicates only compares the few edges of each vertex
+        void assembleIndexedPrimitives(const std::vector<vertex> &vts,
+                                       const std::vector<unsigned int> &indices) override {
+            if (!wireframe) {
+                std::vector<vertex> triangleVts;
+                triangleVts.reserve(indices.size());
+                for (unsigned int index : indices)
+                    triangleVts.push_back(vts[index]);
+                assemblePrimitives(triangleVts);
+                return;
+            }
+
+            // m_edgeStarts[v] is where the edges whose lowest vertex is v start in m_edgeEnds
+            m_edgeStarts.assign(vts.size() + 1, 0);
+            forEachEdge(indices, [&](unsigned int low, unsigned int) { m_edgeStarts[low + 1]++; });
+            for (std::size_t v = 1; v < m_edgeStarts.size(); v++)
+                m_edgeStarts[v] += m_edgeStarts[v - 1];
+            m_edgeEnds.resize(m_edgeStarts.back());
+            m_edgeCursors.assign(m_edgeStarts.begin(), m_edgeStarts.end() - 1);
+            forEachEdge(indices, [&](unsigned int low, unsigned int high) { m_edgeEnds[m_edgeCursors[low]++] = high; });
+
+            m_vertices.assign(vts.begin(), vts.end());
+            m_primitives.clear();
+            m_primitives.reserve(m_edgeEnds.size() / 2);
+            for (unsigned int v = 0; v < vts.size(); v++) {
+                unsigned int first = m_edgeStarts[v], last = m_edgeStarts[v + 1];
+                for (unsigned int e = first; e < last; e++) {
+                    auto end = m_edgeEnds.begin() + e;
+                    if (std::find(m_edgeEnds.begin() + first, end, m_edgeEnds[e]) != end)
+                        continue;
+                    indexedLine l;
+                    l.v1 = v;
+                    l.v2 = m_edgeEnds[e];
+                    m_primitives.push_back(l);
+                }
+            }
+            m_stats.primitivesIn = m_primitives.size();
+        }
 
+        // call edgeFunc(low, high) for the three edges of each triangle of indices, with the lowest vertex first
+        template<class EdgeFunc>
+        static void forEachEdge(const std::vector<unsigned int> &indices, EdgeFunc &&edgeFunc) {
+            for (std::size_t i = 0; i + 2 < indices.size(); i += 3)
+                for (int k = 0; k < 3; k++) {
+                    unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+                    // an edge between a vertex and itself (degenerate triangle) is not a line
+                    if (a != b)
+                        edgeFunc(std::min(a, b), std::max(a, b));
+                }
+        }
+
+        // clip the line against the plane x,y,z = w * bound (side 0, 1, 2) or x,y,z = -w * bound (side 3, 4, 5)
+        void clipLine(indexedLine &l, int side, float bound){
             // index to x, y or z coordinate (x=0, y=1, z=2)
             int idx = side % 3;
             // we check if the variable is in the range of the clipping plane using w
@@ -47,11 +138,12 @@ namespace srl {
             // we can rewrite the latter with x,y,z * -1 > w
             // so we need to multiply x,y,z by -1 when testing against the planes at -w
             // planes 0, 1 and 2 are positive w, planes 3, 4 and 5 are negative w
+            // (with a guard band, w is scaled by bound)
             float wMult = side > 2 ? -1.0f : 1.0f;
 
-            glm::vec4 p1 = v1.pos;
-            glm::vec4 p2 = v2.pos;
-            int outCount = (p1[idx] * wMult > p1.w) + (p2[idx] * wMult > p2.w);
+            glm::vec4 p1 = m_vertices[l.v1].pos;
+            glm::vec4 p2 = m_vertices[l.v2].pos;
+            int outCount = (p1[idx] * wMult > bound * p1.w) + (p2[idx] * wMult > bound * p2.w);
             if( outCount == 2){
                 // the line is outside the frustum, we don't need to draw it
                 l.rejected = true;
@@ -67,33 +159,65 @@ namespace srl {
                 glm::vec4 p1p2vec = p2 - p1;
 
                 // proportion t that added to p1 will give the point where coordinates p1[idx] + p1p2vec[idx]*t == w , for idx = x, y or z
-                float denom = p1p2vec.w * wMult - p1p2vec[idx];
-                float t = (p1[idx] - p1.w * wMult) / denom;
+                float denom = bound * p1p2vec.w * wMult - p1p2vec[idx];
+                float t = (p1[idx] - bound * p1.w * wMult) / denom;
 
-                // interpolate and update the value of one of the variables
-                vertex &vTarget = p1[idx] * wMult > p1.w ? v1 : v2;
-                vTarget = v1 + (v2 - v1) * t;
+                // interpolate a new vertex for the end that is outside, the vertex itself is not changed since
+                // other lines may share it
+                vertex v1 = m_vertices[l.v1];
+                vertex v2 = m_vertices[l.v2];
+                m_vertices.push_back(v1 + (v2 - v1) * t);
+                unsigned int &target = p1[idx] * wMult > bound * p1.w ? l.v1 : l.v2;
+                target = m_vertices.size() - 1;
             }
         }
 
-        // clip primitives so that they are contained within the render frustum
+        // clip primitives so that they are in front of the near plane and inside the guard band
+        // lines completely outside of one of the planes of the render volume are rejected (outcodes), lines that
+        // don't cross the near plane or the guard band are not clipped, and the rasterization discards the pixels
+        // outside of the frame buffer
         void clipPrimitives()  {
-            // repeat for the six planes of the viewing frustum
-            for (int side = 0; side < 6; side ++){
+            // the vertices are tested against the planes once
+            m_outcodes.resize(m_vertices.size());
+            for (int i = 0, size = m_vertices.size(); i < size; i++)
+                m_outcodes[i] = outcode(m_vertices[i].pos, clipBound(0));
+
+            m_clipCodes.assign(m_primitives.size(), 0);
+            bool clipping = false;
+            for(int i = 0, size = m_primitives.size(); i < size; i++){
+                indexedLine &l = m_primitives[i];
+                unsigned int c1 = m_outcodes[l.v1], c2 = m_outcodes[l.v2];
+                if (c1 & c2 & outsideVolume) {
+                    // both vertices are outside of the same plane
+                    l.rejected = true;
+                    m_stats.primitivesRejected++;
+                    continue;
+                }
+                m_clipCodes[i] = (c1 | c2) & clippedPlanes;
+                clipping = clipping || m_clipCodes[i] != 0;
+            }
+            if (!clipping)
+                return;
+
+            // near plane first, then the x and y planes of the guard band
+            for (int side : {5, 0, 1, 3, 4}){
                 for(int i = 0, size = m_primitives.size(); i < size; i++){
-                    if (!m_primitives[i].rejected)
-                        clipLine(m_primitives[i], side);
+                    if (m_primitives[i].rejected || !(m_clipCodes[i] & clipBit(side)))
+                        continue;
+                    clipLine(m_primitives[i], side, clipBound(side));
+                    if (m_primitives[i].rejected)
+                        m_stats.primitivesRejected++;
                 }
             }
         }
 
         // perspective division (canonical perspective volume to normalized device coordinates)
+        // the lines share their vertices, so each vertex is divided once
+        // (vertices left outside of the volume by clipping are not used anymore, their result doesn't matter)
         void divideByW() {
-            for(auto &line : m_primitives) {
-                line.v1.pos.z /= line.v1.pos.w;
-                line.v1 = line.v1 / line.v1.pos.w;
-                line.v2.pos.z /= line.v2.pos.w;
-                line.v2 = line.v2 / line.v2.pos.w;
+            for(auto &vtx : m_vertices) {
+                vtx.pos.z /= vtx.pos.w;
+                vtx = vtx / vtx.pos.w;
             }
         }
 
@@ -102,9 +226,8 @@ namespace srl {
             float halfW = width / 2;
             float halfH = height / 2;
             glm::mat4 toWindowSpace = glm::scale(glm::vec3(halfW, halfH, 1.f)) * glm::translate(glm::vec3(1.f, 1.f, 0.f));
-            for(auto &line : m_primitives) {
-                line.v1.pos = toWindowSpace * line.v1.pos;
-                line.v2.pos = toWindowSpace * line.v2.pos;
+            for(auto &vtx : m_vertices) {
+                vtx.pos = toWindowSpace * vtx.pos;
             }
         }
 
@@ -116,35 +239,233 @@ namespace srl {
                 // is current primitive visible?
                 if(line.rejected)
                     continue;
+                const vertex &v1 = m_vertices[line.v1];
+                const vertex &v2 = m_vertices[line.v2];
 
                 // vertices of the line rounded to the closest integer (aka pixel location)
-                glm::ivec2 iv1(line.v1.pos.x + .5f, line.v1.pos.y + .5f);
-                glm::ivec2 iv2(line.v2.pos.x + .5f, line.v2.pos.y + .5f);
+                glm::ivec2 iv1(v1.pos.x + .5f, v1.pos.y + .5f);
+                glm::ivec2 iv2(v2.pos.x + .5f, v2.pos.y + .5f);
                 // run the rasterization and collect all pixel locations
                 LineRasterizer rasterizer(iv1.x, iv1.y, iv2.x, iv2.y);
                 std::vector<glm::ivec2> pixels = rasterizer.all_pixels();
 
                 // create a fragment for each pixel in the rasterization
                 for (auto &pxl : pixels){
+                    // x and y are only clipped to the guard band, skip the pixels outside of the frame buffer
+                    if (pxl.x < 0 || pxl.x >= m_viewportWidth || pxl.y < 0 || pxl.y >= m_viewportHeight)
+                        continue;
+
                     fragment frag;
 
                     frag.pos = pxl;
                     // screen space interpolation factor
                     float interp = glm::length(glm::vec2(pxl - iv1)) / glm::length(glm::vec2(iv2 - iv1));
                     // hyperbolic interpolation correction
-                    float hypInterp = interp * line.v2.hypInterp + (1.f-interp) * line.v1.hypInterp;
+                    float hypInterp = interp * v2.hypInterp + (1.f-interp) * v1.hypInterp;
                     // interpolate and then apply the correction
-                    frag.depth = (interp * line.v2.pos.z + (1.f-interp) * line.v1.pos.z) / hypInterp;
-                    frag.col = (interp * line.v2.col + (1.f-interp) *line.v1.col) / hypInterp;
+                    frag.depth = (interp * v2.pos.z + (1.f-interp) * v1.pos.z) / hypInterp;
+                    frag.col = (interp * v2.col + (1.f-interp) * v1.col) / hypInterp;
 
                     outFrs.push_back(frag);
                 }
             }
         }
 
-        // lists of line primitives.
-        std::vector<line> m_primitives;
+        // what the batched rasterization needs to walk a line, computed once per draw
+        struct LineSetup {
+            // the line advances one pixel at a time along its major axis (the one it changes the most along)
+            bool xMajor;
+            // major and minor coordinates of the first vertex, change of the minor coordinate per unit of the
+            // major one, and 1 / (change of the major coordinate from the first vertex to the second)
+            float major1, minor1, gradient, invLength;
+            // major coordinates of the ends of the line, and the pixels of the major axis between them
+            float majorMin, majorMax;
+            int pixelMin, pixelMax;
+            // bands the line overlaps, none if bandMax < bandMin (the line is rejected or outside of the screen)
+            int bandMin, bandMax;
+            // depth, hyperbolic interpolation factor and color at the first vertex, and their change to the second
+            // one, so that the rasterization doesn't read the vertices again
+            float depth1, depthDelta, hypInterp1, hypInterpDelta;
+            Colors::color col1, colDelta;
+        };
+
+        // compute the setup of the visible lines, in parallel, and sort them into the lists of the bands they
+        // overlap. The lists keep the submission order
+        void setupLines(int width, int height) {
+            int size = (int) m_primitives.size();
+            m_setups.resize(size);
+            const int linesPerTask = 4096;
+            workerPool().parallelFor((size + linesPerTask - 1) / linesPerTask, [&](int task, int) {
+                for (int i = task * linesPerTask; i < std::min(size, (task + 1) * linesPerTask); i++)
+                    setupLine(i, width, height);
+            });
+
+            m_bandBins.resize((height + m_bandHeight - 1) / m_bandHeight);
+            for (auto &bin : m_bandBins)
+                bin.clear();
+            for (int i = 0; i < size; i++)
+                for (int band = m_setups[i].bandMin; band <= m_setups[i].bandMax; band++)
+                    m_bandBins[band].push_back(i);
+        }
+
+        void setupLine(int i, int width, int height) {
+            const indexedLine &l = m_primitives[i];
+            LineSetup &setup = m_setups[i];
+            setup.bandMin = 0;
+            setup.bandMax = -1;
+            if (l.rejected)
+                return;
+            const vertex &v1 = m_vertices[l.v1];
+            const vertex &v2 = m_vertices[l.v2];
+            glm::vec2 p1(v1.pos), p2(v2.pos);
+            // pixel centers are at integer coordinates, the line covers the pixels within half a pixel of it
+            // (a pixel more on each side for the antialiasing)
+            glm::ivec2 pMin = glm::ivec2(glm::floor(glm::min(p1, p2) + .5f)) - 1;
+            glm::ivec2 pMax = glm::ivec2(glm::floor(glm::max(p1, p2) + .5f)) + 1;
+            if (pMax.x < 0 || pMin.x >= width || pMax.y < 0 || pMin.y >= height)
+                return;
+            setup.bandMin = std::max(pMin.y, 0) / m_bandHeight;
+            setup.bandMax = std::min(pMax.y, height - 1) / m_bandHeight;
+
+            glm::vec2 delta = p2 - p1;
+            setup.xMajor = std::abs(delta.x) >= std::abs(delta.y);
+            int major = setup.xMajor ? 0 : 1, minor = 1 - major;
+            setup.major1 = p1[major];
+            setup.minor1 = p1[minor];
+            setup.gradient = delta[major] != 0 ? delta[minor] / delta[major] : 0.0f;
+            setup.invLength = delta[major] != 0 ? 1.0f / delta[major] : 0.0f;
+            setup.majorMin = std::min(p1[major], p2[major]);
+            setup.majorMax = std::max(p1[major], p2[major]);
+            setup.pixelMin = floorToInt(setup.majorMin + .5f);
+            setup.pixelMax = floorToInt(setup.majorMax + .5f);
+
+            setup.depth1 = v1.pos.z;
+            setup.depthDelta = v2.pos.z - v1.pos.z;
+            setup.hypInterp1 = v1.hypInterp;
+            setup.hypInterpDelta = v2.hypInterp - v1.hypInterp;
+            setup.col1 = v1.col;
+            setup.colDelta = v2.col - v1.col;
+        }
+
+        // draw the lines of one band, bands don't share pixels, so the workers can write to the frame buffers
+        // without locks
+        void rasterBand(int band, int worker, CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) {
+            int yMin = band * m_bandHeight;
+            int yMax = std::min(yMin + m_bandHeight, (int) fb.H) - 1;
+            // counted locally, the counters of the workers share cache lines
+            FragmentCounters counters;
+            for (int i : m_bandBins[band])
+                rasterLine(i, yMin, yMax, fb, db, counters);
+            m_workerCounters[worker].add(counters);
+        }
+
+        // draw the pixels of line i in rows [yMin, yMax]
+        void rasterLine(int i, int yMin, int yMax, CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db,
+                        FragmentCounters &counters) {
+            const LineSetup &setup = m_setups[i];
+            int width = fb.W;
+
+            // only walk the part of the major axis where the pixels can be inside the band and the frame buffer
+            int first = setup.pixelMin, last = setup.pixelMax;
+            int minorMin, minorMax;
+            if (setup.xMajor) {
+                first = std::max(first, 0);
+                last = std::min(last, width - 1);
+                if (setup.gradient != 0) {
+                    float m1 = setup.major1 + (yMin - 1 - setup.minor1) / setup.gradient;
+                    float m2 = setup.major1 + (yMax + 1 - setup.minor1) / setup.gradient;
+                    // clamped first, a nearly horizontal line can cross the band far outside of the int range
+                    float lo = glm::clamp(std::min(m1, m2), first - 2.0f, last + 2.0f);
+                    float hi = glm::clamp(std::max(m1, m2), first - 2.0f, last + 2.0f);
+                    first = std::max(first, floorToInt(lo) - 1);
+                    last = std::min(last, -floorToInt(-hi) + 1);
+                }
+                minorMin = yMin;
+                minorMax = yMax;
+            } else {
+                first = std::max(first, yMin);
+                last = std::min(last, yMax);
+                minorMin = 0;
+                minorMax = width - 1;
+            }
+
+            for (int m = first; m <= last; m++) {
+                // the minor coordinate is computed from the first vertex, not stepped, so that all the bands
+                // agree on the pixels of the line
+                float minor = setup.minor1 + (m - setup.major1) * setup.gradient;
+                float t = glm::clamp((m - setup.major1) * setup.invLength, 0.0f, 1.0f);
+                if (m_antialiasing) {
+                    // the end points only cover part of their pixel along the major axis
+                    float span = std::min(m + .5f, setup.majorMax) - std::max(m - .5f, setup.majorMin);
+                    int pixel = floorToInt(minor);
+                    float fraction = minor - pixel;
+                    if (pixel >= minorMin && pixel <= minorMax)
+                        plot(setup, m, pixel, t, (1.0f - fraction) * span, fb, db, counters);
+                    if (pixel + 1 >= minorMin && pixel + 1 <= minorMax)
+                        plot(setup, m, pixel + 1, t, fraction * span, fb, db, counters);
+                }
+                else {
+                    int pixel = floorToInt(minor + .5f);
+                    if (pixel >= minorMin && pixel <= minorMax)
+                        plot(setup, m, pixel, t, 1.0f, fb, db, counters);
+                }
+            }
+        }
+
+        // floor of x, for |x| < 2^31 (std::floor is a function call without SSE 4.1)
+        static int floorToInt(float x) {
+            int i = int(x);
+            return i - int(float(i) > x);
+        }
+
+        // depth test, shade and write the fragment of a line at interpolation factor t, covering coverage of the
+        // pixel at major and minor coordinates (major, minor)
+        void plot(const LineSetup &setup, int major, int minor, float t, float coverage,
+                  CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db, FragmentCounters &counters) {
+            if (!(coverage > 0.0f))
+                return;
+            int x = setup.xMajor ? major : minor, y = setup.xMajor ? minor : major;
+            counters.generated++;
+            // hyperbolic interpolation, as in rasterPrimitives
+            float invHypInterp = 1.0f / (setup.hypInterp1 + setup.hypInterpDelta * t);
+            float depth = (setup.depth1 + setup.depthDelta * t) * invHypInterp;
+            if (!(depth < db.valueAt(x, y))) {
+                counters.depthRejected++;
+                return;
+            }
+
+            fragment frag;
+            frag.pos = glm::ivec2(x, y);
+            frag.depth = depth;
+            frag.col = (setup.col1 + setup.colDelta * t) * invHypInterp;
+            processFragment(frag);
+            counters.written++;
+            if (!m_antialiasing) {
+                fb.paintAt(x, y, Colors::toRGBA32(frag.col));
+                db.paintAt(x, y, depth);
+                return;
+            }
+            frag.col.a = glm::clamp(frag.col.a, 0.0f, 1.0f) * std::min(coverage, 1.0f);
+            fb.paintAt(x, y, Colors::blend(Colors::toRGBA32(frag.col), fb.valueAt(x, y)));
+            if (coverage >= .5f)
+                db.paintAt(x, y, depth);
+        }
+
+        // vertices of the current draw, and the lines that use them
+        std::vector<vertex> m_vertices;
+        std::vector<indexedLine> m_primitives;
+        // planes each vertex is outside of, and planes each line has to be clipped against
+        std::vector<unsigned int> m_outcodes;
+        std::vector<unsigned int> m_clipCodes;
         bool wireframe = true;
+
+        // edges of the current indexed draw, grouped by their lowest vertex
+        std::vector<unsigned int> m_edgeStarts, m_edgeEnds, m_edgeCursors;
+
+        // batched rasterization: setup of each line, lines of each band, and fragment counters of each worker
+        std::vector<LineSetup> m_setups;
+        std::vector<std::vector<int>> m_bandBins;
+        std::vector<FragmentCounters> m_workerCounters;
     };
 
 }
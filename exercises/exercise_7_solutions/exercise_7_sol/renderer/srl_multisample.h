@@ -0,0 +1,108 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_SRL_MULTISAMPLE_H
+#define ITU_GRAPHICS_PROGRAMMING_SRL_MULTISAMPLE_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "glm/glm.hpp"
+#include "rasterizer/edgefunctionrasterizer.h"
+
+namespace srl {
+
+    // positions of the samples of a pixel for 1, 2, 4 and 8 samples per pixel (the standard MSAA patterns),
+    // in 1/16 of a pixel from the pixel location
+    inline const glm::ivec2 *samplePositions(unsigned int sampleCount) {
+        static const glm::ivec2 positions1[] = {{0, 0}};
+        static const glm::ivec2 positions2[] = {{4, 4}, {-4, -4}};
+        static const glm::ivec2 positions4[] = {{-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+        static const glm::ivec2 positions8[] = {{1, -3}, {-1, 3}, {5, 1}, {-3, -5}, {-5, 5}, {-7, -1}, {3, 7}, {7, -7}};
+        switch (sampleCount) {
+            case 2: return positions2;
+            case 4: return positions4;
+            case 8: return positions8;
+            default: return positions1;
+        }
+    }
+
+    // finds the samples of each pixel covered by a triangle (multisample coverage).
+    // Each sample position is rasterized with the edge function rasterizer, moving the triangle by the offset of the
+    // sample, so samples follow the same fill rule as pixels and triangles that share an edge never share a sample.
+    // The masks of the samples are then combined into one coverage mask per pixel
+    class MultisampleRasterizer {
+    public:
+        // call pixelFunc(glm::ivec2 pxl, unsigned int mask) for each pixel inside [xMin, xMax] x [yMin, yMax] where
+        // the triangle covers at least one sample, bit s of mask is set if sample s is covered.
+        // The vertices are in fixed point with subpixelBits (at least 4) fractional bits. Pixels are generated one
+        // block of the edge function rasterizer at a time, left to right along each row of the block
+        template<class PixelFunc>
+        void rasterize(glm::ivec2 v1, glm::ivec2 v2, glm::ivec2 v3, int subpixelBits, unsigned int sampleCount,
+                       int xMin, int yMin, int xMax, int yMax, PixelFunc &&pixelFunc) {
+            const int bs = edge_function_rasterizer::block_size;
+            const glm::ivec2 *offsets = samplePositions(sampleCount);
+
+            glm::ivec2 lo, hi;
+            pixelBounds(v1, v2, v3, subpixelBits, lo, hi);
+            int xLo = std::max(lo.x, xMin), xHi = std::min(hi.x, xMax);
+            int yLo = std::max(lo.y, yMin), yHi = std::min(hi.y, yMax);
+            if (xLo > xHi || yLo > yHi)
+                return;
+
+            // coverage masks of the blocks of pixels, sampleCount masks per block
+            int bx0 = xLo & ~(bs - 1), by0 = yLo & ~(bs - 1);
+            int countX = ((xHi & ~(bs - 1)) - bx0) / bs + 1;
+            int countY = ((yHi & ~(bs - 1)) - by0) / bs + 1;
+            m_masks.assign(countX * countY * sampleCount, 0);
+            for (unsigned int s = 0; s < sampleCount; s++) {
+                glm::ivec2 o = offsets[s] * (1 << (subpixelBits - 4));
+                edge_function_rasterizer rasterizer(v1.x - o.x, v1.y - o.y, v2.x - o.x, v2.y - o.y, v3.x - o.x, v3.y - o.y,
+                                                    xLo, yLo, xHi, yHi, subpixelBits);
+                for (; rasterizer.more_blocks(); rasterizer.next_block()) {
+                    int block = (rasterizer.block_x() - bx0) / bs + (rasterizer.block_y() - by0) / bs * countX;
+                    m_masks[block * sampleCount + s] = rasterizer.block_mask();
+                }
+            }
+
+            for (int block = 0, count = countX * countY; block < count; block++) {
+                const std::uint64_t *masks = &m_masks[block * sampleCount];
+                std::uint64_t covered = 0;
+                for (unsigned int s = 0; s < sampleCount; s++)
+                    covered |= masks[s];
+                int bx = bx0 + (block % countX) * bs, by = by0 + (block / countX) * bs;
+                for (; covered != 0; covered &= covered - 1) {
+                    int bit = lowestBit(covered);
+                    unsigned int mask = 0;
+                    for (unsigned int s = 0; s < sampleCount; s++)
+                        mask |= unsigned((masks[s] >> bit) & 1u) << s;
+                    pixelFunc(glm::ivec2(bx + bit % bs, by + bit / bs), mask);
+                }
+            }
+        }
+
+        // the pixels with samples that can be inside the triangle (in fixed point with subpixelBits fractional bits):
+        // its bounding box grown by half a pixel, since the samples are up to 7/16 of a pixel away from the pixel
+        // location. Screen tiles must bin the triangles with these bounds, not the ones of the pixel locations
+        static void pixelBounds(glm::ivec2 v1, glm::ivec2 v2, glm::ivec2 v3, int subpixelBits,
+                                glm::ivec2 &bMin, glm::ivec2 &bMax) {
+            const int one = 1 << subpixelBits, half = one / 2;
+            glm::ivec2 lo = glm::min(glm::min(v1, v2), v3) - half;
+            glm::ivec2 hi = glm::max(glm::max(v1, v2), v3) + half;
+            bMin = glm::ivec2((lo.x + one - 1) >> subpixelBits, (lo.y + one - 1) >> subpixelBits);
+            bMax = glm::ivec2(hi.x >> subpixelBits, hi.y >> subpixelBits);
+        }
+
+    private:
+        static int lowestBit(std::uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+            return __builtin_ctzll(mask);
+#else
+            int i = 0;
+            while (!(mask & 1)) { mask >>= 1; i++; }
+            return i;
+#endif
+        }
+
+        std::vector<std::uint64_t> m_masks;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SRL_MULTISAMPLE_H
@@ -0,0 +1,117 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_SRL_PARALLEL_H
+#define ITU_GRAPHICS_PROGRAMMING_SRL_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace srl {
+
+    // a small pool of worker threads that run the iterations of a loop in parallel
+    // the threads are created once and sleep between jobs, so that we don't pay for thread creation every frame
+    class WorkerPool {
+    public:
+        // threadCount == 0 means one thread per hardware core
+        explicit WorkerPool(unsigned int threadCount = 0) {
+            if (threadCount == 0)
+                threadCount = std::max(1u, std::thread::hardware_concurrency());
+            m_threadCount = threadCount;
+            // the calling thread works too, so we only need threadCount - 1 extra threads
+            for (unsigned int i = 1; i < threadCount; i++)
+                m_threads.emplace_back(&WorkerPool::workerLoop, this, i);
+        }
+
+        ~WorkerPool() {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_quit = true;
+            }
+            m_wakeUp.notify_all();
+            for (auto &t : m_threads)
+                t.join();
+        }
+
+        WorkerPool(WorkerPool const&) = delete;
+        void operator=(WorkerPool const&) = delete;
+
+        unsigned int threadCount() const { return m_threadCount; }
+
+        // call task(index, worker) for every index in [0, count) and wait until all calls return
+        // worker is in [0, threadCount()) and can be used to access per thread scratch memory
+        // indices are handed out one at a time, so uneven workloads are balanced between the threads
+        void parallelFor(int count, const std::function<void(int index, int worker)> &task) {
+            if (count <= 0)
+                return;
+            if (m_threadCount == 1 || count == 1) {
+                for (int i = 0; i < count; i++)
+                    task(i, 0);
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_task = &task;
+                m_count = count;
+                m_next = 0;
+                m_busy = (int) m_threads.size();
+                m_job++;
+            }
+            m_wakeUp.notify_all();
+
+            runTask(0);
+
+            // wait for the other workers to finish their last index
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait(lock, [this] { return m_busy == 0; });
+            m_task = nullptr;
+        }
+
+    private:
+        void runTask(int worker) {
+            for (int i = m_next++; i < m_count; i = m_next++)
+                (*m_task)(i, worker);
+        }
+
+        void workerLoop(int worker) {
+            unsigned long long lastJob = 0;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_wakeUp.wait(lock, [&] { return m_quit || m_job != lastJob; });
+                    if (m_quit)
+                        return;
+                    lastJob = m_job;
+                }
+
+                runTask(worker);
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_busy--;
+                }
+                m_done.notify_one();
+            }
+        }
+
+        unsigned int m_threadCount;
+        std::vector<std::thread> m_threads;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wakeUp;
+        std::condition_variable m_done;
+
+        // current job
+        const std::function<void(int, int)> *m_task = nullptr;
+        int m_count = 0;
+        std::atomic<int> m_next{0};
+        int m_busy = 0;
+        unsigned long long m_job = 0;
+        bool m_quit = false;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SRL_PARALLEL_H
@@ -5,14 +5,199 @@
 #ifndef ITU_GRAPHICS_PROGRAMMING_SRL_POINT_RENDERER_H
 #define ITU_GRAPHICS_PROGRAMMING_SRL_POINT_RENDERER_H
 
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/transform.hpp>
 #include "srl_renderer.h"
 #include "srl_types.h"
 
 namespace srl {
+    // point clouds (see render(const PointCloud &, ...)) skip the primitive stages: each point is transformed,
+    // tested against the frustum and projected in one pass, by all the worker threads at once, straight into a
+    // buffer with a 64 bits word per pixel. The word has the depth of the point in its high 32 bits and its color in
+    // the low 32 bits, so an atomic min of the word keeps the nearest point of the pixel, without locks, binning or
+    // sorting (points at the same depth keep the smallest color, so the result doesn't depend on the order the
+    // threads run). A second pass depth tests the pixels against the depth buffer and writes them to the frame buffer
     class PointRenderer : public Renderer {
+    public:
+        // point clouds: fill the pixels that no point covers when most of their 8 neighbours are covered, with the
+        // nearest of the neighbours, to close the gaps between the points of dense surfaces
+        bool m_fillHoles = false;
+
+        using Renderer::render;
+
+        // render the points of cloud with mvp transformation in the fb framebuffer. The colors are written as they
+        // are (the fixed fragment shader passes the color through)
+        void render(const PointCloud &cloud,
+                    const glm::mat4 &m,
+                    const glm::mat4 &vp,
+                    CustomFrameBuffer <uint32_t> &fb,
+                    CustomFrameBuffer <float> &db) {
+            assert(cloud.positions.size() == cloud.colors.size() && fb.S == db.S);
+            m_viewportWidth = fb.W;
+            m_viewportHeight = fb.H;
+            m_viewportSamples = fb.S;
+            resetStats(fb);
+            m_stats.primitivesIn = (int) cloud.positions.size();
+            resizeSplats(fb.W, fb.H);
+
+            WorkerPool &pool = workerPool();
+            m_workerCounters.assign(pool.threadCount(), FragmentCounters());
+            {
+                // the vertex stages, the rasterization and the depth test between the points are all done here
+                StageTimer timer(m_stats.rasterPrimitivesNs);
+                glm::mat4 modelViewProjection = vp * m;
+                int size = (int) cloud.positions.size();
+                pool.parallelFor((size + splatBatch - 1) / splatBatch, [&](int batch, int worker) {
+                    splat(cloud, batch * splatBatch, std::min(size, (batch + 1) * splatBatch), modelViewProjection,
+                          m_workerCounters[worker]);
+                });
+            }
+            // the points that are not in the frame buffer are the only ones that don't make a fragment
+            long long splatted = 0;
+            for (auto &counters : m_workerCounters)
+                splatted += counters.generated;
+            m_stats.primitivesRejected = m_stats.primitivesIn - (int) splatted;
+            {
+                StageTimer timer(m_stats.writeToFrameBufferNs);
+                pool.parallelFor((int) fb.H, [&](int y, int worker) {
+                    // counted locally, the counters of the workers share cache lines
+                    FragmentCounters counters;
+                    resolveSplats(y, fb, db, counters);
+                    m_workerCounters[worker].add(counters);
+                });
+                // filling the holes reads the neighbours of the pixels, so the rows can only be emptied afterwards
+                if (m_fillHoles) {
+                    pool.parallelFor((int) fb.H, [&](int y, int) {
+                        std::atomic<std::uint64_t> *row = m_splats.get() + y * m_splatsWidth;
+                        for (unsigned int x = 0; x < m_splatsWidth; x++)
+                            row[x].store(emptySplat, std::memory_order_relaxed);
+                    });
+                }
+            }
+            for (auto &counters : m_workerCounters)
+                m_stats.fragments.add(counters);
+            // the points hidden by a nearer point of their pixel failed the depth test too
+            m_stats.fragments.depthRejected = m_stats.fragments.generated - m_stats.fragments.written;
+        }
+
     private:
+        // points splatted by each task of the worker pool
+        static const int splatBatch = 1 << 16;
+        // covered neighbours that make an empty pixel a hole
+        static const int holeNeighbours = 5;
+        // pixels with no point: greater than the word of any point
+        static const std::uint64_t emptySplat = ~std::uint64_t(0);
+
+        // the word of a point, its bits compare as unsigned ints in the same order as the depths compare as floats:
+        // the sign bit of positive depths is set, and all the bits of negative depths are flipped
+        static std::uint64_t splatWord(float depth, std::uint32_t color) {
+            std::uint32_t bits;
+            std::memcpy(&bits, &depth, sizeof(bits));
+            bits = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+            return (std::uint64_t(bits) << 32) | color;
+        }
+
+        static float splatDepth(std::uint64_t word) {
+            std::uint32_t bits = std::uint32_t(word >> 32);
+            bits = (bits & 0x80000000u) ? bits & 0x7FFFFFFFu : ~bits;
+            float depth;
+            std::memcpy(&depth, &bits, sizeof(depth));
+            return depth;
+        }
+
+        // the buffer starts empty, and resolveSplats empties it again
+        void resizeSplats(unsigned int width, unsigned int height) {
+            if (m_splatsWidth == width && m_splatsHeight == height)
+                return;
+            m_splatsWidth = width;
+            m_splatsHeight = height;
+            m_splats.reset(new std::atomic<std::uint64_t>[width * height]);
+            for (unsigned int i = 0; i < width * height; i++)
+                m_splats[i].store(emptySplat, std::memory_order_relaxed);
+        }
+
+        // transform the points [begin, end) of cloud and keep the nearest point of each pixel. The clipping test,
+        // the perspective division and the mapping to the window are the same as the ones of the primitive stages
+        void splat(const PointCloud &cloud, int begin, int end, const glm::mat4 &mvp, FragmentCounters &counters) {
+            float halfW = float(m_viewportWidth / 2), halfH = float(m_viewportHeight / 2);
+            unsigned int width = m_splatsWidth, height = m_splatsHeight;
+            std::atomic<std::uint64_t> *splats = m_splats.get();
+            long long generated = 0;
+            for (int i = begin; i < end; i++) {
+                const glm::vec3 &p = cloud.positions[i];
+                glm::vec4 pos = mvp[0] * p.x + mvp[1] * p.y + mvp[2] * p.z + mvp[3];
+                // outside of the frustum, w <= 0 is tested on its own so that no point is divided by 0
+                if (!(pos.w > 0.0f) || std::abs(pos.x) > pos.w || std::abs(pos.y) > pos.w || std::abs(pos.z) > pos.w)
+                    continue;
+                float invW = 1.0f / pos.w;
+                // the window coordinates are not negative, so the casts round to the nearest pixel
+                unsigned int x = (unsigned int) (pos.x * invW * halfW + halfW + .5f);
+                unsigned int y = (unsigned int) (pos.y * invW * halfH + halfH + .5f);
+                if (x >= width || y >= height)
+                    continue;
+                generated++;
+
+                // z is divided by w twice, like the primitive stages do
+                std::uint64_t word = splatWord(pos.z * invW * invW, cloud.colors[i]);
+                std::atomic<std::uint64_t> &pixel = splats[x + y * width];
+                // most points are behind the one already in the pixel and only pay for the load
+                std::uint64_t current = pixel.load(std::memory_order_relaxed);
+                while (word < current && !pixel.compare_exchange_weak(current, word, std::memory_order_relaxed)) {}
+            }
+            counters.generated += generated;
+        }
+
+        // covered pixels of a column of 3 pixels, and the nearest of their words
+        struct SplatColumn {
+            int covered;
+            std::uint64_t nearest;
+        };
+
+        SplatColumn splatColumn(unsigned int x, unsigned int y) const {
+            SplatColumn column{0, emptySplat};
+            for (unsigned int ny = y - 1; ny <= y + 1; ny++) {
+                std::uint64_t word = m_splats[x + ny * m_splatsWidth].load(std::memory_order_relaxed);
+                column.covered += word != emptySplat;
+                column.nearest = std::min(column.nearest, word);
+            }
+            return column;
+        }
+
+        // depth test the nearest point of the pixels of row y against db and write the ones that pass, the row is
+        // emptied unless the holes are filled. A hole takes the nearest of its neighbours, and counts as a fragment
+        // (the points that are behind another point of their pixel are counted by render). The pixels on the border
+        // of the buffer are never holes
+        void resolveSplats(int y, CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db,
+                           FragmentCounters &counters) {
+            std::atomic<std::uint64_t> *row = m_splats.get() + y * m_splatsWidth;
+            // the 3 x 3 neighbours of the pixel, as 3 columns that slide along the row
+            bool fill = m_fillHoles && y > 0 && y + 1 < (int) m_splatsHeight;
+            SplatColumn left{0, emptySplat}, center{0, emptySplat};
+            SplatColumn right = fill ? splatColumn(0, y) : SplatColumn{0, emptySplat};
+            for (unsigned int x = 0; x < m_splatsWidth; x++) {
+                std::uint64_t word = row[x].load(std::memory_order_relaxed);
+                if (fill) {
+                    left = center;
+                    center = right;
+                    right = x + 1 < m_splatsWidth ? splatColumn(x + 1, y) : SplatColumn{0, emptySplat};
+                }
+                if (word == emptySplat) {
+                    if (!fill || x == 0 || x + 1 == m_splatsWidth ||
+                        left.covered + center.covered + right.covered < holeNeighbours)
+                        continue;
+                    word = std::min(std::min(left.nearest, center.nearest), right.nearest);
+                    counters.generated++;
+                }
+                else if (!m_fillHoles)
+                    row[x].store(emptySplat, std::memory_order_relaxed);
+                writeFragment(x, y, splatDepth(word), std::uint32_t(word), fb, db, counters);
+            }
+        }
 
         // create point primitives
         void assemblePrimitives(const std::vector<vertex> &vts) override {
@@ -25,6 +210,7 @@ namespace srl {
                 p.v1 = vts[i];
                 m_primitives.push_back(p);
             }
+            m_stats.primitivesIn = m_primitives.size();
         }
 
         static void clipPoint(point &p, int side){
@@ -50,8 +236,11 @@ namespace srl {
             // repeat for the six planes of the viewing frustum
             for (int side = 0; side < 6; side ++){
                 for(auto & p : m_primitives){
-                    if (!p.rejected)
-                        clipPoint(p, side);
+                    if (p.rejected)
+                        continue;
+                    clipPoint(p, side);
+                    if (p.rejected)
+                        m_stats.primitivesRejected++;
                 }
             }
         }
@@ -97,6 +286,12 @@ namespace srl {
 
         // lists of point primitives, part of the class so that we avoid reallocating memory every frame
         std::vector<point> m_primitives;
+
+        // nearest point of each pixel of the point clouds, as the words of splatWord
+        std::unique_ptr<std::atomic<std::uint64_t>[]> m_splats;
+        unsigned int m_splatsWidth = 0, m_splatsHeight = 0;
+        // fragments of each worker thread
+        std::vector<FragmentCounters> m_workerCounters;
     };
 
 }
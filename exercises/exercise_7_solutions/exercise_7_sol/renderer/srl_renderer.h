@@ -7,14 +7,196 @@
 
 #include <vector>
 #include <algorithm>
+#include <memory>
+#include <limits>
+#include <cstdint>
+#include <chrono>
+#include <sstream>
+#include <string>
 #include "glm/glm.hpp"
 #include "srl_types.h"
+#include "srl_parallel.h"
+#include "srl_vertex_stream.h"
+#include "srl_shaders.h"
 
 
 namespace srl {
-    class Renderer {
 
+    // clipping volume shared by the pipelines: outcodes of the vertices and the planes primitives are clipped against
+    class ClipVolume {
     public:
+        // primitives are only clipped against the near plane and the guard band -g * w <= x, y <= g * w,
+        // the parts outside of the frame buffer are discarded by the rasterizer (must be >= 1)
+        float m_guardBand = 2.0f;
+
+    protected:
+        // the outcode of a vertex has a bit set for each plane of the clipping volume the vertex is outside of.
+        // Bits 0 to 5 are the planes x, y, z = w and x, y, z = -w (in the same order as the "side" of the clippers),
+        // and bits 6 to 11 are the same planes moved out to the guard band (only x and y are used)
+        static const unsigned int outsideVolume = 0x3Fu;
+        // the planes primitives are actually clipped against: the near plane and the guard band
+        static const unsigned int clippedPlanes = (1u << 5) | (0x3Fu << 6);
+
+        // the x and y planes of the viewport are at -b * w <= x, y <= b * w, with b = viewportBound
+        static unsigned int outcode(const glm::vec4 &p, float guardBand, float viewportBound = 1.0f) {
+            unsigned int code = 0;
+            for (int side = 0; side < 6; side++) {
+                int idx = side % 3;
+                float wMult = side > 2 ? -1.0f : 1.0f;
+                if (p[idx] * wMult > (idx < 2 ? viewportBound : 1.0f) * p.w)
+                    code |= 1u << side;
+                if (idx < 2 && p[idx] * wMult > guardBand * p.w)
+                    code |= 1u << (side + 6);
+            }
+            return code;
+        }
+
+        // primitives are only clipped against the near plane (side 5) and the x and y planes of the guard band,
+        // near plane first. Outcode bit that tells a primitive must be clipped against a side, and the distance
+        // of that side in units of w
+        static unsigned int clipBit(int side) {
+            return side == 5 ? 1u << 5 : 1u << (side + 6);
+        }
+
+        float clipBound(int side) const {
+            return side == 5 ? 1.0f : std::max(m_guardBand, 1.0f);
+        }
+
+        // the samples of a multisampled pixel can be up to half a pixel outside of the viewport, so primitives are
+        // only rejected if they are more than half a pixel out (half a pixel is 1 / width in normalized coordinates)
+        static float viewportBound(int width, int height, unsigned int sampleCount) {
+            return sampleCount > 1 ? 1.0f + 1.0f / float(std::min(width, height)) : 1.0f;
+        }
+    };
+
+    // fragments generated by the rasterization, and how many of them failed the depth test or were written
+    // (fragments outside of the frame buffer are neither)
+    struct FragmentCounters {
+        long long generated = 0, depthRejected = 0, written = 0;
+        // blocks of pixels whose depth was written as a plane (see CustomFrameBuffer::setPlaneCompression), the
+        // fragments of these blocks are neither depth tested against the buffer nor written to it one by one
+        long long planeBlocks = 0;
+
+        void add(const FragmentCounters &other) {
+            generated += other.generated;
+            depthRejected += other.depthRejected;
+            written += other.written;
+            planeBlocks += other.planeBlocks;
+        }
+    };
+
+    // statistics of the last draw of a renderer (see Renderer::stats). They are always collected, which costs two
+    // clock reads per stage and a counter per primitive and per fragment
+    struct RenderStats {
+        // time spent in each stage, in nanoseconds. Renderers that stream the fragments through the depth test and
+        // the fragment shader, or rasterize in tiles, interleave the last three stages and count them all in
+        // rasterPrimitivesNs (as well as the triangle setup)
+        std::int64_t processVerticesNs = 0, assemblePrimitivesNs = 0, backfaceCullingNs = 0, clipPrimitivesNs = 0,
+                     divideByWNs = 0, toScreenSpaceNs = 0, rasterPrimitivesNs = 0, processFragmentsNs = 0,
+                     writeToFrameBufferNs = 0;
+
+        // primitives made by the primitive assembly, added by clipping, rejected by back face culling, and rejected
+        // by clipping (outside of the clipping volume) or by the triangle setup (no area or no pixels on the screen)
+        int primitivesIn = 0, primitivesClipped = 0, primitivesCulled = 0, primitivesRejected = 0;
+
+        FragmentCounters fragments;
+
+        // pixels of the frame buffer
+        int pixelCount = 0;
+
+        // primitives that reach the rasterization
+        int primitivesOut() const {
+            return primitivesIn + primitivesClipped - primitivesCulled - primitivesRejected;
+        }
+
+        // average number of fragments per pixel of the frame buffer
+        double overdraw() const {
+            return pixelCount > 0 ? double(fragments.generated) / pixelCount : 0.0;
+        }
+
+        std::int64_t totalNs() const {
+            return processVerticesNs + assemblePrimitivesNs + backfaceCullingNs + clipPrimitivesNs + divideByWNs +
+                   toScreenSpaceNs + rasterPrimitivesNs + processFragmentsNs + writeToFrameBufferNs;
+        }
+
+        // sum of the statistics of several draws (e.g. to average them over frames)
+        void add(const RenderStats &other) {
+            processVerticesNs += other.processVerticesNs;
+            assemblePrimitivesNs += other.assemblePrimitivesNs;
+            backfaceCullingNs += other.backfaceCullingNs;
+            clipPrimitivesNs += other.clipPrimitivesNs;
+            divideByWNs += other.divideByWNs;
+            toScreenSpaceNs += other.toScreenSpaceNs;
+            rasterPrimitivesNs += other.rasterPrimitivesNs;
+            processFragmentsNs += other.processFragmentsNs;
+            writeToFrameBufferNs += other.writeToFrameBufferNs;
+            primitivesIn += other.primitivesIn;
+            primitivesClipped += other.primitivesClipped;
+            primitivesCulled += other.primitivesCulled;
+            primitivesRejected += other.primitivesRejected;
+            fragments.add(other.fragments);
+            pixelCount += other.pixelCount;
+        }
+
+        // the statistics as a single line JSON object
+        std::string toJson() const {
+            std::ostringstream out;
+            out << "{\"timeNs\": {\"processVertices\": " << processVerticesNs
+                << ", \"assemblePrimitives\": " << assemblePrimitivesNs
+                << ", \"backfaceCulling\": " << backfaceCullingNs
+                << ", \"clipPrimitives\": " << clipPrimitivesNs
+                << ", \"divideByW\": " << divideByWNs
+                << ", \"toScreenSpace\": " << toScreenSpaceNs
+                << ", \"rasterPrimitives\": " << rasterPrimitivesNs
+                << ", \"processFragments\": " << processFragmentsNs
+                << ", \"writeToFrameBuffer\": " << writeToFrameBufferNs
+                << ", \"total\": " << totalNs() << "}"
+                << ", \"primitives\": {\"in\": " << primitivesIn << ", \"clipped\": " << primitivesClipped
+                << ", \"culled\": " << primitivesCulled << ", \"rejected\": " << primitivesRejected
+                << ", \"out\": " << primitivesOut() << "}"
+                << ", \"fragments\": {\"generated\": " << fragments.generated
+                << ", \"depthRejected\": " << fragments.depthRejected << ", \"written\": " << fragments.written
+                << ", \"planeBlocks\": " << fragments.planeBlocks << "}"
+                << ", \"pixels\": " << pixelCount << ", \"overdraw\": " << overdraw() << "}";
+            return out.str();
+        }
+    };
+
+    // adds the time from its construction to its destruction to a timer of RenderStats
+    class StageTimer {
+    public:
+        explicit StageTimer(std::int64_t &ns) : m_ns(ns), m_start(std::chrono::steady_clock::now()) {}
+
+        ~StageTimer() {
+            m_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+        }
+
+        StageTimer(StageTimer const&) = delete;
+        void operator=(StageTimer const&) = delete;
+
+    private:
+        std::int64_t &m_ns;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    class CommandBuffer;
+
+    class Renderer : public ClipVolume {
+        // runs the vertex stage of its draws itself, and the rest of the pipeline with renderTransformed
+        friend class CommandBuffer;
+
+    public:
+        // number of threads used by the parallel stages of the renderer (0 means one per core)
+        unsigned int m_threadCount = 0;
+
+        // run the geometry stages on the worker threads: the vertex shader, and the primitive stages of the renderers
+        // that support it (TriangleRenderer), in chunks of geometryChunkSize vertices or primitives. The results of
+        // the chunks are put back together in the order of the chunks, so the primitives are rasterized in the same
+        // order whatever the number of threads
+        bool m_parallelGeometry = false;
+
+        // statistics of the last call to render
+        const RenderStats &stats() const { return m_stats; }
 
         // render vertices with mvp transformation in the fb framebuffer
         void render(const std::vector<vertex> &vts,
@@ -27,34 +209,338 @@ namespace srl {
             //  to make the Software Render Library work, you have to call all methods
             //  in this class, in the right order and with the right parameters.
 
-            std::vector<vertex> _vts = vts; // copy all vertices from vts to _vts (since vts is a const)
-            std::vector<fragment> _frs;    // vector that will store the fragments
+            // the vertices and the fragments are members of the class, so that the next calls reuse their memory
+            m_clipVertices.assign(vts.begin(), vts.end()); // copy all vertices from vts (since vts is a const)
             glm::mat4 modelViewProjection = vp * m; // the matrix that transform points from local space to clipping space
 
-            processVertices(modelViewProjection, _vts);
-            assemblePrimitives(_vts);
-            clipPrimitives();
-            divideByW();
-            toScreenSpace(fb.W, fb.H);
-            backfaceCulling();
-            rasterPrimitives(_frs);
-            processFragments(_frs);
-            writeToFrameBuffer(_frs, fb, db);
+            m_viewportWidth = fb.W;
+            m_viewportHeight = fb.H;
+            m_viewportSamples = fb.S;
+            resetStats(fb);
+
+            { StageTimer timer(m_stats.processVerticesNs); processVerticesInChunks(modelViewProjection, m_clipVertices); }
+            { StageTimer timer(m_stats.assemblePrimitivesNs); assemblePrimitives(m_clipVertices); }
+            { StageTimer timer(m_stats.backfaceCullingNs); backfaceCulling(); }
+            { StageTimer timer(m_stats.clipPrimitivesNs); clipPrimitives(); }
+            { StageTimer timer(m_stats.divideByWNs); divideByW(); }
+            { StageTimer timer(m_stats.toScreenSpaceNs); toScreenSpace(fb.W, fb.H); }
+            drawPrimitives(m_fragments, fb, db); // rasterPrimitives, processFragments and writeToFrameBuffer
 
             //  MIND THAT THE METHODS BELOW ARE NOT DECLARED/DEFINED IN THE RIGHT ORDER!
 
         }
 
+        // render the triangles made by the indices (16 or 32 bits) to the vertices vts, with mvp transformation
+        // the largest value of the index type restarts the strip or fan (primitive restart).
+        // each vertex that is used is only transformed once, however many triangles share it
+        void render(const std::vector<vertex> &vts,
+                    const std::vector<std::uint16_t> &indices,
+                    Topology topology,
+                    const glm::mat4 &m,
+                    const glm::mat4 &vp,
+                    CustomFrameBuffer <uint32_t> &fb,
+                    CustomFrameBuffer <float> &db) {
+            renderIndexed(vts, indices, topology, m, vp, fb, db);
+        }
+
+        void render(const std::vector<vertex> &vts,
+                    const std::vector<std::uint32_t> &indices,
+                    Topology topology,
+                    const glm::mat4 &m,
+                    const glm::mat4 &vp,
+                    CustomFrameBuffer <uint32_t> &fb,
+                    CustomFrameBuffer <float> &db) {
+            renderIndexed(vts, indices, topology, m, vp, fb, db);
+        }
+
+        // same as above, with the vertices stored as a structure of arrays
+        // the vertices are transformed several at a time with SIMD instructions. If they are all inside the
+        // clipping volume, clipping can't change the primitives, so the perspective division and the mapping
+        // to window coordinates are also done on the whole stream before the primitives are assembled
+        void render(const VertexStream &vts,
+                    const glm::mat4 &m,
+                    const glm::mat4 &vp,
+                    CustomFrameBuffer <uint32_t> &fb,
+                    CustomFrameBuffer <float> &db) {
+
+            glm::mat4 modelViewProjection = vp * m;
+            m_viewportWidth = fb.W;
+            m_viewportHeight = fb.H;
+            m_viewportSamples = fb.S;
+            resetStats(fb);
+
+            {
+                StageTimer timer(m_stats.processVerticesNs);
+                m_vertexStream = vts; // reuses the memory of the previous calls
+                processVertices(modelViewProjection, m_vertexStream);
+            }
+
+            if (m_vertexStream.insideClipVolume()) {
+                { StageTimer timer(m_stats.divideByWNs); m_vertexStream.divideByW(); }
+                { StageTimer timer(m_stats.toScreenSpaceNs); m_vertexStream.toScreenSpace(fb.W, fb.H); }
+                {
+                    StageTimer timer(m_stats.assemblePrimitivesNs);
+                    m_vertexStream.toVertices(m_streamVertices);
+                    assemblePrimitives(m_streamVertices);
+                }
+                // w is 1 in window coordinates, so the clipping space test still works
+                { StageTimer timer(m_stats.backfaceCullingNs); backfaceCulling(); }
+            }
+            else {
+                {
+                    StageTimer timer(m_stats.assemblePrimitivesNs);
+                    m_vertexStream.toVertices(m_streamVertices);
+                    assemblePrimitives(m_streamVertices);
+                }
+                { StageTimer timer(m_stats.backfaceCullingNs); backfaceCulling(); }
+                { StageTimer timer(m_stats.clipPrimitivesNs); clipPrimitives(); }
+                { StageTimer timer(m_stats.divideByWNs); divideByW(); }
+                { StageTimer timer(m_stats.toScreenSpaceNs); toScreenSpace(fb.W, fb.H); }
+            }
+            drawPrimitives(m_fragments, fb, db);
+        }
+
         virtual ~Renderer(){};
+
+    protected:
+        // generate the fragments of the primitives, process them and write them to the frame buffer
+        // renderers can override this to run these stages in a different way (e.g. in parallel)
+        virtual void drawPrimitives(std::vector<fragment> &frs, CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) {
+            { StageTimer timer(m_stats.rasterPrimitivesNs); rasterPrimitives(frs); }
+            m_stats.fragments.generated += frs.size();
+            { StageTimer timer(m_stats.processFragmentsNs); processFragments(frs); }
+            { StageTimer timer(m_stats.writeToFrameBufferNs); writeToFrameBuffer(frs, fb, db, m_stats.fragments); }
+        }
+
+        // size of the frame buffer of the current draw, primitives must be scissored to it when rasterized
+        int m_viewportWidth = 0, m_viewportHeight = 0;
+        unsigned int m_viewportSamples = 1;
+
+        // statistics of the current draw, the renderers count the primitives they add or reject in their stages
+        RenderStats m_stats;
+
+        void resetStats(const CustomFrameBuffer <uint32_t> &fb) {
+            m_stats = RenderStats();
+            m_stats.pixelCount = fb.W * fb.H;
+        }
+
+        // worker threads shared by the parallel stages, (re)created when m_threadCount changes
+        WorkerPool &workerPool() {
+            if (!m_workerPool || m_workerPoolThreads != m_threadCount) {
+                m_workerPool.reset(new WorkerPool(m_threadCount));
+                m_workerPoolThreads = m_threadCount;
+            }
+            return *m_workerPool;
+        }
+
+        // vertices or primitives per task of the parallel geometry stages. The chunks don't depend on the number of
+        // threads, so neither do the results of the stages
+        static const int geometryChunkSize = 4096;
+
+        // number of chunks forEachChunk splits count vertices or primitives into (a single chunk without
+        // m_parallelGeometry)
+        int chunkCount(int count) const {
+            if (!m_parallelGeometry)
+                return 1;
+            return std::max(1, (count + geometryChunkSize - 1) / geometryChunkSize);
+        }
+
+        // call chunkFunc(chunk, begin, end) for each chunk [begin, end) of [0, count), on the worker threads with
+        // m_parallelGeometry, and return the sum of the ints it returns (e.g. the primitives a stage rejected)
+        template<class ChunkFunc>
+        int forEachChunk(int count, ChunkFunc &&chunkFunc) {
+            int chunks = chunkCount(count);
+            if (chunks == 1)
+                return chunkFunc(0, 0, count);
+            m_chunkResults.assign(chunks, 0);
+            workerPool().parallelFor(chunks, [&](int chunk, int) {
+                m_chunkResults[chunk] = chunkFunc(chunk, chunk * geometryChunkSize,
+                                                  std::min(count, (chunk + 1) * geometryChunkSize));
+            });
+            int sum = 0;
+            for (int result : m_chunkResults)
+                sum += result;
+            return sum;
+        }
+
     private:
+        // the stages after the vertex shader, for vertices that are already in clipping space
+        void renderTransformed(const std::vector<vertex> &clipVts,
+                               CustomFrameBuffer <uint32_t> &fb,
+                               CustomFrameBuffer <float> &db) {
+            m_viewportWidth = fb.W;
+            m_viewportHeight = fb.H;
+            m_viewportSamples = fb.S;
+            resetStats(fb);
+
+            { StageTimer timer(m_stats.assemblePrimitivesNs); assemblePrimitives(clipVts); }
+            { StageTimer timer(m_stats.backfaceCullingNs); backfaceCulling(); }
+            { StageTimer timer(m_stats.clipPrimitivesNs); clipPrimitives(); }
+            { StageTimer timer(m_stats.divideByWNs); divideByW(); }
+            { StageTimer timer(m_stats.toScreenSpaceNs); toScreenSpace(fb.W, fb.H); }
+            drawPrimitives(m_fragments, fb, db);
+        }
+
+        // same as above for an indexed draw, all the vertices of clipVts are transformed (there is no post-transform
+        // cache to skip the ones the indices don't use)
+        template<class Index>
+        void renderTransformed(const std::vector<vertex> &clipVts,
+                               const std::vector<Index> &indices,
+                               Topology topology,
+                               CustomFrameBuffer <uint32_t> &fb,
+                               CustomFrameBuffer <float> &db) {
+            m_viewportWidth = fb.W;
+            m_viewportHeight = fb.H;
+            m_viewportSamples = fb.S;
+            resetStats(fb);
+
+            {
+                StageTimer timer(m_stats.assemblePrimitivesNs);
+                listTriangles(indices, topology, (unsigned int) clipVts.size(), m_triangleIndices);
+                assembleIndexedPrimitives(clipVts, m_triangleIndices);
+            }
+            { StageTimer timer(m_stats.backfaceCullingNs); backfaceCulling(); }
+            { StageTimer timer(m_stats.clipPrimitivesNs); clipPrimitives(); }
+            { StageTimer timer(m_stats.divideByWNs); divideByW(); }
+            { StageTimer timer(m_stats.toScreenSpaceNs); toScreenSpace(fb.W, fb.H); }
+            drawPrimitives(m_fragments, fb, db);
+        }
+
+        template<class Index>
+        void renderIndexed(const std::vector<vertex> &vts,
+                           const std::vector<Index> &indices,
+                           Topology topology,
+                           const glm::mat4 &m,
+                           const glm::mat4 &vp,
+                           CustomFrameBuffer <uint32_t> &fb,
+                           CustomFrameBuffer <float> &db) {
+
+            glm::mat4 modelViewProjection = vp * m;
+            m_viewportWidth = fb.W;
+            m_viewportHeight = fb.H;
+            m_viewportSamples = fb.S;
+            resetStats(fb);
+
+            {
+                // the post-transform cache is counted as part of the primitive assembly
+                StageTimer timer(m_stats.assemblePrimitivesNs);
+                listTriangles(indices, topology, (unsigned int) vts.size(), m_triangleIndices);
+
+                // post-transform cache: copy each vertex used by the triangles once, in the order they are first used,
+                // and point the triangles to the copy. m_cacheSlots stores where each vertex of vts was copied to
+                m_indexedVertices.clear();
+                m_cacheSlots.assign(vts.size(), -1);
+                for (auto &index : m_triangleIndices) {
+                    int &slot = m_cacheSlots[index];
+                    if (slot < 0) {
+                        slot = (int) m_indexedVertices.size();
+                        m_indexedVertices.push_back(vts[index]);
+                    }
+                    index = (unsigned int) slot;
+                }
+            }
+
+            { StageTimer timer(m_stats.processVerticesNs); processVerticesInChunks(modelViewProjection, m_indexedVertices); }
+            { StageTimer timer(m_stats.assemblePrimitivesNs); assembleIndexedPrimitives(m_indexedVertices, m_triangleIndices); }
+            { StageTimer timer(m_stats.backfaceCullingNs); backfaceCulling(); }
+            { StageTimer timer(m_stats.clipPrimitivesNs); clipPrimitives(); }
+            { StageTimer timer(m_stats.divideByWNs); divideByW(); }
+            { StageTimer timer(m_stats.toScreenSpaceNs); toScreenSpace(fb.W, fb.H); }
+            drawPrimitives(m_fragments, fb, db);
+        }
+
+        // split the indices into a list of triangles (3 indices per triangle)
+        // triangles with an index outside [0, vertexCount) are skipped
+        template<class Index>
+        static void listTriangles(const std::vector<Index> &indices, Topology topology, unsigned int vertexCount,
+                                  std::vector<unsigned int> &triangleIndices) {
+            const Index restart = std::numeric_limits<Index>::max();
+            triangleIndices.clear();
+            triangleIndices.reserve(topology == Topology::triangleList ? indices.size() : indices.size() * 3);
+
+            auto addTriangle = [&](unsigned int i1, unsigned int i2, unsigned int i3) {
+                if (i1 < vertexCount && i2 < vertexCount && i3 < vertexCount) {
+                    triangleIndices.push_back(i1);
+                    triangleIndices.push_back(i2);
+                    triangleIndices.push_back(i3);
+                }
+            };
+
+            // previous indices, and number of indices since the start or the last restart
+            unsigned int v[3] = {0, 0, 0};
+            int count = 0;
+            for (Index index : indices) {
+                if (index == restart) {
+                    count = 0;
+                    continue;
+                }
+                switch (topology) {
+                    case Topology::triangleList:
+                        v[count % 3] = index;
+                        if (count % 3 == 2)
+                            addTriangle(v[0], v[1], v[2]);
+                        break;
+                    case Topology::triangleStrip:
+                        // swap the first two vertices of every other triangle, so they all have the same winding order
+                        if (count >= 2) {
+                            if (count % 2 == 0)
+                                addTriangle(v[0], v[1], index);
+                            else
+                                addTriangle(v[1], v[0], index);
+                        }
+                        v[0] = v[1];
+                        v[1] = index;
+                        break;
+                    case Topology::triangleFan:
+                        if (count == 0)
+                            v[0] = index;
+                        else {
+                            if (count >= 2)
+                                addTriangle(v[0], v[1], index);
+                            v[1] = index;
+                        }
+                        break;
+                }
+                count++;
+            }
+        }
+
+        std::unique_ptr<WorkerPool> m_workerPool;
+        unsigned int m_workerPoolThreads = 0;
+        // value returned by each chunk of forEachChunk
+        std::vector<int> m_chunkResults;
+
+        // transformed vertices and fragments of the current draw
+        std::vector<vertex> m_clipVertices;
+        std::vector<fragment> m_fragments;
+
+        // transformed vertices of the current indexed draw, the triangles that use them, and the post-transform cache
+        std::vector<vertex> m_indexedVertices;
+        std::vector<unsigned int> m_triangleIndices;
+        std::vector<int> m_cacheSlots;
+
+        // transformed copy of the vertex stream, and its vertices as an array of structs for the primitive stages
+        VertexStream m_vertexStream;
+        std::vector<vertex> m_streamVertices;
 
         virtual void assemblePrimitives(const std::vector<vertex> &vts) = 0;
+        // create the primitives of an indexed draw, every 3 indices to vts make a triangle
+        // by default the triangles are expanded into a list of vertices, renderers can override this
+        // to refer to the vertices by index instead
+        virtual void assembleIndexedPrimitives(const std::vector<vertex> &vts, const std::vector<unsigned int> &indices) {
+            std::vector<vertex> triangleVts;
+            triangleVts.reserve(indices.size());
+            for (unsigned int index : indices)
+                triangleVts.push_back(vts[index]);
+            assemblePrimitives(triangleVts);
+        }
         // performs the perspective division
 
         // remove all geometry outside the visible volume (performed in clipping space)
         virtual void clipPrimitives() = 0;
         // test if the surface of the primitive is visible to the camera
-        // only used when rendering triangles.
+        // only used when rendering triangles. Performed in clipping space, before clipping,
+        // so that back faces are never clipped
         virtual void backfaceCulling(){};
 
         // (i.e. transforms from the clipping space to the normalized device coordinates)
@@ -66,24 +552,53 @@ namespace srl {
 
         // perform vertex operations in the vertex stream (i.e. the equivalent to a vertex shader)
         static void processVertices(const glm::mat4 &mvp, std::vector<vertex> &vInOut) {
-            for (auto &vtx : vInOut){
-                // this is the equivalent to a vertex shader
-                vtx.pos = mvp * vtx.pos;
+            processVertices(mvp, vInOut, 0, (int) vInOut.size());
+        }
+
+        // same, for the vertices [begin, end) of vInOut
+        static void processVertices(const glm::mat4 &mvp, std::vector<vertex> &vInOut, int begin, int end) {
+            FixedVertexShader shader;
+            shader.mvp = mvp;
+            FixedVaryings varyings;
+            for (int i = begin; i < end; i++){
+                // this is the equivalent to a vertex shader (the attributes pass through unchanged)
+                vInOut[i].pos = shader(vInOut[i], varyings);
             }
         }
 
+        // same, on the worker threads with m_parallelGeometry
+        void processVerticesInChunks(const glm::mat4 &mvp, std::vector<vertex> &vInOut) {
+            forEachChunk((int) vInOut.size(), [&](int, int begin, int end) {
+                processVertices(mvp, vInOut, begin, end);
+                return 0;
+            });
+        }
+
+        // same vertex shader, running on several vertices at once
+        static void processVertices(const glm::mat4 &mvp, VertexStream &vInOut) {
+            vInOut.transform(mvp);
+        }
+
+    protected:
         // perform fragment operations in the fragment stream (i.e. fragment shader)
         static void processFragments(std::vector<fragment>& fInOut) {
-            // fragment shader - not necessary for now since we are not modifying the color
             for (auto &frg : fInOut){
-                // example: uncomment this to make all fragments darker
-                // frg.col = frg.col * 0.5f;
+                processFragment(frg);
             }
         }
 
+        // the fragment shader, called once per fragment
+        // it doesn't change the depth, so renderers can run the depth test before it (early-z)
+        static void processFragment(fragment &frg) {
+            // fragment shader, the same one a ShaderPipeline with the fixed shaders runs
+            frg.col = FixedFragmentShader()(FixedVaryings{frg.norm, frg.col, frg.uv});
+        }
+
         // fragment operations and copy color to frame buffer
-        // blending test and z/depth-buffer can come here
-        static void writeToFrameBuffer(const std::vector<fragment> &frs, CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) {
+        // blending test and z/depth-buffer can come here. counters receives the fragments that are written or fail
+        // the depth test (a multisampled fragment is written if any of its samples is)
+        static void writeToFrameBuffer(const std::vector<fragment> &frs, CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db,
+                                       FragmentCounters &counters) {
 			int width = fb.W;
 			int height = fb.H;
             for (int i = 0, size = frs.size(); i < size; i++) {
@@ -93,13 +608,38 @@ namespace srl {
 				if (pos.x < 0 || pos.x >= width || pos.y < 0 || pos.y >= height)
 					continue;
 
-				// z/depth-test algorithm:
-				if (frs[i].depth < db.valueAt(pos.x, pos.y)) {
-                    // is the new fragment closer? Then update the color and the depth buffer
-					fb.paintAt(pos.x, pos.y, Colors::toRGBA32(frs[i].col));
-                    db.paintAt(pos.x, pos.y, frs[i].depth);
-				}
+				writeFragment(pos.x, pos.y, frs[i].depth, Colors::toRGBA32(frs[i].col), fb, db, counters);
+            }
+        }
+
+        // depth test a fragment with color (in the format of Colors::toRGBA32) at pixel (x, y), which must be inside
+        // the frame buffer, and write it if it passes
+        static void writeFragment(int x, int y, float depth, std::uint32_t color, CustomFrameBuffer <uint32_t> &fb,
+                                  CustomFrameBuffer <float> &db, FragmentCounters &counters) {
+            // multisampling: the fragment covers all the samples of the pixel, test and write each of them
+            if (db.S > 1) {
+                bool written = false;
+                for (unsigned int s = 0; s < db.S; s++) {
+                    if (depth < db.sampleAt(x, y, s)) {
+                        fb.paintSample(x, y, s, color);
+                        db.paintSample(x, y, s, depth);
+                        written = true;
+                    }
+                }
+                if (written)
+                    counters.written++;
+                else
+                    counters.depthRejected++;
+            }
+            // z/depth-test algorithm:
+            else if (depth < db.valueAt(x, y)) {
+                // is the new fragment closer? Then update the color and the depth buffer
+                fb.paintAt(x, y, color);
+                db.paintAt(x, y, depth);
+                counters.written++;
             }
+            else
+                counters.depthRejected++;
         }
     };
 }
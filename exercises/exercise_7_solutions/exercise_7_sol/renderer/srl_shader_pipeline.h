@@ -0,0 +1,339 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_SRL_SHADER_PIPELINE_H
+#define ITU_GRAPHICS_PROGRAMMING_SRL_SHADER_PIPELINE_H
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include "glm/glm.hpp"
+#include "srl_types.h"
+#include "srl_renderer.h"
+#include "srl_shaders.h"
+#include "srl_triangle_setup.h"
+#include "srl_multisample.h"
+#include "rasterizer/edgefunctionrasterizer.h"
+
+namespace srl {
+
+    // screen space derivatives of the varyings of a fragment, given to the fragment shaders that take them as a second
+    // parameter (e.g. to choose the mip map of a srl::Texture). They are the exact derivatives at the pixel, where a
+    // GPU takes the differences between the pixels of a 2x2 quad, and come from the plane equations of the triangle,
+    // only for the varyings the shader asks for: d.ddx(&Varyings::uv) computes the derivative of uv and nothing else
+    template<class Varyings>
+    class FragmentDerivatives {
+        static const int varyingCount = sizeof(Varyings) / sizeof(float);
+        typedef PlaneInterpolator<varyingCount + 2> Interpolator;
+
+    public:
+        FragmentDerivatives(const Interpolator &interp, const float *varyings) : m_interp(interp), m_varyings(varyings) {}
+
+        // derivative of a member of the varyings along x and along y
+        template<class T>
+        T ddx(T Varyings::*member) const { return derivative(member, 0); }
+        template<class T>
+        T ddy(T Varyings::*member) const { return derivative(member, 1); }
+
+        // derivatives of all the varyings
+        Varyings ddx() const { return derivatives(0); }
+        Varyings ddy() const { return derivatives(1); }
+
+    private:
+        template<class T>
+        T derivative(T Varyings::*member, int axis) const {
+            static_assert(sizeof(T) % sizeof(float) == 0, "the varyings must be floats");
+            // index of the first float of the member (only the address of the member is used)
+            Varyings varyings;
+            int first = int((reinterpret_cast<const char *>(&(varyings.*member)) -
+                             reinterpret_cast<const char *>(&varyings)) / sizeof(float));
+            float d[sizeof(T) / sizeof(float)];
+            for (int i = 0; i < int(sizeof(T) / sizeof(float)); i++)
+                d[i] = m_interp.derivatives(Interpolator::Planes::firstAttribute + first + i, m_varyings[first + i])[axis];
+            T result;
+            std::memcpy(&result, d, sizeof(T));
+            return result;
+        }
+
+        Varyings derivatives(int axis) const {
+            float d[varyingCount];
+            for (int i = 0; i < varyingCount; i++)
+                d[i] = m_interp.derivatives(Interpolator::Planes::firstAttribute + i, m_varyings[i])[axis];
+            Varyings result;
+            std::memcpy(&result, d, sizeof(Varyings));
+            return result;
+        }
+
+        const Interpolator &m_interp;
+        const float *m_varyings;
+    };
+
+    // triangle pipeline compiled for one vertex shader and one fragment shader.
+    // The shaders are functors called directly from the vertex loop and the raster loop, so the compiler can inline
+    // them, and only the values the shaders pass to each other (the varyings) are interpolated:
+    //  - Varyings: struct of floats (or glm vectors of floats) written by the vertex shader and read, interpolated,
+    //    by the fragment shader
+    //  - VertexShader: glm::vec4 operator()(const Vertex &in, Varyings &out), returns the clip space position.
+    //    Vertex can be any type, it is the element type of the vector given to render
+    //  - FragmentShader: Colors::color operator()(const Varyings &in), returns the color of the fragment. Shaders
+    //    that need the screen space derivatives of the varyings take them as a second parameter instead:
+    //    Colors::color operator()(const Varyings &in, const FragmentDerivatives<Varyings> &d)
+    // The shaders can keep their uniforms (matrices, lights, ...) as members, m_vertexShader and m_fragmentShader
+    // are public for that reason. Triangles go through the same stages as in the TriangleRenderer: backface culling
+    // and clipping in clip space, 28.4 fixed point edge function rasterization, early depth test and plane equation
+    // interpolation, one triangle at a time. Frame buffers with several samples per pixel are rendered with
+    // multisample anti-aliasing, as in the TriangleRenderer
+    template<class Varyings, class VertexShader, class FragmentShader>
+    class ShaderPipeline : public ClipVolume {
+        static_assert(std::is_trivially_copyable<Varyings>::value && sizeof(Varyings) % sizeof(float) == 0,
+                      "the varyings must be a struct of floats");
+
+    public:
+        VertexShader m_vertexShader;
+        FragmentShader m_fragmentShader;
+
+        ShaderPipeline() = default;
+
+        ShaderPipeline(const VertexShader &vertexShader, const FragmentShader &fragmentShader)
+                : m_vertexShader(vertexShader), m_fragmentShader(fragmentShader) {}
+
+        // render the triangle list vts (every 3 vertices make a triangle, counterclockwise triangles face the camera)
+        template<class Vertex>
+        void render(const std::vector<Vertex> &vts, CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) {
+            // vertex shader
+            m_shaded.resize(vts.size());
+            m_outcodes.resize(vts.size());
+            float bound = viewportBound(fb.W, fb.H, db.S);
+            for (int i = 0, size = vts.size(); i < size; i++) {
+                Varyings out;
+                m_shaded[i].pos = m_vertexShader(vts[i], out);
+                std::memcpy(m_shaded[i].varyings, &out, sizeof(Varyings));
+                m_outcodes[i] = outcode(m_shaded[i].pos, clipBound(0), bound);
+            }
+
+            for (int i = 0, size = vts.size(); i + 2 < size; i += 3)
+                drawTriangle(i, fb, db);
+        }
+
+    private:
+        static const int varyingCount = sizeof(Varyings) / sizeof(float);
+        // planes of the depth, 1/w and the varyings
+        typedef PlaneEquations<varyingCount + 2> Planes;
+
+        // number of fractional bits of the fixed point vertices given to the rasterizer
+        static const int subpixelBits = 4;
+
+        // output of the vertex shader
+        struct ShadedVertex {
+            glm::vec4 pos;
+            float varyings[varyingCount];
+        };
+
+        void drawTriangle(int first, CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) {
+            const ShadedVertex &v1 = m_shaded[first], &v2 = m_shaded[first + 1], &v3 = m_shaded[first + 2];
+            unsigned int c1 = m_outcodes[first], c2 = m_outcodes[first + 1], c3 = m_outcodes[first + 2];
+
+            // all the vertices are outside of the same plane
+            if (c1 & c2 & c3 & outsideVolume)
+                return;
+
+            // backface culling in clip space, before clipping (see TriangleRenderer::backfaceCulling)
+            glm::vec4 p1 = v1.pos, p2 = v2.pos, p3 = v3.pos;
+            float det = p1.x * (p2.y * p3.w - p3.y * p2.w)
+                      - p1.y * (p2.x * p3.w - p3.x * p2.w)
+                      + p1.w * (p2.x * p3.y - p3.x * p2.y);
+            if (det < 0)
+                return;
+
+            unsigned int clipCodes = (c1 | c2 | c3) & clippedPlanes;
+            if (!clipCodes) {
+                rasterTriangle(v1, v2, v3, fb, db);
+                return;
+            }
+
+            // clip the triangle as a polygon, against the near plane and the guard band
+            // (each plane adds at most one vertex)
+            ShadedVertex polygons[2][8];
+            ShadedVertex *polygon = polygons[0], *clipped = polygons[1];
+            polygon[0] = v1;
+            polygon[1] = v2;
+            polygon[2] = v3;
+            int count = 3;
+            for (int side : {5, 0, 1, 3, 4}) {
+                if (!(clipCodes & clipBit(side)))
+                    continue;
+                count = clipPolygon(polygon, count, clipped, side, clipBound(side));
+                std::swap(polygon, clipped);
+                if (count < 3)
+                    return;
+            }
+            for (int i = 2; i < count; i++)
+                rasterTriangle(polygon[0], polygon[i - 1], polygon[i], fb, db);
+        }
+
+        // clip the polygon in against the plane x,y = w * bound (side 0, 1) or x,y,z = -w * bound (side 3, 4, 5),
+        // write the result to out and return its number of vertices
+        static int clipPolygon(const ShadedVertex *in, int count, ShadedVertex *out, int side, float bound) {
+            int idx = side % 3;
+            float wMult = side > 2 ? -1.0f : 1.0f;
+            auto outside = [&](const glm::vec4 &p) { return p[idx] * wMult > bound * p.w; };
+
+            int outCount = 0;
+            for (int i = 0; i < count; i++) {
+                const ShadedVertex &a = in[i], &b = in[(i + 1) % count];
+                bool aOut = outside(a.pos), bOut = outside(b.pos);
+                // the intersection is always computed from the inside vertex, so that triangles sharing the edge
+                // get exactly the same vertex
+                if (aOut != bOut)
+                    out[outCount++] = aOut ? intersection(b, a, idx, wMult, bound) : intersection(a, b, idx, wMult, bound);
+                if (!bOut)
+                    out[outCount++] = b;
+            }
+            return outCount;
+        }
+
+        // the point where the edge from vertex in to vertex out crosses the clipping plane
+        static ShadedVertex intersection(const ShadedVertex &in, const ShadedVertex &out, int idx, float wMult, float bound) {
+            glm::vec4 inOutVec = out.pos - in.pos;
+            float t = (in.pos[idx] - bound * in.pos.w * wMult) / (bound * inOutVec.w * wMult - inOutVec[idx]);
+            ShadedVertex v;
+            v.pos = in.pos + inOutVec * t;
+            for (int i = 0; i < varyingCount; i++)
+                v.varyings[i] = in.varyings[i] + (out.varyings[i] - in.varyings[i]) * t;
+            return v;
+        }
+
+        // perspective division, window coordinates, triangle setup and rasterization of a triangle
+        void rasterTriangle(const ShadedVertex &v1, const ShadedVertex &v2, const ShadedVertex &v3,
+                            CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) {
+            glm::vec4 pos[3];
+            float values[3][Planes::valueCount];
+            const ShadedVertex *vts[3] = {&v1, &v2, &v3};
+            float halfW = fb.W / 2;
+            float halfH = fb.H / 2;
+            for (int k = 0; k < 3; k++) {
+                // the same operations as the divideByW and toScreenSpace stages of the renderers
+                float w = vts[k]->pos.w;
+                pos[k] = vts[k]->pos / w;
+                pos[k].x = halfW * pos[k].x + halfW;
+                pos[k].y = halfH * pos[k].y + halfH;
+                values[k][Planes::depth] = vts[k]->pos.z / w / w;
+                values[k][Planes::hypInterp] = 1.0f / w;
+                for (int i = 0; i < varyingCount; i++)
+                    values[k][Planes::firstAttribute + i] = vts[k]->varyings[i] / w;
+            }
+
+            Planes planes;
+            if (!planes.setup(pos[0], pos[1], pos[2], values[0], values[1], values[2]))
+                return;
+            PlaneInterpolator<Planes::valueCount> interp(planes);
+
+            glm::ivec2 iv[3];
+            for (int k = 0; k < 3; k++) {
+                const float one = float(1 << subpixelBits);
+                iv[k] = glm::ivec2(std::floor(pos[k].x * one + .5f), std::floor(pos[k].y * one + .5f));
+            }
+
+            if (db.S > 1) {
+                rasterMultisample(iv, interp, fb, db);
+                return;
+            }
+
+            const int bs = edge_function_rasterizer::block_size;
+            edge_function_rasterizer rasterizer(iv[0].x, iv[0].y, iv[1].x, iv[1].y, iv[2].x, iv[2].y,
+                                                0, 0, fb.W - 1, fb.H - 1, subpixelBits);
+            for (; rasterizer.more_blocks(); rasterizer.next_block()) {
+                std::uint64_t mask = rasterizer.block_mask();
+                for (int j = 0; j < bs; j++) {
+                    unsigned int row = (mask >> (j * bs)) & 0xFFu;
+                    for (int i = 0; row != 0; i++, row >>= 1) {
+                        if (!(row & 1u))
+                            continue;
+                        glm::ivec2 pxl(rasterizer.block_x() + i, rasterizer.block_y() + j);
+
+                        // early z/depth-test, occluded fragments are never interpolated or shaded
+                        float depth = interp.moveTo(pxl);
+                        if (!(depth < db.valueAt(pxl.x, pxl.y)))
+                            continue;
+
+                        Varyings in;
+                        float varyings[varyingCount];
+                        interp.attributes(varyings);
+                        std::memcpy(&in, varyings, sizeof(Varyings));
+
+                        FragmentDerivatives<Varyings> derivatives(interp, varyings);
+                        Colors::color color = shade(m_fragmentShader, in, derivatives, 0);
+                        fb.paintAt(pxl.x, pxl.y, Colors::toRGBA32(color));
+                        db.paintAt(pxl.x, pxl.y, depth);
+                    }
+                }
+            }
+        }
+
+        // multisampled rasterization, depth is tested and written per sample and the fragment is shaded once per pixel
+        // (see TriangleRenderer::streamTriangleMultisample)
+        void rasterMultisample(const glm::ivec2 iv[3], PlaneInterpolator<Planes::valueCount> &interp,
+                               CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) {
+            const unsigned int sampleCount = db.S, allSamples = (1u << sampleCount) - 1u;
+            glm::vec2 offsets[8];
+            for (unsigned int s = 0; s < sampleCount; s++)
+                offsets[s] = glm::vec2(samplePositions(sampleCount)[s]) / 16.0f;
+
+            m_multisampleRasterizer.rasterize(iv[0], iv[1], iv[2], subpixelBits, sampleCount, 0, 0, fb.W - 1, fb.H - 1,
+                                              [&](glm::ivec2 pxl, unsigned int mask) {
+                interp.moveTo(pxl);
+                float depths[8];
+                unsigned int passed = 0;
+                for (unsigned int s = 0; s < sampleCount; s++) {
+                    if (!(mask & (1u << s)))
+                        continue;
+                    depths[s] = interp.depthAt(offsets[s]);
+                    if (depths[s] < db.sampleAt(pxl.x, pxl.y, s))
+                        passed |= 1u << s;
+                }
+                if (!passed)
+                    return;
+
+                Varyings in;
+                float varyings[varyingCount];
+                interp.attributes(varyings);
+                std::memcpy(&in, varyings, sizeof(Varyings));
+                FragmentDerivatives<Varyings> derivatives(interp, varyings);
+                std::uint32_t color = Colors::toRGBA32(shade(m_fragmentShader, in, derivatives, 0));
+
+                if (passed == allSamples)
+                    fb.paintSamples(pxl.x, pxl.y, color);
+                for (unsigned int s = 0; s < sampleCount; s++) {
+                    if (!(passed & (1u << s)))
+                        continue;
+                    if (passed != allSamples)
+                        fb.paintSample(pxl.x, pxl.y, s, color);
+                    db.paintSample(pxl.x, pxl.y, s, depths[s]);
+                }
+            });
+        }
+
+        // call the fragment shader, with the derivatives of the varyings if it takes them
+        // (the int overload is preferred when both are valid)
+        template<class Shader>
+        static auto shade(const Shader &shader, const Varyings &in, const FragmentDerivatives<Varyings> &d, int)
+                -> decltype(shader(in, d)) {
+            return shader(in, d);
+        }
+
+        template<class Shader>
+        static Colors::color shade(const Shader &shader, const Varyings &in, const FragmentDerivatives<Varyings> &, long) {
+            return shader(in);
+        }
+
+        // shaded vertices and their outcodes, part of the class so that we avoid reallocating memory every frame
+        std::vector<ShadedVertex> m_shaded;
+        std::vector<unsigned int> m_outcodes;
+        MultisampleRasterizer m_multisampleRasterizer;
+    };
+
+    // pipeline running the shaders of the srl::Renderer classes, renders the same images as the TriangleRenderer
+    typedef ShaderPipeline<FixedVaryings, FixedVertexShader, FixedFragmentShader> FixedShaderPipeline;
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SRL_SHADER_PIPELINE_H
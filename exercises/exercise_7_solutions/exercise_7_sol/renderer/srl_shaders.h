@@ -0,0 +1,40 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_SRL_SHADERS_H
+#define ITU_GRAPHICS_PROGRAMMING_SRL_SHADERS_H
+
+#include "glm/glm.hpp"
+#include "srl_types.h"
+
+namespace srl {
+
+    // the shaders of the fixed pipeline of the srl::Renderer classes, written as the functors of a ShaderPipeline.
+    // The renderers call them for their vertex and fragment stages, so both pipelines shade in the same way
+
+    // varyings of the fixed pipeline: the attributes of srl::vertex
+    struct FixedVaryings {
+        glm::vec4 norm;
+        Colors::color col;
+        glm::vec2 uv;
+    };
+
+    // transforms the position by the model view projection matrix, and passes the attributes through
+    struct FixedVertexShader {
+        glm::mat4 mvp = glm::mat4(1.0f);
+
+        glm::vec4 operator()(const vertex &in, FixedVaryings &out) const {
+            out.norm = in.norm;
+            out.col = in.col;
+            out.uv = in.uv;
+            return mvp * in.pos;
+        }
+    };
+
+    // the color of the fragment is the interpolated vertex color
+    struct FixedFragmentShader {
+        Colors::color operator()(const FixedVaryings &in) const {
+            // example: return in.col * 0.5f to make all fragments darker
+            return in.col;
+        }
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SRL_SHADERS_H
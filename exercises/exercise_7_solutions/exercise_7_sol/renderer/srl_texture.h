@@ -0,0 +1,421 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_SRL_TEXTURE_H
+#define ITU_GRAPHICS_PROGRAMMING_SRL_TEXTURE_H
+
+#include <vector>
+#include <memory>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include "glm/glm.hpp"
+#include "srl_types.h"
+#include "srl_block_compression.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SRL_TEXTURE_SSE
+#include <emmintrin.h>
+#endif
+
+namespace srl {
+
+    // 8 bits RGBA texture (texels in the format of Colors::toRGBA32) with its chain of mip maps, for fragment shaders.
+    // Each level is stored in blocks of 4x4 texels, one 64 bytes cache line per block, so the 4 texels of a bilinear
+    // lookup are almost always in the same cache line, and the texels of neighbour fragments are close in memory
+    // whatever the orientation of the triangle on the screen (a row major image is only cache friendly along x).
+    // The level of detail is chosen from the screen space derivatives of the texture coordinates, which the
+    // ShaderPipeline gives to the fragment shaders that take them (see FragmentDerivatives).
+    // The levels can also be stored block compressed (BC1 or BC3, see BlockCompression), 4 or 8 times smaller. The
+    // blocks are decoded when they are sampled into a small cache of decoded blocks, one per thread, so a block is
+    // usually decoded once for all the fragments that sample it
+    class Texture {
+    public:
+        enum class Filter {
+            nearest,    // nearest texel of the nearest mip map
+            bilinear,   // bilinear filtering of the nearest mip map
+            trilinear   // bilinear filtering of the two nearest mip maps, blended by the level of detail
+        };
+        enum class Wrap { repeat, clamp };
+        enum class Format {
+            rgba8,  // 4 bytes per texel
+            bc1,    // 8 bytes per block of 4x4 texels, opaque or fully transparent texels
+            bc3     // 16 bytes per block of 4x4 texels, 8 bits alpha
+        };
+
+        Filter m_filter = Filter::trilinear;
+        Wrap m_wrap = Wrap::repeat;
+
+        Texture() = default;
+
+        // texture with the width x height texels, stored in rows starting from v = 0
+        Texture(int width, int height, const std::uint32_t *texels, Format format = Format::rgba8) {
+            setImage(width, height, texels, format);
+        }
+
+        // texture with the width x height texels given as 4 bytes R, G, B, A per texel, e.g. the image returned by
+        // stbi_load(path, &width, &height, &channels, 4)
+        Texture(int width, int height, const unsigned char *rgba, Format format = Format::rgba8) {
+            setImage(width, height, rgba, format);
+        }
+
+        // replace the image of the texture and compute its mip maps, down to a single texel. The mip maps are
+        // computed from the uncompressed image, then each level is encoded to the format
+        void setImage(int width, int height, const std::uint32_t *texels, Format format = Format::rgba8) {
+            static std::atomic<std::uint32_t> lastId(0);
+            m_id = ++lastId;
+            m_format = format;
+
+            m_levels.clear();
+            const int words = blockWords(format);
+            int size = 0;
+            for (int w = width, h = height; ; w = std::max(w / 2, 1), h = std::max(h / 2, 1)) {
+                Level level;
+                level.width = w;
+                level.height = h;
+                level.blocksX = (w + blockSize - 1) / blockSize;
+                level.offset = size;
+                size += level.blocksX * ((h + blockSize - 1) / blockSize) * words;
+                m_levels.push_back(level);
+                if (w == 1 && h == 1)
+                    break;
+            }
+
+            // 16 words padding to align the first block to 64 bytes
+            m_size = size;
+            m_memory.reset(new std::uint32_t[size + 16]());
+            m_data = m_memory.get() + (16 - (std::uintptr_t(m_memory.get()) / sizeof(std::uint32_t)) % 16) % 16;
+
+            std::vector<std::uint32_t> image(texels, texels + width * height), mipMap;
+            for (int l = 0, count = m_levels.size(); l < count; l++) {
+                storeLevel(m_levels[l], image);
+                if (l + 1 == count)
+                    break;
+
+                // each texel of a mip map is the average of the (up to) 2x2 texels it covers in the level above
+                const Level &src = m_levels[l], &dst = m_levels[l + 1];
+                mipMap.resize(dst.width * dst.height);
+                for (int y = 0; y < dst.height; y++) {
+                    for (int x = 0; x < dst.width; x++) {
+                        int x0 = std::min(2 * x, src.width - 1), x1 = std::min(2 * x + 1, src.width - 1);
+                        int y0 = std::min(2 * y, src.height - 1), y1 = std::min(2 * y + 1, src.height - 1);
+                        const std::uint32_t quad[4] = {image[x0 + y0 * src.width], image[x1 + y0 * src.width],
+                                                       image[x0 + y1 * src.width], image[x1 + y1 * src.width]};
+                        mipMap[x + y * dst.width] = average(quad);
+                    }
+                }
+                image.swap(mipMap);
+            }
+        }
+
+        void setImage(int width, int height, const unsigned char *rgba, Format format = Format::rgba8) {
+            std::vector<std::uint32_t> texels(width * height);
+            for (int i = 0, size = width * height; i < size; i++) {
+                const unsigned char *c = rgba + 4 * i;
+                texels[i] = c[0] | (c[1] << 8) | (c[2] << 16) | (std::uint32_t(c[3]) << 24);
+            }
+            setImage(width, height, texels.data(), format);
+        }
+
+        int width(int level = 0) const { return m_levels[level].width; }
+        int height(int level = 0) const { return m_levels[level].height; }
+        int levelCount() const { return m_levels.size(); }
+        Format format() const { return m_format; }
+
+        // memory used by the texels of all the levels
+        std::size_t sizeInBytes() const { return m_size * sizeof(std::uint32_t); }
+
+        // texel (x, y) of a level, without filtering or wrapping
+        std::uint32_t texelAt(int x, int y, int level = 0) const {
+            assert(x >= 0 && x < width(level) && y >= 0 && y < height(level));
+            return fetch(m_levels[level], x, y);
+        }
+
+        // level of detail of a fragment, from the derivatives of its texture coordinates along x and y on the screen:
+        // log2 of the number of texels of level 0 covered by a step of one pixel
+        float levelOfDetail(glm::vec2 ddx, glm::vec2 ddy) const {
+            glm::vec2 size(m_levels[0].width, m_levels[0].height);
+            glm::vec2 tx = ddx * size, ty = ddy * size;
+            float rho2 = std::max(glm::dot(tx, tx), glm::dot(ty, ty));
+            // log2(sqrt(rho2)), the texture is magnified when rho2 <= 1
+            return rho2 > 1.0f ? 0.5f * log2Fast(rho2) : 0.0f;
+        }
+
+        // filtered color at the texture coordinates uv, with the level of detail given by the screen space
+        // derivatives of uv
+        Colors::color sample(glm::vec2 uv, glm::vec2 ddx, glm::vec2 ddy) const {
+            return sampleLevel(uv, levelOfDetail(ddx, ddy));
+        }
+
+        // filtered color at the texture coordinates uv, at a level of detail lod (level 0 if lod <= 0)
+        Colors::color sampleLevel(glm::vec2 uv, float lod) const {
+            float maxLod = float(m_levels.size() - 1);
+            lod = std::min(std::max(lod, 0.0f), maxLod);
+            if (m_filter != Filter::trilinear) {
+                const Level &level = m_levels[int(lod + .5f)];
+                if (m_filter == Filter::nearest)
+                    return toColor(scale(unpack(nearest(level, uv)), 1.0f / 255.0f));
+                return toColor(bilinear(level, uv, 1.0f / 255.0f));
+            }
+
+            int l = int(lod);
+            float t = lod - float(l);
+            Color4 color = bilinear(m_levels[l], uv, (1.0f - t) / 255.0f);
+            if (t > 0.0f)
+                color = add(color, bilinear(m_levels[l + 1], uv, t / 255.0f));
+            return toColor(color);
+        }
+
+    private:
+        static const int blockSize = 4; // texelIndex depends on it
+
+        struct Level {
+            int width, height;
+            // blocks in a row of blocks, and first word of the level in m_data
+            int blocksX, offset;
+        };
+
+        // 32 bits words per block of 4x4 texels
+        static int blockWords(Format format) {
+            return format == Format::bc1 ? BlockCompression::bc1Words
+                 : format == Format::bc3 ? BlockCompression::bc3Words : blockSize * blockSize;
+        }
+
+        // the texels of a block are stored in rows, and the blocks in rows of blocks (x, y >= 0)
+        static int texelIndex(const Level &level, int x, int y) {
+            int block = (y >> 2) * level.blocksX + (x >> 2);
+            return level.offset + block * blockSize * blockSize + (y & 3) * blockSize + (x & 3);
+        }
+
+        // store (and encode) the texels of a level, given in rows. The blocks on the right and top borders of
+        // levels that are not a multiple of 4 texels repeat the last column and row
+        void storeLevel(const Level &level, const std::vector<std::uint32_t> &texels) {
+            const int words = blockWords(m_format);
+            for (int by = 0, blocksY = (level.height + blockSize - 1) / blockSize; by < blocksY; by++) {
+                for (int bx = 0; bx < level.blocksX; bx++) {
+                    std::uint32_t block[16];
+                    for (int i = 0; i < 16; i++) {
+                        int x = std::min(bx * blockSize + (i & 3), level.width - 1);
+                        int y = std::min(by * blockSize + (i >> 2), level.height - 1);
+                        block[i] = texels[x + y * level.width];
+                    }
+                    std::uint32_t *out = m_data + level.offset + (by * level.blocksX + bx) * words;
+                    if (m_format == Format::bc1)
+                        BlockCompression::encodeBC1(block, out);
+                    else if (m_format == Format::bc3)
+                        BlockCompression::encodeBC3(block, out);
+                    else
+                        std::memcpy(out, block, sizeof(block));
+                }
+            }
+        }
+
+        // decoded blocks of the compressed textures, one cache per thread so that the threads of a renderer don't
+        // have to share (or lock) it. It has no constructor, so it is zero initialized (key 0 is never used) without
+        // a guard on every access. Entry (bx % 64, by % 8) holds block (bx, by), a window that is wider than tall
+        // since the fragments come in rows. The key of a block is the id of its texture and its offset, and the
+        // texels of a block are read before the next lookup, which could evict it
+        struct BlockCache {
+            static const int entryCount = 512;
+            std::uint64_t keys[entryCount];
+            std::uint32_t texels[entryCount][16];
+        };
+
+        // the 16 texels of block (bx, by) of a compressed level, decoded if the block is not in the cache
+        const std::uint32_t *decodedBlock(const Level &level, int bx, int by) const {
+            static thread_local BlockCache cache;
+            std::uint32_t offset = std::uint32_t(level.offset + (by * level.blocksX + bx) * blockWords(m_format));
+            std::uint64_t key = (std::uint64_t(m_id) << 32) | offset;
+            // the levels are moved by a few blocks, so that the two levels of a trilinear lookup mostly don't collide
+            int entry = ((by + level.offset) & 7) * 64 + ((bx + 3 * level.offset) & 63);
+            if (cache.keys[entry] != key) {
+                if (m_format == Format::bc1)
+                    BlockCompression::decodeBC1(m_data + offset, cache.texels[entry]);
+                else
+                    BlockCompression::decodeBC3(m_data + offset, cache.texels[entry]);
+                cache.keys[entry] = key;
+            }
+            return cache.texels[entry];
+        }
+
+        std::uint32_t fetch(const Level &level, int x, int y) const {
+            if (m_format == Format::rgba8)
+                return m_data[texelIndex(level, x, y)];
+            return decodedBlock(level, x >> 2, y >> 2)[(y & 3) * blockSize + (x & 3)];
+        }
+
+
+        // log2 of x > 0 with an error below 0.01 (plenty for a level of detail): the exponent of the float plus a
+        // parabola through the log2 of its mantissa m in [1, 2) at 1 and 2, so it is exact for powers of 2
+        static float log2Fast(float x) {
+            std::uint32_t bits;
+            std::memcpy(&bits, &x, sizeof(float));
+            float exponent = float(int(bits >> 23) - 127);
+            bits = (bits & 0x007FFFFFu) | 0x3F800000u;
+            float m;
+            std::memcpy(&m, &bits, sizeof(float));
+            return exponent + (-1.0f / 3.0f * m + 2.0f) * m - 5.0f / 3.0f;
+        }
+
+        // floor of x, for |x| < 2^31 (std::floor is a function call without SSE 4.1)
+        static float floorFast(float x) {
+            float f = float(int(x));
+            return f - float(f > x);
+        }
+
+        // the 4 channels of a color in a SIMD register, filtering is done on the 4 channels at once
+#if defined(SRL_TEXTURE_SSE)
+        typedef __m128 Color4;
+        static Color4 unpack(std::uint32_t texel) {
+            __m128i zero = _mm_setzero_si128();
+            __m128i c = _mm_cvtsi32_si128(int(texel));
+            c = _mm_unpacklo_epi16(_mm_unpacklo_epi8(c, zero), zero);
+            return _mm_cvtepi32_ps(c);
+        }
+        static Color4 scale(Color4 c, float s) { return _mm_mul_ps(c, _mm_set1_ps(s)); }
+        static Color4 add(Color4 a, Color4 b) { return _mm_add_ps(a, b); }
+        static Colors::color toColor(Color4 c) {
+            Colors::color color;
+            _mm_storeu_ps(&color[0], c);
+            return color;
+        }
+#else
+        typedef glm::vec4 Color4;
+        static Color4 unpack(std::uint32_t texel) {
+            return Color4(texel & 0xFFu, (texel >> 8) & 0xFFu, (texel >> 16) & 0xFFu, texel >> 24);
+        }
+        static Color4 scale(Color4 c, float s) { return c * s; }
+        static Color4 add(Color4 a, Color4 b) { return a + b; }
+        static Colors::color toColor(Color4 c) { return c; }
+#endif
+
+        // texel coordinate of the texture coordinate u in [0, size) texels, with the wrap mode
+        float wrap(float u, int size) const {
+            u = m_wrap == Wrap::repeat ? u - floorFast(u) : std::min(std::max(u, 0.0f), 1.0f);
+            return u * float(size);
+        }
+
+        // index of the texel x in [-1, size], which is outside of the level at the borders (see footprint)
+        int wrapTexel(int x, int size) const {
+            if (x < 0)
+                return m_wrap == Wrap::repeat ? size - 1 : 0;
+            if (x >= size)
+                return m_wrap == Wrap::repeat ? 0 : size - 1;
+            return x;
+        }
+
+        std::uint32_t nearest(const Level &level, glm::vec2 uv) const {
+            int x = std::min(int(wrap(uv.x, level.width)), level.width - 1);
+            int y = std::min(int(wrap(uv.y, level.height)), level.height - 1);
+            return fetch(level, x, y);
+        }
+
+        // texels of a bilinear lookup, the columns x0, x1 and the rows y0, y1 (wrapped), and the weights of x1 and y1
+        struct Footprint {
+            int x0, x1, y0, y1;
+            float tx, ty;
+        };
+
+#if defined(SRL_TEXTURE_SSE)
+        // x and y are computed at once, in the first two lanes of the registers
+        Footprint footprint(const Level &level, glm::vec2 uv) const {
+            __m128 c = _mm_set_ps(0.0f, 0.0f, uv.y, uv.x);
+            c = m_wrap == Wrap::repeat ? _mm_sub_ps(c, floor4(c))
+                                       : _mm_min_ps(_mm_max_ps(c, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+            // texel centers are at half integer coordinates
+            __m128i size = _mm_set_epi32(1, 1, level.height, level.width);
+            c = _mm_sub_ps(_mm_mul_ps(c, _mm_cvtepi32_ps(size)), _mm_set1_ps(.5f));
+            __m128 f = floor4(c), t = _mm_sub_ps(c, f);
+            // i0 is in [-1, size - 1] and i1 in [0, size]
+            __m128i i0 = _mm_cvttps_epi32(f), i1 = _mm_add_epi32(i0, _mm_set1_epi32(1));
+            __m128i below = _mm_cmplt_epi32(i0, _mm_setzero_si128()), inside = _mm_cmplt_epi32(i1, size);
+            if (m_wrap == Wrap::repeat) {
+                i0 = _mm_add_epi32(i0, _mm_and_si128(below, size)); // -1 becomes size - 1
+                i1 = _mm_and_si128(i1, inside);                     // size becomes 0
+            }
+            else {
+                i0 = _mm_andnot_si128(below, i0);                                   // -1 becomes 0
+                i1 = _mm_add_epi32(i1, _mm_andnot_si128(inside, _mm_set1_epi32(-1))); // size becomes size - 1
+            }
+            Footprint fp;
+            fp.x0 = _mm_cvtsi128_si32(i0);
+            fp.y0 = _mm_cvtsi128_si32(_mm_shuffle_epi32(i0, 1));
+            fp.x1 = _mm_cvtsi128_si32(i1);
+            fp.y1 = _mm_cvtsi128_si32(_mm_shuffle_epi32(i1, 1));
+            fp.tx = _mm_cvtss_f32(t);
+            fp.ty = _mm_cvtss_f32(_mm_shuffle_ps(t, t, 1));
+            return fp;
+        }
+
+        // floor of the 4 floats, for |x| < 2^31
+        static __m128 floor4(__m128 x) {
+            __m128 f = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+            return _mm_sub_ps(f, _mm_and_ps(_mm_cmpgt_ps(f, x), _mm_set1_ps(1.0f)));
+        }
+#else
+        Footprint footprint(const Level &level, glm::vec2 uv) const {
+            // texel centers are at half integer coordinates
+            float u = wrap(uv.x, level.width) - .5f, v = wrap(uv.y, level.height) - .5f;
+            float fx = floorFast(u), fy = floorFast(v);
+            Footprint fp;
+            fp.x0 = wrapTexel(int(fx), level.width);
+            fp.y0 = wrapTexel(int(fy), level.height);
+            fp.x1 = wrapTexel(int(fx) + 1, level.width);
+            fp.y1 = wrapTexel(int(fy) + 1, level.height);
+            fp.tx = u - fx;
+            fp.ty = v - fy;
+            return fp;
+        }
+#endif
+
+        // the 2x2 texels of a bilinear lookup, with a single cache lookup when they are in the same block
+        void fetchQuad(const Level &level, const Footprint &fp, std::uint32_t texels[4]) const {
+            if (m_format != Format::rgba8 && (fp.x0 >> 2) == (fp.x1 >> 2) && (fp.y0 >> 2) == (fp.y1 >> 2)) {
+                const std::uint32_t *block = decodedBlock(level, fp.x0 >> 2, fp.y0 >> 2);
+                texels[0] = block[(fp.y0 & 3) * blockSize + (fp.x0 & 3)];
+                texels[1] = block[(fp.y0 & 3) * blockSize + (fp.x1 & 3)];
+                texels[2] = block[(fp.y1 & 3) * blockSize + (fp.x0 & 3)];
+                texels[3] = block[(fp.y1 & 3) * blockSize + (fp.x1 & 3)];
+                return;
+            }
+            texels[0] = fetch(level, fp.x0, fp.y0);
+            texels[1] = fetch(level, fp.x1, fp.y0);
+            texels[2] = fetch(level, fp.x0, fp.y1);
+            texels[3] = fetch(level, fp.x1, fp.y1);
+        }
+
+        // bilinear filtering of the 4 texels around uv, the result is multiplied by weight
+        Color4 bilinear(const Level &level, glm::vec2 uv, float weight) const {
+            Footprint fp = footprint(level, uv);
+            std::uint32_t texels[4];
+            fetchQuad(level, fp, texels);
+            Color4 c00 = unpack(texels[0]), c10 = unpack(texels[1]), c01 = unpack(texels[2]), c11 = unpack(texels[3]);
+            float w1 = weight * fp.ty, w0 = weight - w1;
+            return add(add(scale(c00, w0 * (1.0f - fp.tx)), scale(c10, w0 * fp.tx)),
+                       add(scale(c01, w1 * (1.0f - fp.tx)), scale(c11, w1 * fp.tx)));
+        }
+
+        // average of 4 colors, each channel separately
+        static std::uint32_t average(const std::uint32_t texels[4]) {
+            std::uint32_t result = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                std::uint32_t sum = 2;
+                for (int k = 0; k < 4; k++)
+                    sum += (texels[k] >> shift) & 0xFFu;
+                result |= (sum / 4) << shift;
+            }
+            return result;
+        }
+
+        Format m_format = Format::rgba8;
+        // unique id of the image, for the block cache
+        std::uint32_t m_id = 0;
+        std::vector<Level> m_levels;
+        std::unique_ptr<std::uint32_t[]> m_memory;
+        std::uint32_t *m_data = nullptr;
+        // words used by the levels
+        int m_size = 0;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SRL_TEXTURE_H
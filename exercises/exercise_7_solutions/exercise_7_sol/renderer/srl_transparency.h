@@ -0,0 +1,165 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_SRL_TRANSPARENCY_H
+#define ITU_GRAPHICS_PROGRAMMING_SRL_TRANSPARENCY_H
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include "srl_types.h"
+
+namespace srl {
+
+    // order-independent transparency: the translucent fragments of a frame are kept, in any order, in a linked list
+    // per pixel, and resolve sorts the list of each pixel by depth and blends it over the opaque color.
+    // The nodes of all the lists come from a single arena, a vector that is allocated once and reused every frame.
+    // Each thread takes chunks of consecutive nodes from it with an atomic increment of the arena size, and the
+    // arena is emptied by setting its size to 0, so there is no allocation per fragment and emptying it doesn't
+    // depend on the number of fragments. A fragment that doesn't fit in the arena is dropped, and the arena grows to
+    // fit all the fragments of the frame at the next resolve. The list heads of the pixels are cleared by resolve
+    // as it visits them
+    class TransparencyBuffer {
+    public:
+        // layers blended per pixel, only the nearest ones are kept (the ones behind are mostly hidden anyway)
+        static const int maxLayers = 32;
+        // nodes taken from the arena at once
+        static const std::uint32_t chunkSize = 64;
+
+        // the nodes of the arena a thread is filling, each thread adding fragments needs its own
+        struct Chunk {
+            std::uint32_t next = 0, end = 0;
+            // chunks taken before the arena was last emptied are stale
+            unsigned int generation = 0;
+        };
+
+        // match the size of the frame buffer, the fragments of a frame with another size are dropped
+        void setSize(unsigned int width, unsigned int height) {
+            if (m_width == width && m_height == height)
+                return;
+            m_width = width;
+            m_height = height;
+            m_heads.assign(width * height, std::uint32_t(endOfList));
+            // start with one node per pixel
+            if (m_nodes.size() < m_heads.size())
+                m_nodes.resize(m_heads.size());
+            clear();
+        }
+
+        // add a fragment with color (in the format of Colors::toRGBA32) and depth at pixel (x, y), in a node of
+        // chunk. Different threads can add fragments at the same time, with their own chunks, as long as they don't
+        // add to the same pixels
+        void add(Chunk &chunk, unsigned int x, unsigned int y, float depth, std::uint32_t color) {
+            assert(x < m_width && y < m_height);
+            if (chunk.next == chunk.end || chunk.generation != m_generation) {
+                std::uint32_t size = std::uint32_t(m_nodes.size());
+                // once the arena is full, stop counting the nodes taken so that the count can't overflow
+                std::uint32_t first = m_count.load(std::memory_order_relaxed) < size ?
+                                      m_count.fetch_add(chunkSize, std::memory_order_relaxed) : size;
+                chunk.next = std::min(first, size);
+                chunk.end = std::min(first + chunkSize, size);
+                chunk.generation = m_generation;
+                if (chunk.next == chunk.end) {
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+            std::uint32_t index = chunk.next++;
+            std::uint32_t &head = m_heads[x + y * m_width];
+            m_nodes[index] = Node{depth, color, head};
+            head = index;
+        }
+
+        // whether fragments were added since the last resolve
+        bool empty() const { return m_count.load(std::memory_order_relaxed) == 0; }
+
+        // fragments of the last resolved frame that were dropped because they didn't fit in the arena
+        std::uint32_t droppedCount() const { return m_lastDropped; }
+
+        // blend the fragments of row y that are in front of the opaque depth db over the color buffer fb, from back
+        // to front, and clear the lists of the row. Rows can be resolved in parallel, finish with endResolve
+        void resolveRow(int y, CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) {
+            std::uint32_t *heads = m_heads.data() + y * m_width;
+            Layers layers;
+            for (unsigned int x = 0; x < m_width; x++) {
+                if (heads[x] == endOfList)
+                    continue;
+                layers.count = 0;
+                layers.opaqueDepth = db.valueAt(x, y);
+                for (std::uint32_t i = heads[x]; i != endOfList; i = m_nodes[i].next)
+                    layers.add(m_nodes[i]);
+                heads[x] = endOfList;
+
+                std::uint32_t color = fb.valueAt(x, y);
+                for (int k = layers.count - 1; k >= 0; k--)
+                    color = Colors::blend(layers.colors[k], color);
+                fb.paintAt(x, y, color);
+            }
+        }
+
+        // empty the arena after all the rows are resolved, and grow it if the fragments of the frame didn't fit
+        void endResolve() {
+            m_lastDropped = m_dropped.load(std::memory_order_relaxed);
+            std::size_t needed = m_nodes.size() + m_lastDropped;
+            std::size_t size = m_nodes.size();
+            while (size < needed)
+                size *= 2;
+            m_nodes.resize(size);
+            clear();
+        }
+
+    private:
+        static const std::uint32_t endOfList = 0xFFFFFFFFu;
+
+        struct Node {
+            float depth;
+            std::uint32_t color;
+            // index of the next node of the list, or endOfList
+            std::uint32_t next;
+        };
+
+        // the nearest layers of a pixel, sorted from front to back
+        struct Layers {
+            float opaqueDepth;
+            int count;
+            float depths[maxLayers];
+            std::uint32_t colors[maxLayers];
+
+            // the lists go from the last fragment added to the first, and a fragment goes behind the ones with the
+            // same depth, so that ties blend in the order the fragments were drawn
+            void add(const Node &node) {
+                // opaque fragments drawn after this one can hide it
+                if (!(node.depth < opaqueDepth))
+                    return;
+                int k = count < maxLayers ? count++ : maxLayers;
+                for (; k > 0 && depths[k - 1] > node.depth; k--) {
+                    if (k < maxLayers) {
+                        depths[k] = depths[k - 1];
+                        colors[k] = colors[k - 1];
+                    }
+                }
+                if (k < maxLayers) {
+                    depths[k] = node.depth;
+                    colors[k] = node.color;
+                }
+            }
+        };
+
+        void clear() {
+            m_count = 0;
+            m_dropped = 0;
+            m_generation++;
+        }
+
+        unsigned int m_width = 0, m_height = 0;
+        // index of the last node added to the list of each pixel
+        std::vector<std::uint32_t> m_heads;
+        // the arena, the number of nodes taken from it (which can be more than its size), the fragments that didn't
+        // fit, and the number of times it was emptied
+        std::vector<Node> m_nodes;
+        std::atomic<std::uint32_t> m_count{0};
+        std::atomic<std::uint32_t> m_dropped{0};
+        unsigned int m_generation = 0;
+        std::uint32_t m_lastDropped = 0;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SRL_TRANSPARENCY_H
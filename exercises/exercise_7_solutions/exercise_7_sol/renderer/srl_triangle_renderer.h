@@ -9,9 +9,15 @@
 #include <glm/gtx/transform.hpp>
 #include "srl_renderer.h"
 #include "rasterizer/trianglerasterizer.h"
+#include "rasterizer/edgefunctionrasterizer.h"
 #include <glm/gtc/matrix_access.hpp>
 #include <iostream>
+#include <cmath>
 #include "srl_types.h"
+#include "srl_hierarchical_z.h"
+#include "srl_triangle_setup.h"
+#include "srl_multisample.h"
+#include "srl_transparency.h"
 
 namespace srl {
 
@@ -19,24 +25,270 @@ namespace srl {
     public:
         bool m_clipToFrustum = true;
 
+        // sort-middle rasterization: triangles are binned into screen tiles,
+        // and each tile is rasterized, depth tested and written by a worker thread
+        bool m_tiledRasterization = false;
+        // width and height of the tiles, in pixels
+        int m_tileSize = 64;
+
+        // rasterize with edge functions, testing blocks of pixels at once, instead of walking the scanlines
+        // (both rasterizers generate the same pixels)
+        bool m_edgeFunctionRasterizer = false;
+
+        // rasterize the triangles with their vertices in 28.4 fixed point, instead of rounding them to the closest
+        // pixel, so that the pixels follow the sub-pixel position of the edges. Pixels on shared edges still belong
+        // to one triangle only. Always uses the edge function rasterizer (the scanline rasterizer needs integers)
+        bool m_subpixelRasterization = true;
+
+        // number of fractional bits of the fixed point vertices used by m_subpixelRasterization
+        static const int subpixelBits = 4;
+
+        // rasterize the triangles whose pixels fit in a 2x2 or 4x4 square (most of the triangles of dense meshes)
+        // by testing those pixels directly against the edge functions, without setting up a rasterizer. The pixels
+        // are the same as with the rasterizers
+        bool m_smallTriangles = true;
+
+        // stream each fragment through the depth test, the fragment shader and the frame buffer as soon as it is
+        // rasterized, instead of storing all the fragments of the frame first. The attributes of a fragment are
+        // only interpolated and shaded if it passes the depth test (early-z)
+        bool m_streamFragments = false;
+
+        // skip triangles, and blocks of pixels of the edge function rasterizer, that are hidden behind the depth
+        // buffer before rasterizing them. Uses a min/max depth pyramid that is updated as depth is written,
+        // so it always uses the streaming path
+        bool m_hierarchicalZ = false;
+
+        // interpolate the depth and the attributes with the plane equations computed by the triangle setup, stepping
+        // them from pixel to pixel, instead of computing the barycentric coordinates of every fragment
+        bool m_planeInterpolation = true;
+
+        // multisample anti-aliasing is enabled by giving the renderer frame buffers with more than one sample per
+        // pixel (CustomFrameBuffer::setSampleCount). Triangles are then rasterized in fixed point with a coverage
+        // mask per pixel, depth tested and written per sample, and shaded once per pixel (always streaming, with
+        // plane equation interpolation, and without the hierarchical z-buffer). Call resolve on the color buffer
+        // to get the anti-aliased image
+
+        // visibility buffer rendering: the draws only rasterize and depth test the triangles, and write the id of
+        // the nearest triangle of each pixel (the draw, or instance, and the index of the triangle in m_primitives)
+        // instead of shading it. resolveVisibility then shades each visible pixel exactly once, with the attributes
+        // of its triangle, so the cost of shading depends on the resolution only, not on the overdraw or the number
+        // of triangles. The triangles of the draws are kept until then. Always uses the streaming path, and is
+        // ignored with multisampling
+        bool m_visibilityBuffer = false;
+
+        // order-independent transparency: fragments with an alpha below 1 (after the fragment shader) are not
+        // written to the frame buffer but kept in a list per pixel (see TransparencyBuffer), and resolveTransparency
+        // blends them in depth order over the opaque pixels, whatever the order the translucent triangles were drawn.
+        // Translucent fragments are depth tested against the opaque ones but don't write depth. Always uses the
+        // streaming path, is ignored with multisampling, and the visibility buffer is not used while it is on
+        bool m_orderIndependentTransparency = false;
+
+        // shade the pixels of the draws since the last call, must be called after the draws of a frame when
+        // m_visibilityBuffer is on, before the color buffer is used (does nothing if there is nothing to shade)
+        // runs on the worker threads with m_tiledRasterization
+        // (its time is added to the processFragments time of the statistics of the last draw)
+        void resolveVisibility(CustomFrameBuffer <uint32_t> &fb) {
+            if (m_instanceCount == 0)
+                return;
+            StageTimer timer(m_stats.processFragmentsNs);
+            assert(fb.W == (unsigned int) m_visibilityWidth && fb.H == (unsigned int) m_visibilityHeight);
+            if (m_tiledRasterization)
+                workerPool().parallelFor(m_visibilityHeight, [&](int y, int) { resolveVisibilityRow(y, fb); });
+            else
+                for (int y = 0; y < m_visibilityHeight; y++)
+                    resolveVisibilityRow(y, fb);
+            m_instanceCount = 0;
+        }
+
+        // blend the translucent fragments of the draws since the last call over fb, must be called after the draws
+        // of a frame (and after resolveVisibility) when m_orderIndependentTransparency is on, with the depth buffer
+        // of the draws. Runs on the worker threads with m_tiledRasterization
+        // (its time is added to the processFragments time of the statistics of the last draw)
+        void resolveTransparency(CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) {
+            if (m_transparency.empty())
+                return;
+            StageTimer timer(m_stats.processFragmentsNs);
+            m_transparency.setSize(fb.W, fb.H);
+            if (m_tiledRasterization)
+                workerPool().parallelFor(fb.H, [&](int y, int) { m_transparency.resolveRow(y, fb, db); });
+            else
+                for (int y = 0; y < (int) fb.H; y++)
+                    m_transparency.resolveRow(y, fb, db);
+            m_transparency.endResolve();
+        }
+
+        // call pixelFunc(glm::ivec2) for each pixel inside the rectangle [xMin, xMax] x [yMin, yMax] that a draw
+        // with one sample per pixel would rasterize for the triangle with window coordinates p1, p2 and p3 (after
+        // toScreenSpace), with the current settings, including the rejection of the triangle setup. The tiled
+        // rasterization calls it once per screen tile, with the rectangle of the tile (e.g. to check the fill rule)
+        template<class PixelFunc>
+        void forEachCoveredPixel(glm::vec4 p1, glm::vec4 p2, glm::vec4 p3, int xMin, int yMin, int xMax, int yMax,
+                                 PixelFunc &&pixelFunc) {
+            triangle tri;
+            tri.v1.pos = p1;
+            tri.v2.pos = p2;
+            tri.v3.pos = p3;
+            TriangleSetup setup;
+            if (!coversPixels(tri) || !setup.setup(tri))
+                return;
+            forEachPixel(tri, xMin, yMin, xMax, yMax, pixelFunc);
+        }
+
+    protected:
+        void drawPrimitives(std::vector<fragment> &frs, CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) override {
+            {
+                // the triangle setup is counted as part of the rasterization
+                StageTimer timer(m_stats.rasterPrimitivesNs);
+                setupPrimitives(db.S == 1);
+            }
+
+            assert(fb.S == db.S);
+            bool multisample = db.S > 1;
+            m_multisampleRasterizers.resize(1);
+
+            // the depth buffer may have been cleared or written since the last call
+            // (the depth pyramid is built from single sample depth buffers only)
+            m_hiZActive = m_hierarchicalZ && !multisample;
+            if (m_hiZActive) {
+                StageTimer timer(m_stats.rasterPrimitivesNs);
+                m_hiZ.reset(db);
+            }
+
+            m_transparencyActive = m_orderIndependentTransparency && !multisample;
+            if (m_transparencyActive) {
+                m_transparency.setSize(fb.W, fb.H);
+                m_transparencyChunks.resize(std::max<std::size_t>(m_transparencyChunks.size(), 1));
+            }
+
+            m_visibilityActive = m_visibilityBuffer && !multisample && !m_transparencyActive && beginVisibility(fb);
+            // ids left by earlier draws would be shaded over the pixels of a draw that doesn't write ids
+            if (!m_visibilityActive && m_instanceCount > 0)
+                resolveVisibility(fb);
+
+            if (!m_tiledRasterization && !m_streamFragments && !m_hierarchicalZ && !multisample && !m_visibilityActive &&
+                !m_transparencyActive && !db.planeCompression()) {
+                Renderer::drawPrimitives(frs, fb, db);
+                return;
+            }
+
+            // from here on, the rasterization, the fragment shader and the writes to the frame buffer are interleaved
+            StageTimer timer(m_stats.rasterPrimitivesNs);
+            if (!m_tiledRasterization) {
+                for (int i = 0, size = m_primitives.size(); i < size; i++) {
+                    if (m_primitives[i].rejected)
+                        continue;
+                    if (multisample)
+                        streamTriangleMultisample(i, 0, 0, fb.W - 1, fb.H - 1, m_multisampleRasterizers[0], fb, db, m_stats.fragments);
+                    else
+                        streamTriangle(i, 0, 0, fb.W - 1, fb.H - 1, fb, db, m_stats.fragments, m_transparencyChunks[0]);
+                }
+                if (m_visibilityActive)
+                    endVisibility();
+                return;
+            }
+
+            binPrimitives(fb.W, fb.H, multisample);
+
+            if (m_hiZActive) {
+                // each thread can only use the levels of the pyramid with tiles inside its own screen tiles
+                const int hiZTile = HierarchicalZBuffer::tileSize;
+                if (m_tileSize % hiZTile == 0) {
+                    int level = 0;
+                    while (m_tileSize % (hiZTile << (level + 1)) == 0)
+                        level++;
+                    m_hiZ.setMaxLevel(level);
+                }
+                else
+                    m_hiZActive = false;
+            }
+
+            WorkerPool &pool = workerPool();
+            m_tileFragments.resize(pool.threadCount());
+            m_multisampleRasterizers.resize(pool.threadCount());
+            m_workerCounters.assign(pool.threadCount(), FragmentCounters());
+            // chunks still being filled by the previous draws are kept
+            m_transparencyChunks.resize(std::max<std::size_t>(m_transparencyChunks.size(), pool.threadCount()));
+            pool.parallelFor(m_tileCountX * m_tileCountY, [&](int tile, int worker) {
+                rasterTile(tile, worker, fb, db);
+            });
+            for (auto &counters : m_workerCounters)
+                m_stats.fragments.add(counters);
+            if (m_visibilityActive)
+                endVisibility();
+        }
+
     private:
 
         // create triangle primitives
         void assemblePrimitives(const std::vector<vertex> &vts) override {
-            m_primitives.clear();
-            m_primitives.reserve(vts.size()/3);
+            copyVertices(vts);
+            m_primitives.resize(vts.size()/3);
 
-            for(int i = 0, size = vts.size()-2; i < size; i+=3){
-                triangle t;
-                t.v1 = vts[i];
-                t.v2 = vts[i+1];
-                t.v3 = vts[i+2];
+            forEachChunk((int) m_primitives.size(), [&](int, int begin, int end) {
+                for (int i = begin; i < end; i++) {
+                    unsigned int first = (unsigned int) i * 3;
+                    m_primitives[i] = indexedTriangle{first, first + 1, first + 2};
+                }
+                return 0;
+            });
+            m_stats.primitivesIn = m_primitives.size();
+        }
 
-                m_primitives.push_back(t);
-            }
+        // create triangle primitives that refer to the shared vertices vts
+        void assembleIndexedPrimitives(const std::vector<vertex> &vts, const std::vector<unsigned int> &indices) override {
+            copyVertices(vts);
+            m_primitives.resize(indices.size()/3);
+
+            forEachChunk((int) m_primitives.size(), [&](int, int begin, int end) {
+                for (int i = begin; i < end; i++)
+                    m_primitives[i] = indexedTriangle{indices[i * 3], indices[i * 3 + 1], indices[i * 3 + 2]};
+                return 0;
+            });
+            m_stats.primitivesIn = m_primitives.size();
+        }
+
+        void copyVertices(const std::vector<vertex> &vts) {
+            m_vertices.resize(vts.size());
+            forEachChunk((int) vts.size(), [&](int, int begin, int end) {
+                std::copy(vts.begin() + begin, vts.begin() + end, m_vertices.begin() + begin);
+                return 0;
+            });
         }
 
-        bool clipTriangle(triangle &tIn, int i){
+        // vertices and triangles added by clipping a chunk of the primitives. They are stored apart from the ones of
+        // the draw until all the chunks are clipped, the triangles refer to the vertices of the chunk with indices
+        // from m_vertices.size() on, as if they were added at the end of m_vertices
+        struct ClipChunk {
+            std::vector<vertex> vertices;
+            std::vector<indexedTriangle> primitives;
+            std::vector<unsigned int> clipCodes;
+            int clipped = 0;
+            // where the vertices and the triangles go once the chunks are put together
+            unsigned int vertexOffset = 0, primitiveOffset = 0;
+        };
+
+        // vertex index of m_vertices or, past its end, of the vertices added to chunk
+        const vertex &clipVertex(unsigned int index, const ClipChunk &chunk) const {
+            return index < m_vertices.size() ? m_vertices[index] : chunk.vertices[index - m_vertices.size()];
+        }
+
+        // add the vertex where the edge from vertex in to vertex out crosses the clipping plane,
+        // and return its index. The vertices of the edge are not changed, since other triangles may share them
+        unsigned int clipEdge(unsigned int in, unsigned int out, int idx, int wMult, float bound, ClipChunk &chunk){
+            vertex inVtx = clipVertex(in, chunk);
+            vertex outVtx = clipVertex(out, chunk);
+            // vector from in position to out position
+            glm::vec4 inOutVec = outVtx.pos - inVtx.pos;
+            // find the weight t
+            float t = (inVtx.pos[idx] - bound * inVtx.pos.w * wMult) / (bound * inOutVec.w * wMult - inOutVec[idx]);
+            // compute edge intersection
+            chunk.vertices.push_back(inVtx + (outVtx - inVtx) * t);
+            return m_vertices.size() + chunk.vertices.size() - 1;
+        }
+
+        // clip the triangle against the plane x,y,z = w * bound (side 0, 1, 2) or x,y,z = -w * bound (side 3, 4, 5)
+        // returns false if the triangle is rejected
+        bool clipTriangle(indexedTriangle &tIn, int i, float bound, ClipChunk &chunk){
             // index to x, y or z coordinate (x=0, y=1, z=2)
             int idx = i % 3;
             // we check if the variable is in the range of the clipping plane using w
@@ -44,24 +296,25 @@ namespace srl {
             // we can rewrite the latter with x,y,z * -1 > w
             // so we need to multiply x,y,z by -1 when testing against the planes at -w
             // planes 0, 1 and 2 are positive w, planes 3, 4 and 5 are negative w
+            // (with a guard band, w is scaled by bound)
             int wMult = i > 2 ? -1 : 1;
 
             // positions of the three vertex
-            glm::vec4 p1 = tIn.v1.pos;
-            glm::vec4 p2 = tIn.v2.pos;
-            glm::vec4 p3 = tIn.v3.pos;
+            glm::vec4 p1 = clipVertex(tIn.v1, chunk).pos;
+            glm::vec4 p2 = clipVertex(tIn.v2, chunk).pos;
+            glm::vec4 p3 = clipVertex(tIn.v3, chunk).pos;
 
-            // store a pointer to the vertices in and out the desired half-space
-            vertex* inVts[3]; int inCount = 0;
-            vertex* outVts[3]; int outCount = 0;
+            // store a pointer to the vertex indices in and out the desired half-space
+            unsigned int* inVts[3]; int inCount = 0;
+            unsigned int* outVts[3]; int outCount = 0;
             int outIdx;
 
             // test if the points are in the valid
-            if(p1[idx] * wMult > p1.w) {outVts[outCount] = &tIn.v1; outCount++; outIdx = 0;}
+            if(p1[idx] * wMult > bound * p1.w) {outVts[outCount] = &tIn.v1; outCount++; outIdx = 0;}
             else {inVts[inCount] = &tIn.v1; inCount++;}
-            if(p2[idx] * wMult > p2.w) {outVts[outCount] = &tIn.v2; outCount++; outIdx = 1;}
+            if(p2[idx] * wMult > bound * p2.w) {outVts[outCount] = &tIn.v2; outCount++; outIdx = 1;}
             else {inVts[inCount] = &tIn.v2; inCount++;}
-            if(p3[idx] * wMult > p3.w) {outVts[outCount] = &tIn.v3; outCount++; outIdx = 2;}
+            if(p3[idx] * wMult > bound * p3.w) {outVts[outCount] = &tIn.v3; outCount++; outIdx = 2;}
             else {inVts[inCount] = &tIn.v3; inCount++;}
 
 
@@ -76,19 +329,9 @@ namespace srl {
                 return false;
             }
             else if (outCount == 2) {   // two vertices in the invalid side of the half-space
-                // vector from in position to first out position
-                glm::vec4 inOutVec = outVts[0]->pos - inVts[0]->pos;
-                // find the weight t
-                float t = (inVts[0]->pos[idx] - inVts[0]->pos.w * wMult) / (inOutVec.w * wMult - inOutVec[idx]);
-                // compute edge intersection 1
-                vertex edgeVtx1 = (*inVts[0]) + (*outVts[0] - *inVts[0]) * t;
-
-                // vector from in position to second out position
-                inOutVec = outVts[1]->pos - inVts[0]->pos;
-                // find the weight t
-                t = (inVts[0]->pos[idx] - inVts[0]->pos.w * wMult) / (inOutVec.w * wMult - inOutVec[idx]);
-                // compute edge intersection 2
-                vertex edgeVtx2 = (*inVts[0]) + (*outVts[1] - *inVts[0]) * t;
+                // compute edge intersections 1 and 2
+                unsigned int edgeVtx1 = clipEdge(*inVts[0], *outVts[0], idx, wMult, bound, chunk);
+                unsigned int edgeVtx2 = clipEdge(*inVts[0], *outVts[1], idx, wMult, bound, chunk);
 
                 // update the two triangle vertices in the invalid half-space
                 *(outVts[0]) = edgeVtx1;
@@ -96,61 +339,155 @@ namespace srl {
             }
             else if (outCount == 1) {   // one vertex in the invalid side of the half-space
 
-                // vector from first in position to out position
-                glm::vec4 inOutVec = outVts[0]->pos - inVts[0]->pos;
-                // find the weight t
-                float t = (inVts[0]->pos[idx] - inVts[0]->pos.w * wMult) / (inOutVec.w * wMult - inOutVec[idx]);
-                // compute edge intersection 1
-                vertex edgeVtx1 = (*inVts[0]) + (*outVts[0] - *inVts[0]) * t;
-
-                // vector from second in position to out position
-                inOutVec = outVts[0]->pos - inVts[1]->pos;
-                // find the weight t
-                t = (inVts[1]->pos[idx] - inVts[1]->pos.w * wMult) / (inOutVec.w * wMult - inOutVec[idx]);
-                // compute edge intersection 2
-                vertex edgeVtx2 = (*inVts[1]) + (*outVts[0] - *inVts[1]) * t;
+                // compute edge intersections 1 (from the first in vertex) and 2 (from the second in vertex)
+                unsigned int edgeVtx1 = clipEdge(*inVts[0], *outVts[0], idx, wMult, bound, chunk);
+                unsigned int edgeVtx2 = clipEdge(*inVts[1], *outVts[0], idx, wMult, bound, chunk);
 
                 // update the location of the vertex in the invalid side of the half-space
                 *outVts[0] = edgeVtx1;
 
                 // we have fixed the triangle that was already stored, now lets create the triangle that is missing
                 // using the two edge points and the second in vertex
-                triangle newT;
+                indexedTriangle newT;
                 // ensure the winding order of new triangles is correct (so that they are not culled during backface culling)
                 if(outIdx == 0){newT.v1 = *inVts[1]; newT.v2 = edgeVtx2; newT.v3 = edgeVtx1;}
                 else if(outIdx == 1){newT.v1 =  *inVts[1]; newT.v2 = edgeVtx1; newT.v3 = edgeVtx2;}
                 else {newT.v1 = edgeVtx1; newT.v2 = *inVts[1]; newT.v3 = edgeVtx2;}
 
-                m_primitives.push_back(newT);
+                // (tIn may be a triangle of the chunk, so it is not used after this)
+                chunk.primitives.push_back(newT);
+                chunk.clipped++;
             }
 
             return true;
         }
 
 
-        // clip primitives so that they are contained within the render volume
+        // clip primitives so that they are in front of the near plane and inside the guard band
+        // the vertices are tested against the planes once (outcodes). Triangles completely outside of one of the
+        // planes of the render volume are rejected, and triangles that don't cross the near plane or the guard band
+        // are not clipped at all. The rasterizer discards the pixels outside of the frame buffer, and the depth test
+        // the pixels beyond the far plane.
+        // Each chunk of the primitives is clipped on its own (see ClipChunk), and the vertices and triangles the
+        // chunks add are then appended to the ones of the draw in the order of the chunks
         void clipPrimitives() override {
-            for (int side = 0; side < 6; side ++){
-                for(int i = 0, size = m_primitives.size(); i < size; i++){
-                    if (!m_primitives[i].rejected)
-                        clipTriangle(m_primitives[i], side);
+            m_outcodes.resize(m_vertices.size());
+            float bound = viewportBound(m_viewportWidth, m_viewportHeight, m_viewportSamples);
+            forEachChunk((int) m_vertices.size(), [&](int, int begin, int end) {
+                for (int i = begin; i < end; i++)
+                    m_outcodes[i] = outcode(m_vertices[i].pos, clipBound(0), bound);
+                return 0;
+            });
+
+            int primitiveCount = (int) m_primitives.size();
+            m_clipCodes.resize(primitiveCount);
+            m_clipChunks.resize(std::max<std::size_t>(m_clipChunks.size(), chunkCount(primitiveCount)));
+            m_stats.primitivesRejected += forEachChunk(primitiveCount, [&](int chunk, int begin, int end) {
+                return clipChunk(m_clipChunks[chunk], begin, end);
+            });
+
+            // room for the vertices and the triangles of the chunks
+            unsigned int vertexCount = m_vertices.size(), addedVertices = 0, addedPrimitives = 0;
+            for (int c = 0, chunks = chunkCount(primitiveCount); c < chunks; c++) {
+                ClipChunk &chunk = m_clipChunks[c];
+                chunk.vertexOffset = addedVertices;
+                chunk.primitiveOffset = primitiveCount + addedPrimitives;
+                addedVertices += chunk.vertices.size();
+                addedPrimitives += chunk.primitives.size();
+                m_stats.primitivesClipped += chunk.clipped;
+            }
+            if (addedPrimitives == 0 && addedVertices == 0)
+                return;
+            m_vertices.resize(vertexCount + addedVertices);
+            m_primitives.resize(primitiveCount + addedPrimitives);
+
+            // the vertices of a chunk move by the number of vertices of the chunks before it
+            forEachChunk(primitiveCount, [&](int c, int begin, int end) {
+                ClipChunk &chunk = m_clipChunks[c];
+                std::copy(chunk.vertices.begin(), chunk.vertices.end(), m_vertices.begin() + vertexCount + chunk.vertexOffset);
+                std::copy(chunk.primitives.begin(), chunk.primitives.end(), m_primitives.begin() + chunk.primitiveOffset);
+                if (chunk.vertexOffset > 0) {
+                    auto moveVertices = [&](indexedTriangle &tri) {
+                        for (unsigned int *v : {&tri.v1, &tri.v2, &tri.v3})
+                            if (*v >= vertexCount)
+                                *v += chunk.vertexOffset;
+                    };
+                    for (int i = begin; i < end; i++)
+                        if (m_clipCodes[i])
+                            moveVertices(m_primitives[i]);
+                    for (unsigned int i = 0; i < chunk.primitives.size(); i++)
+                        moveVertices(m_primitives[chunk.primitiveOffset + i]);
+                }
+                return 0;
+            });
+        }
+
+        // reject the primitives [begin, end) that are outside of the render volume, and clip the others into chunk.
+        // Returns the number of primitives rejected
+        int clipChunk(ClipChunk &chunk, int begin, int end) {
+            chunk.vertices.clear();
+            chunk.primitives.clear();
+            chunk.clipCodes.clear();
+            chunk.clipped = 0;
+
+            // planes each triangle has to be clipped against
+            int rejected = 0;
+            bool clipping = false;
+            for (int i = begin; i < end; i++){
+                indexedTriangle &tri = m_primitives[i];
+                m_clipCodes[i] = 0;
+                if (tri.rejected)
+                    continue;
+                unsigned int c1 = m_outcodes[tri.v1], c2 = m_outcodes[tri.v2], c3 = m_outcodes[tri.v3];
+                if (c1 & c2 & c3 & outsideVolume) {
+                    // all the vertices are outside of the same plane
+                    tri.rejected = true;
+                    rejected++;
+                    continue;
+                }
+                m_clipCodes[i] = (c1 | c2 | c3) & clippedPlanes;
+                clipping = clipping || m_clipCodes[i] != 0;
+            }
+            if (!clipping)
+                return rejected;
+
+            for (int side : {5, 0, 1, 3, 4}){
+                // the triangles of the chunk, then the ones added by clipping against the previous planes, which
+                // still have to be clipped against the same planes
+                unsigned int added = chunk.primitives.size();
+                for (int i = begin; i < end; i++){
+                    if (m_primitives[i].rejected || !(m_clipCodes[i] & clipBit(side)))
+                        continue;
+                    if (!clipTriangle(m_primitives[i], side, clipBound(side), chunk))
+                        rejected++;
+                    chunk.clipCodes.resize(chunk.primitives.size(), m_clipCodes[i]);
+                }
+                for (unsigned int i = 0; i < added; i++){
+                    if (chunk.primitives[i].rejected || !(chunk.clipCodes[i] & clipBit(side)))
+                        continue;
+                    if (!clipTriangle(chunk.primitives[i], side, clipBound(side), chunk))
+                        rejected++;
+                    unsigned int clipCodes = chunk.clipCodes[i];
+                    chunk.clipCodes.resize(chunk.primitives.size(), clipCodes);
                 }
             }
+            return rejected;
         }
 
         // perspective division (canonical perspective volume to normalized device coordinates)
+        // the triangles share their vertices, so each vertex is divided once
+        // (vertices left outside of the volume by clipping are not used anymore, their result doesn't matter)
         void divideByW() override {
-            for(auto &tri : m_primitives) {
-                // the division of position x, y and z coordinates will place all vertices in the normalized device coordinates
-                // however, we divide all parameters (not only position) to perform hyperbolic interpolation later on
-                tri.v1.pos.z = tri.v1.pos.z / tri.v1.pos.w;
-                tri.v1 = tri.v1 / tri.v1.pos.w;
-                tri.v2.pos.z = tri.v2.pos.z / tri.v2.pos.w;
-                tri.v2 = tri.v2 / tri.v2.pos.w;
-                tri.v3.pos.z = tri.v3.pos.z / tri.v3.pos.w;
-                tri.v3 = tri.v3 / tri.v3.pos.w;
-
-            }
+            forEachChunk((int) m_vertices.size(), [&](int, int begin, int end) {
+                for (int i = begin; i < end; i++) {
+                    vertex &vtx = m_vertices[i];
+                    // the division of position x, y and z coordinates will place all vertices in the normalized device coordinates
+                    // however, we divide all parameters (not only position) to perform hyperbolic interpolation later on
+                    vtx.pos.z = vtx.pos.z / vtx.pos.w;
+                    vtx = vtx / vtx.pos.w;
+                }
+                return 0;
+            });
         }
 
         // normalized device coordinates to window coordinates
@@ -158,73 +495,797 @@ namespace srl {
             float halfW = width / 2;
             float halfH = height / 2;
             glm::mat4 toWindowSpace = glm::scale(glm::vec3(halfW, halfH, 1.f)) * glm::translate(glm::vec3(1.f, 1.f, 0.f));
-            for(auto &tri : m_primitives) {
-                tri.v1.pos = toWindowSpace * tri.v1.pos;
-                tri.v2.pos = toWindowSpace * tri.v2.pos;
-                tri.v3.pos = toWindowSpace * tri.v3.pos;
-            }
+            forEachChunk((int) m_vertices.size(), [&](int, int begin, int end) {
+                for (int i = begin; i < end; i++)
+                    m_vertices[i].pos = toWindowSpace * m_vertices[i].pos;
+                return 0;
+            });
         }
 
 
         // only draw triangles in a counterclockwise winding order (which we define as facing the camera)
+        // this runs in clipping space, before clipping. The determinant of the (x, y, w) coordinates of the vertices
+        // is the z component of the normal in the NDC times w1 * w2 * w3, so it has the same sign for triangles in
+        // front of the camera, and it still tells the facing of triangles that cross the plane of the camera
         void backfaceCulling() override{
-            for(auto &tri : m_primitives) {
-                // two vectors along the edges of the triangle
-                glm::vec3 v1 = tri.v2.pos - tri.v1.pos;
-                glm::vec3 v2 = tri.v3.pos - tri.v1.pos;
+            m_stats.primitivesCulled += forEachChunk((int) m_primitives.size(), [&](int, int begin, int end) {
+                int culled = 0;
+                for (int i = begin; i < end; i++) {
+                    indexedTriangle &tri = m_primitives[i];
+                    glm::vec4 p1 = m_vertices[tri.v1].pos;
+                    glm::vec4 p2 = m_vertices[tri.v2].pos;
+                    glm::vec4 p3 = m_vertices[tri.v3].pos;
 
-                // z component of the normal in the NDC
-                float nz = v1.x * v2.y - v1.y * v2.x;
+                    float det = p1.x * (p2.y * p3.w - p3.y * p2.w)
+                              - p1.y * (p2.x * p3.w - p3.x * p2.w)
+                              + p1.w * (p2.x * p3.y - p3.x * p2.y);
 
-                // bigger than 0 means the normal is not pointing towards the camera
-                if (nz < 0) {
-                    tri.rejected = true;
+                    // smaller than 0 means the normal is not pointing towards the camera
+                    if (det < 0) {
+                        tri.rejected = true;
+                        culled++;
+                    }
                 }
-            }
+                return culled;
+            });
         }
 
         // rasterize the triangle and generate the fragments (outFrs)
         void rasterPrimitives(std::vector<fragment> &outFrs) override {
             outFrs.clear();
 
-            for(auto &tri : m_primitives) {
-                // skip this primitive if it has been rejected during clipping or culling
-                if(tri.rejected)
+            for(int i = 0, size = m_primitives.size(); i < size; i++) {
+                // skip this primitive if it has been rejected during clipping, culling or setup
+                if(m_primitives[i].rejected)
                     continue;
 
-                // vertices of the triangle, rounded to the closest integer (aka pixel location)
-                glm::ivec2 iv1(tri.v1.pos.x + .5f, tri.v1.pos.y + .5f);
-                glm::ivec2 iv2(tri.v2.pos.x + .5f, tri.v2.pos.y + .5f);
-                glm::ivec2 iv3(tri.v3.pos.x + .5f, tri.v3.pos.y + .5f);
-                // run the rasterization and collect all pixel locations
-                triangle_rasterizer rasterizer(iv1.x, iv1.y, iv2.x, iv2.y, iv3.x, iv3.y);
-                std::vector<glm::ivec2> pixels = rasterizer.all_pixels();
+                // x and y are only clipped to the guard band, scissor the triangle to the frame buffer
+                rasterTriangle(i, 0, 0, m_viewportWidth - 1, m_viewportHeight - 1, outFrs);
+            }
+        }
 
-                // create a fragment for each pixel
-                for (auto &pxl : pixels){
-                    fragment frag{};
+        // triangle setup, compute the plane equations of the triangles that will be rasterized
+        // triangles without area on the screen are rejected, since they can't be interpolated. With one sample per
+        // pixel, triangles that cover no pixel (e.g. thin or tiny triangles between pixels) are rejected before
+        // their setup
+        void setupPrimitives(bool singleSample) {
+            m_setups.resize(m_primitives.size());
+            m_stats.primitivesRejected += forEachChunk((int) m_primitives.size(), [&](int, int begin, int end) {
+                int rejected = 0;
+                for (int i = begin; i < end; i++) {
+                    indexedTriangle &prim = m_primitives[i];
+                    if (prim.rejected)
+                        continue;
+                    triangle tri = setupTriangle(prim);
+                    if ((singleSample && !coversPixels(tri)) || !m_setups[i].setup(tri)) {
+                        prim.rejected = true;
+                        rejected++;
+                    }
+                }
+                return rejected;
+            });
+        }
 
+        // false if the rasterizer generates no pixel for the triangle: its vertices are on a line once they are
+        // rounded for the rasterizer, or there is no pixel in its bounding box
+        bool coversPixels(const triangle &tri) const {
+            glm::ivec2 iv1 = rasterPosition(tri.v1.pos);
+            glm::ivec2 iv2 = rasterPosition(tri.v2.pos);
+            glm::ivec2 iv3 = rasterPosition(tri.v3.pos);
+            if (std::int64_t(iv2.x - iv1.x) * (iv3.y - iv1.y) == std::int64_t(iv2.y - iv1.y) * (iv3.x - iv1.x))
+                return false;
+            glm::ivec2 bMin, bMax;
+            pixelBounds(iv1, iv2, iv3, bMin, bMax);
+            return bMin.x <= bMax.x && bMin.y <= bMax.y;
+        }
+
+        // copy the vertices of the triangle for the rasterization
+        // (the rasterization works on its own copy, since barycentricCoordinatesAt modifies the triangle)
+        triangle setupTriangle(const indexedTriangle &prim) const {
+            triangle tri;
+            tri.v1 = m_vertices[prim.v1];
+            tri.v2 = m_vertices[prim.v2];
+            tri.v3 = m_vertices[prim.v3];
+            return tri;
+        }
+
+        // rasterize the part of primitive prim inside the rectangle [xMin, xMax] x [yMin, yMax]
+        // and append the fragments to outFrs
+        void rasterTriangle(int prim, int xMin, int yMin, int xMax, int yMax, std::vector<fragment> &outFrs) {
+            triangle tri = setupTriangle(m_primitives[prim]);
+            if (m_planeInterpolation) {
+                PlaneInterpolator<TriangleSetup::valueCount> interp(m_setups[prim]);
+                forEachPixel(tri, xMin, yMin, xMax, yMax, [&](glm::ivec2 pxl) {
+                    fragment frag{};
                     frag.pos = pxl;
+                    frag.depth = interp.moveTo(pxl);
+                    interpolateAttributes(interp, frag);
+                    outFrs.push_back(frag);
+                });
+                return;
+            }
+            forEachPixel(tri, xMin, yMin, xMax, yMax, [&](glm::ivec2 pxl) {
+                outFrs.push_back(triangleFragment(tri, pxl));
+            });
+        }
 
-                    // barycentric coordinates (in 2D projected space)
-                    glm::vec3 bar = tri.barycentricCoordinatesAt(pxl);
-                    // hyperbolic interpolation correction
-                    float hypInterp = bar.x * tri.v1.hypInterp + bar.y * tri.v2.hypInterp + bar.z * tri.v3.hypInterp;
-                    bar = bar / hypInterp;
-                    frag.depth = bar.x * tri.v1.pos.z + bar.y * tri.v2.pos.z + bar.z * tri.v3.pos.z;
-                    frag.col = bar.x * tri.v1.col + bar.y * tri.v2.col + bar.z * tri.v3.col;
-                    frag.norm = bar.x * tri.v1.norm + bar.y * tri.v2.norm + bar.z * tri.v3.norm;
-                    frag.uv = bar.x * tri.v1.uv + bar.y * tri.v2.uv + bar.z * tri.v3.uv;
+        // rasterize the part of primitive prim inside the rectangle [xMin, xMax] x [yMin, yMax], which must be inside
+        // the frame buffer, and depth test, process and write each fragment right away
+        // (chunk receives the translucent fragments of m_orderIndependentTransparency)
+        void streamTriangle(int prim, int xMin, int yMin, int xMax, int yMax,
+                            CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db, FragmentCounters &counters,
+                            TransparencyBuffer::Chunk &chunk) {
+            triangle tri = setupTriangle(m_primitives[prim]);
+            PlaneInterpolator<TriangleSetup::valueCount> interp(m_setups[prim]);
 
+            // hierarchical z: test the whole triangle, and then each block, against the depth pyramid
+            bool depthTest = true, blockDepthTest = true;
+            glm::ivec2 bMin, bMax;
+            DepthFunction depthFunc;
+            bool hiZTest = m_hiZActive && depthFunction(tri, depthFunc);
+            if (hiZTest) {
+                pixelBounds(tri, bMin, bMax);
+                bMin = glm::max(bMin, glm::ivec2(xMin, yMin));
+                bMax = glm::min(bMax, glm::ivec2(xMax, yMax));
+                if (bMin.x > bMax.x || bMin.y > bMax.y)
+                    return;
 
-                    outFrs.push_back(frag);
+                float zMin, zMax;
+                depthRange(depthFunc, bMin, bMax, zMin, zMax);
+                // the nearest point of the triangle is behind everything in its bounding box
+                if (m_hiZ.occluded(bMin.x, bMin.y, bMax.x, bMax.y, zMin))
+                    return;
+                // the farthest point of the triangle is in front of everything in its bounding box
+                depthTest = blockDepthTest = !m_hiZ.visible(bMin.x, bMin.y, bMax.x, bMax.y, zMax);
+            }
+
+            // depth compression: the depth of a block covered by the triangle is written as a plane (the depth z/w is
+            // linear in screen space) when all its pixels are known to pass the depth test, the fragments of the
+            // block then skip the depth buffer. Translucent fragments don't write depth, so they can't be compressed
+            const int bs = edge_function_rasterizer::block_size;
+            static_assert(bs == CustomFrameBuffer<float>::planeBlockSize, "the blocks of the rasterizer must be compressed");
+            glm::dvec3 depthPlane;
+            bool planeCompression = db.planeCompression() && !m_transparencyActive &&
+                                    screenPlane(tri, tri.v1.pos.z / tri.v1.hypInterp, tri.v2.pos.z / tri.v2.hypInterp,
+                                                tri.v3.pos.z / tri.v3.hypInterp, depthPlane);
+            bool planeBlock = false;
+
+            auto blockFunc = [&](int bx, int by, std::uint64_t mask) {
+                planeBlock = false;
+                if (hiZTest) {
+                    glm::ivec2 blockMin = glm::max(glm::ivec2(bx, by), bMin);
+                    glm::ivec2 blockMax = glm::min(glm::ivec2(bx + bs - 1, by + bs - 1), bMax);
+                    float zMin, zMax;
+                    depthRange(depthFunc, blockMin, blockMax, zMin, zMax);
+                    if (m_hiZ.occluded(blockMin.x, blockMin.y, blockMax.x, blockMax.y, zMin))
+                        return false;
+                    blockDepthTest = depthTest && !m_hiZ.visible(blockMin.x, blockMin.y, blockMax.x, blockMax.y, zMax);
+                }
+                if (planeCompression && mask == ~std::uint64_t(0))
+                    planeBlock = paintDepthPlane(bx, by, depthPlane, blockDepthTest, db);
+                if (planeBlock) {
+                    counters.planeBlocks++;
+                    if (m_hiZActive)
+                        m_hiZ.depthWritten(bx, by);
+                }
+                return true;
+            };
+
+            forEachPixel(tri, xMin, yMin, xMax, yMax, blockFunc, [&](glm::ivec2 pxl) {
+                glm::vec3 bar;
+                float depth;
+                if (m_planeInterpolation)
+                    depth = interp.moveTo(pxl);
+                else {
+                    bar = perspectiveBarycentric(tri, pxl);
+                    depth = interpolateDepth(tri, bar);
+                }
+
+                // early z/depth-test, occluded fragments are never interpolated or shaded
+                counters.generated++;
+                if (blockDepthTest && !planeBlock && !(depth < db.valueAt(pxl.x, pxl.y))) {
+                    counters.depthRejected++;
+                    return;
+                }
+                counters.written++;
+
+                if (m_visibilityActive) {
+                    // only the id of the triangle, the pixel is shaded by resolveVisibility
+                    m_visibility[pxl.x + pxl.y * m_visibilityWidth] = m_instanceId | std::uint32_t(prim);
+                    if (planeBlock)
+                        return;
+                    db.paintAt(pxl.x, pxl.y, depth);
+                    if (m_hiZActive)
+                        m_hiZ.depthWritten(pxl.x, pxl.y);
+                    return;
+                }
+
+                fragment frag{};
+                frag.pos = pxl;
+                frag.depth = depth;
+                if (m_planeInterpolation)
+                    interpolateAttributes(interp, frag);
+                else
+                    interpolateAttributes(tri, bar, frag);
+                processFragment(frag);
+
+                if (m_transparencyActive && frag.col.a < 1.0f) {
+                    // blended by resolveTransparency, without writing depth
+                    m_transparency.add(chunk, pxl.x, pxl.y, frag.depth, Colors::toRGBA32(frag.col));
+                    return;
+                }
+                fb.paintAt(pxl.x, pxl.y, Colors::toRGBA32(frag.col));
+                if (planeBlock)
+                    return;
+                db.paintAt(pxl.x, pxl.y, frag.depth);
+                if (m_hiZActive)
+                    m_hiZ.depthWritten(pxl.x, pxl.y);
+            });
+        }
+
+        // write the depth plane a * x + b * y + c of a triangle that covers the block of pixels at (bx, by), if every
+        // pixel of the block passes the depth test: the block is cleared or holds a plane that is farther away, or
+        // depthTest is false (the depth pyramid found the block visible). Returns false if nothing was written
+        static bool paintDepthPlane(int bx, int by, const glm::dvec3 &plane, bool depthTest, CustomFrameBuffer <float> &db) {
+            const int bs = CustomFrameBuffer<float>::planeBlockSize;
+            double c = plane.x * bx + plane.y * by + plane.z;
+            if (depthTest) {
+                // the plane is linear, so its farthest pixel is a corner of the block
+                double farthest = std::max(std::max(c, c + plane.x * (bs - 1)),
+                                           std::max(c + plane.y * (bs - 1), c + (plane.x + plane.y) * (bs - 1)));
+                float minDepth, maxDepth;
+                if (!db.blockRange(bx, by, minDepth, maxDepth) || !(farthest + 1e-5 < minDepth))
+                    return false;
+            }
+            db.paintPlane(bx, by, float(plane.x), float(plane.y), float(c));
+            return true;
+        }
+
+        // multisampled version of streamTriangle: each sample of the pixel covered by the triangle is depth tested
+        // and written with the depth of the triangle at the sample, and the fragment is shaded once, at the pixel
+        // location, if any sample passes. Pixels where all the samples pass stay compressed in the color buffer
+        void streamTriangleMultisample(int prim, int xMin, int yMin, int xMax, int yMax, MultisampleRasterizer &rasterizer,
+                                       CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db,
+                                       FragmentCounters &counters) {
+            const indexedTriangle &tri = m_primitives[prim];
+            PlaneInterpolator<TriangleSetup::valueCount> interp(m_setups[prim]);
+
+            const unsigned int sampleCount = db.S, allSamples = (1u << sampleCount) - 1u;
+            glm::vec2 offsets[8];
+            for (unsigned int s = 0; s < sampleCount; s++)
+                offsets[s] = glm::vec2(samplePositions(sampleCount)[s]) / 16.0f;
+
+            rasterizer.rasterize(fixedPoint(m_vertices[tri.v1].pos), fixedPoint(m_vertices[tri.v2].pos),
+                                 fixedPoint(m_vertices[tri.v3].pos), subpixelBits, sampleCount,
+                                 xMin, yMin, xMax, yMax, [&](glm::ivec2 pxl, unsigned int mask) {
+                float centerDepth = interp.moveTo(pxl);
+
+                // early z/depth-test of the covered samples
+                float depths[8];
+                unsigned int passed = 0;
+                for (unsigned int s = 0; s < sampleCount; s++) {
+                    if (!(mask & (1u << s)))
+                        continue;
+                    depths[s] = interp.depthAt(offsets[s]);
+                    if (depths[s] < db.sampleAt(pxl.x, pxl.y, s))
+                        passed |= 1u << s;
+                }
+                counters.generated++;
+                if (!passed) {
+                    counters.depthRejected++;
+                    return;
+                }
+                counters.written++;
+
+                fragment frag{};
+                frag.pos = pxl;
+                frag.depth = centerDepth;
+                interpolateAttributes(interp, frag);
+                processFragment(frag);
+
+                std::uint32_t color = Colors::toRGBA32(frag.col);
+                if (passed == allSamples)
+                    fb.paintSamples(pxl.x, pxl.y, color);
+                for (unsigned int s = 0; s < sampleCount; s++) {
+                    if (!(passed & (1u << s)))
+                        continue;
+                    if (passed != allSamples)
+                        fb.paintSample(pxl.x, pxl.y, s, color);
+                    db.paintSample(pxl.x, pxl.y, s, depths[s]);
+                }
+            });
+        }
+
+        // call pixelFunc(glm::ivec2) for each pixel of the triangle inside the rectangle [xMin, xMax] x [yMin, yMax]
+        template<class PixelFunc>
+        void forEachPixel(const triangle &tri, int xMin, int yMin, int xMax, int yMax, PixelFunc &&pixelFunc) {
+            forEachPixel(tri, xMin, yMin, xMax, yMax, [](int, int, std::uint64_t) { return true; }, pixelFunc);
+        }
+
+        // same as above, but the edge function rasterizer first calls blockFunc(bx, by, mask) for each block of
+        // pixels, with the coverage mask of the block, and skips the block if it returns false
+        template<class BlockFunc, class PixelFunc>
+        void forEachPixel(const triangle &tri, int xMin, int yMin, int xMax, int yMax, BlockFunc &&blockFunc, PixelFunc &&pixelFunc) {
+            // vertices of the triangle, in fixed point or rounded to the closest integer (aka pixel location)
+            int bits = m_subpixelRasterization ? subpixelBits : 0;
+            glm::ivec2 iv1 = rasterPosition(tri.v1.pos);
+            glm::ivec2 iv2 = rasterPosition(tri.v2.pos);
+            glm::ivec2 iv3 = rasterPosition(tri.v3.pos);
+
+            if (m_smallTriangles) {
+                glm::ivec2 bMin, bMax;
+                pixelBounds(iv1, iv2, iv3, bMin, bMax);
+                bMin = glm::max(bMin, glm::ivec2(xMin, yMin));
+                bMax = glm::min(bMax, glm::ivec2(xMax, yMax));
+                int size = std::max(bMax.x - bMin.x, bMax.y - bMin.y) + 1;
+                if (size <= 2) {
+                    smallTriangle<2>(iv1, iv2, iv3, bits, bMin, bMax, blockFunc, pixelFunc);
+                    return;
+                }
+                if (size <= 4) {
+                    smallTriangle<4>(iv1, iv2, iv3, bits, bMin, bMax, blockFunc, pixelFunc);
+                    return;
+                }
+            }
+
+            if (m_edgeFunctionRasterizer || m_subpixelRasterization) {
+                // run the rasterization one block of pixels at a time
+                edge_function_rasterizer rasterizer(iv1.x, iv1.y, iv2.x, iv2.y, iv3.x, iv3.y, xMin, yMin, xMax, yMax, bits);
+                for (; rasterizer.more_blocks(); rasterizer.next_block()) {
+                    std::uint64_t mask = rasterizer.block_mask();
+                    if (blockFunc(rasterizer.block_x(), rasterizer.block_y(), mask))
+                        forEachPixelOfBlock(rasterizer.block_x(), rasterizer.block_y(), mask, pixelFunc);
+                }
+                return;
+            }
+
+            // run the rasterization one scanline at a time, pixels are generated bottom to top
+            triangle_rasterizer rasterizer(iv1.x, iv1.y, iv2.x, iv2.y, iv3.x, iv3.y);
+            while (rasterizer.more_fragments()) {
+                int y = rasterizer.y();
+                if (y > yMax)
+                    break;
+                if (y < yMin) {
+                    rasterizer.next_span();
+                    continue;
+                }
+
+                // create a fragment for each pixel of the scanline inside the rectangle
+                for (int x = std::max(rasterizer.x(), xMin), xEnd = std::min(rasterizer.x_span_end(), xMax); x <= xEnd; x++)
+                    pixelFunc(glm::ivec2(x, y));
+                rasterizer.next_span();
+            }
+        }
+
+        // call pixelFunc(glm::ivec2) for each pixel of the coverage mask of the block of pixels at (bx, by)
+        template<class PixelFunc>
+        static void forEachPixelOfBlock(int bx, int by, std::uint64_t mask, PixelFunc &&pixelFunc) {
+            const int bs = edge_function_rasterizer::block_size;
+            for (int j = 0; j < bs; j++) {
+                unsigned int row = (mask >> (j * bs)) & 0xFFu;
+                for (int i = 0; row != 0; i++, row >>= 1) {
+                    if (row & 1u)
+                        pixelFunc(glm::ivec2(bx + i, by + j));
                 }
             }
         }
 
+        // forEachPixel for a triangle whose pixels are in the rectangle [bMin, bMax], which fits in size x size
+        // pixels (empty if the triangle has no pixels). The pixels are tested against the edge functions of the
+        // triangle, with the fill rule of the edge_function_rasterizer, and grouped in the (at most 2x2) blocks of
+        // the rasterizer, which are visited in the same order
+        template<int size, class BlockFunc, class PixelFunc>
+        static void smallTriangle(glm::ivec2 iv1, glm::ivec2 iv2, glm::ivec2 iv3, int bits, glm::ivec2 bMin,
+                                  glm::ivec2 bMax, BlockFunc &&blockFunc, PixelFunc &&pixelFunc) {
+            const int bs = edge_function_rasterizer::block_size;
+            static_assert(size <= bs, "the pixels must be in 2x2 blocks");
+            if (bMin.x > bMax.x || bMin.y > bMax.y)
+                return;
+
+            std::int64_t area = std::int64_t(iv2.x - iv1.x) * (iv3.y - iv1.y) - std::int64_t(iv2.y - iv1.y) * (iv3.x - iv1.x);
+            if (area == 0)
+                return;
+            // counterclockwise order
+            if (area < 0)
+                std::swap(iv2, iv3);
+
+            // the edge functions at bMin, and their steps from pixel to pixel
+            const glm::ivec2 v[3] = {iv1, iv2, iv3};
+            std::int64_t e[3], a[3], b[3];
+            for (int i = 0; i < 3; i++) {
+                glm::ivec2 from = v[i], to = v[(i + 1) % 3];
+                std::int64_t dx = std::int64_t(to.x) - from.x, dy = std::int64_t(to.y) - from.y;
+                a[i] = -dy * (std::int64_t(1) << bits);
+                b[i] = dx * (std::int64_t(1) << bits);
+                e[i] = a[i] * bMin.x + b[i] * bMin.y + dy * from.x - dx * from.y;
+                // pixels on right and top edges are outside
+                if (!(dy < 0 || (dy == 0 && dx > 0)))
+                    e[i] -= 1;
+            }
+
+            // coverage masks of the blocks the rectangle overlaps
+            int bx = bMin.x & ~(bs - 1), by = bMin.y & ~(bs - 1);
+            std::uint64_t masks[2][2] = {};
+            for (int j = 0; j < size; j++) {
+                for (int i = 0; i < size; i++) {
+                    std::int64_t e0 = e[0] + a[0] * i + b[0] * j;
+                    std::int64_t e1 = e[1] + a[1] * i + b[1] * j;
+                    std::int64_t e2 = e[2] + a[2] * i + b[2] * j;
+                    if ((e0 | e1 | e2) < 0 || bMin.x + i > bMax.x || bMin.y + j > bMax.y)
+                        continue;
+                    int x = bMin.x + i - bx, y = bMin.y + j - by;
+                    masks[y / bs][x / bs] |= std::uint64_t(1) << (x % bs + (y % bs) * bs);
+                }
+            }
+
+            for (int j = 0; j < 2; j++) {
+                for (int i = 0; i < 2; i++) {
+                    if (masks[j][i] != 0 && blockFunc(bx + i * bs, by + j * bs, masks[j][i]))
+                        forEachPixelOfBlock(bx + i * bs, by + j * bs, masks[j][i], pixelFunc);
+                }
+            }
+        }
+
+        // create the fragment of the triangle at pixel pxl
+        static fragment triangleFragment(triangle &tri, glm::ivec2 pxl) {
+            fragment frag{};
+
+            frag.pos = pxl;
+
+            glm::vec3 bar = perspectiveBarycentric(tri, pxl);
+            frag.depth = interpolateDepth(tri, bar);
+            interpolateAttributes(tri, bar, frag);
+
+            return frag;
+        }
+
+        // barycentric coordinates of pixel pxl, corrected for hyperbolic interpolation
+        static glm::vec3 perspectiveBarycentric(triangle &tri, glm::ivec2 pxl) {
+            // barycentric coordinates (in 2D projected space)
+            glm::vec3 bar = tri.barycentricCoordinatesAt(pxl);
+            // hyperbolic interpolation correction
+            float hypInterp = bar.x * tri.v1.hypInterp + bar.y * tri.v2.hypInterp + bar.z * tri.v3.hypInterp;
+            return bar / hypInterp;
+        }
+
+        static float interpolateDepth(const triangle &tri, glm::vec3 bar) {
+            return bar.x * tri.v1.pos.z + bar.y * tri.v2.pos.z + bar.z * tri.v3.pos.z;
+        }
+
+        // position of a vertex given to the rasterizer: 28.4 fixed point with m_subpixelRasterization,
+        // else rounded to the closest pixel
+        glm::ivec2 rasterPosition(glm::vec4 pos) const {
+            if (m_subpixelRasterization)
+                return fixedPoint(pos);
+            return glm::ivec2(pos.x + .5f, pos.y + .5f);
+        }
+
+        // window position in 28.4 fixed point
+        static glm::ivec2 fixedPoint(glm::vec4 pos) {
+            const float one = float(1 << subpixelBits);
+            return glm::ivec2(std::floor(pos.x * one + .5f), std::floor(pos.y * one + .5f));
+        }
+
+        // bounding box of the pixel locations used by the rasterizer
+        void pixelBounds(const triangle &tri, glm::ivec2 &bMin, glm::ivec2 &bMax) const {
+            pixelBounds(tri.v1.pos, tri.v2.pos, tri.v3.pos, bMin, bMax);
+        }
+
+        // same as above, from the window coordinates of the vertices
+        void pixelBounds(glm::vec4 p1, glm::vec4 p2, glm::vec4 p3, glm::ivec2 &bMin, glm::ivec2 &bMax) const {
+            pixelBounds(rasterPosition(p1), rasterPosition(p2), rasterPosition(p3), bMin, bMax);
+        }
+
+        // same as above, from the positions given to the rasterizer (see rasterPosition)
+        void pixelBounds(glm::ivec2 iv1, glm::ivec2 iv2, glm::ivec2 iv3, glm::ivec2 &bMin, glm::ivec2 &bMax) const {
+            bMin = glm::min(glm::min(iv1, iv2), iv3);
+            bMax = glm::max(glm::max(iv1, iv2), iv3);
+            if (m_subpixelRasterization) {
+                // first pixel at or after the smallest coordinate, last pixel at or before the largest one
+                const int one = 1 << subpixelBits;
+                bMin = glm::ivec2((bMin.x + one - 1) >> subpixelBits, (bMin.y + one - 1) >> subpixelBits);
+                bMax = glm::ivec2(bMax.x >> subpixelBits, bMax.y >> subpixelBits);
+            }
+        }
+
+        // the depth of a fragment is the interpolated pos.z (z/w^2) divided by the interpolated hypInterp (1/w),
+        // and both are linear in screen space. We store them as planes a * x + b * y + c
+        struct DepthFunction {
+            glm::dvec3 num;
+            glm::dvec3 den;
+        };
+
+        // returns false if the triangle has no area on the screen
+        static bool depthFunction(const triangle &tri, DepthFunction &depthFunc) {
+            return screenPlane(tri, tri.v1.pos.z, tri.v2.pos.z, tri.v3.pos.z, depthFunc.num) &&
+                   screenPlane(tri, tri.v1.hypInterp, tri.v2.hypInterp, tri.v3.hypInterp, depthFunc.den);
+        }
+
+        // plane a * x + b * y + c that has values f1, f2 and f3 at the vertices of the triangle
+        static bool screenPlane(const triangle &tri, double f1, double f2, double f3, glm::dvec3 &plane) {
+            glm::dvec3 p1(tri.v1.pos.x, tri.v1.pos.y, f1);
+            glm::dvec3 p2(tri.v2.pos.x, tri.v2.pos.y, f2);
+            glm::dvec3 p3(tri.v3.pos.x, tri.v3.pos.y, f3);
+            glm::dvec3 n = glm::cross(p2 - p1, p3 - p1);
+            if (std::abs(n.z) < 1e-12)
+                return false;
+            plane.x = -n.x / n.z;
+            plane.y = -n.y / n.z;
+            plane.z = p1.z - plane.x * p1.x - plane.y * p1.y;
+            return true;
+        }
+
+        // smallest and largest depth of the triangle in the rectangle of pixels [bMin, bMax]
+        // the pixels of a triangle can be slightly outside of it (vertices are rounded), so we can't use the depth
+        // of the vertices. The ratio of two linear functions has its extremes at the corners of the rectangle, as long
+        // as the denominator is positive there. The range is padded to account for rounding errors
+        static void depthRange(const DepthFunction &depthFunc, glm::ivec2 bMin, glm::ivec2 bMax, float &zMin, float &zMax) {
+            const double padding = 1e-5;
+            double minZ = HUGE_VAL, maxZ = -HUGE_VAL;
+            for (int corner = 0; corner < 4; corner++) {
+                double x = corner & 1 ? bMax.x : bMin.x;
+                double y = corner & 2 ? bMax.y : bMin.y;
+                double num = depthFunc.num.x * x + depthFunc.num.y * y + depthFunc.num.z;
+                double den = depthFunc.den.x * x + depthFunc.den.y * y + depthFunc.den.z;
+                if (den < 1e-9) {
+                    // no useful bounds
+                    zMin = -HUGE_VALF;
+                    zMax = HUGE_VALF;
+                    return;
+                }
+                minZ = std::min(minZ, num / den);
+                maxZ = std::max(maxZ, num / den);
+            }
+            zMin = float(minZ - padding);
+            zMax = float(maxZ + padding);
+        }
+
+        static void interpolateAttributes(const PlaneInterpolator<TriangleSetup::valueCount> &interp, fragment &frag) {
+            float attributes[TriangleSetup::valueCount - TriangleSetup::firstAttribute];
+            interp.attributes(attributes);
+            TriangleSetup::toFragment(attributes, frag);
+        }
+
+        static void interpolateAttributes(const triangle &tri, glm::vec3 bar, fragment &frag) {
+            frag.col = bar.x * tri.v1.col + bar.y * tri.v2.col + bar.z * tri.v3.col;
+            frag.norm = bar.x * tri.v1.norm + bar.y * tri.v2.norm + bar.z * tri.v3.norm;
+            frag.uv = bar.x * tri.v1.uv + bar.y * tri.v2.uv + bar.z * tri.v3.uv;
+        }
+
+        // sort the visible triangles into the lists of the screen tiles they overlap
+        // the lists keep the submission order, so each pixel sees the triangles in the same order as rasterPrimitives.
+        // With m_parallelGeometry, the chunks of the primitives first count the triangles they add to each tile,
+        // then write them at the place of the chunk in the lists. With multisample, the triangles are binned to the
+        // tiles of the pixels where they can cover a sample, not only the pixel location
+        void binPrimitives(int width, int height, bool multisample) {
+            m_tileCountX = (width + m_tileSize - 1) / m_tileSize;
+            m_tileCountY = (height + m_tileSize - 1) / m_tileSize;
+            int tileCount = m_tileCountX * m_tileCountY;
+            m_tileBins.resize(tileCount);
+            for (auto &bin : m_tileBins)
+                bin.clear();
+
+            int size = m_primitives.size();
+            if (chunkCount(size) == 1) {
+                for (int i = 0; i < size; i++)
+                    forEachTileOf(i, width, height, multisample, [&](int tile) { m_tileBins[tile].push_back(i); });
+                return;
+            }
+
+            // triangles of each chunk in each tile, and then the place of the first one in the list of the tile
+            m_binCounts.assign(chunkCount(size) * tileCount, 0);
+            forEachChunk(size, [&](int chunk, int begin, int end) {
+                int *counts = m_binCounts.data() + chunk * tileCount;
+                for (int i = begin; i < end; i++)
+                    forEachTileOf(i, width, height, multisample, [&](int tile) { counts[tile]++; });
+                return 0;
+            });
+            for (int tile = 0; tile < tileCount; tile++) {
+                int binSize = 0;
+                for (int chunk = 0, chunks = chunkCount(size); chunk < chunks; chunk++) {
+                    int &count = m_binCounts[chunk * tileCount + tile];
+                    int first = binSize;
+                    binSize += count;
+                    count = first;
+                }
+                m_tileBins[tile].resize(binSize);
+            }
+            forEachChunk(size, [&](int chunk, int begin, int end) {
+                int *next = m_binCounts.data() + chunk * tileCount;
+                for (int i = begin; i < end; i++)
+                    forEachTileOf(i, width, height, multisample, [&](int tile) { m_tileBins[tile][next[tile]++] = i; });
+                return 0;
+            });
+        }
+
+        // call tileFunc(tile) for the tiles the bounding box of primitive prim overlaps, if it is visible (the bounds
+        // of the samples, which reach half a pixel further, with multisample)
+        template<class TileFunc>
+        void forEachTileOf(int prim, int width, int height, bool multisample, TileFunc &&tileFunc) const {
+            const indexedTriangle &tri = m_primitives[prim];
+            if (tri.rejected)
+                return;
+
+            glm::ivec2 bMin, bMax;
+            const glm::vec4 &p1 = m_vertices[tri.v1].pos, &p2 = m_vertices[tri.v2].pos, &p3 = m_vertices[tri.v3].pos;
+            if (multisample)
+                MultisampleRasterizer::pixelBounds(fixedPoint(p1), fixedPoint(p2), fixedPoint(p3), subpixelBits,
+                                                   bMin, bMax);
+            else
+                pixelBounds(p1, p2, p3, bMin, bMax);
+            bMin = glm::max(bMin, glm::ivec2(0, 0));
+            bMax = glm::min(bMax, glm::ivec2(width - 1, height - 1));
+            if (bMin.x > bMax.x || bMin.y > bMax.y)
+                return;
+
+            for (int ty = bMin.y / m_tileSize; ty <= bMax.y / m_tileSize; ty++)
+                for (int tx = bMin.x / m_tileSize; tx <= bMax.x / m_tileSize; tx++)
+                    tileFunc(tx + ty * m_tileCountX);
+        }
+
+        // rasterize, process and write the fragments of one tile
+        // tiles don't share pixels, so the workers can write to the frame buffers without locks
+        void rasterTile(int tile, int worker, CustomFrameBuffer <uint32_t> &fb, CustomFrameBuffer <float> &db) {
+            std::vector<fragment> &frs = m_tileFragments[worker];
+            int xMin = (tile % m_tileCountX) * m_tileSize;
+            int yMin = (tile / m_tileCountX) * m_tileSize;
+            int xMax = std::min(xMin + m_tileSize, (int) fb.W) - 1;
+            int yMax = std::min(yMin + m_tileSize, (int) fb.H) - 1;
+
+            // counted locally and added to the counters of the worker once per tile, the counters of the workers
+            // share cache lines
+            FragmentCounters counters;
+            frs.clear();
+            for (int i : m_tileBins[tile]) {
+                if (db.S > 1)
+                    streamTriangleMultisample(i, xMin, yMin, xMax, yMax, m_multisampleRasterizers[worker], fb, db, counters);
+                else if (m_streamFragments || m_hierarchicalZ || m_visibilityActive || m_transparencyActive ||
+                         db.planeCompression())
+                    streamTriangle(i, xMin, yMin, xMax, yMax, fb, db, counters, m_transparencyChunks[worker]);
+                else
+                    rasterTriangle(i, xMin, yMin, xMax, yMax, frs);
+            }
+            counters.generated += frs.size();
+            processFragments(frs);
+            writeToFrameBuffer(frs, fb, db, counters);
+            m_workerCounters[worker].add(counters);
+        }
+
+        // the triangles of a draw, kept until they are shaded by resolveVisibility
+        struct VisibilityInstance {
+            std::vector<vertex> vertices;
+            std::vector<indexedTriangle> primitives;
+            std::vector<TriangleSetup> setups;
+        };
+
+        // prepare the visibility buffer for the current draw, returns false if the triangles of the draw don't fit
+        // in the ids (the draw is then rendered without it). The ids of a pixel are cleared when it is shaded,
+        // and when the size of the frame buffer changes
+        bool beginVisibility(CustomFrameBuffer <uint32_t> &fb) {
+            if (m_primitives.size() >= triangleMask)
+                return false;
+            if (m_visibilityWidth != (int) fb.W || m_visibilityHeight != (int) fb.H) {
+                m_visibilityWidth = fb.W;
+                m_visibilityHeight = fb.H;
+                m_visibility.assign(fb.W * fb.H, std::uint32_t(noTriangle));
+                m_instanceCount = 0;
+            }
+            // out of instance ids, shade what we have so far
+            if (m_instanceCount == maxInstances)
+                resolveVisibility(fb);
+            m_instanceId = std::uint32_t(m_instanceCount) << triangleBits;
+            return true;
+        }
+
+        // keep the triangles of the draw for resolveVisibility, the memory of the instance they replace is reused
+        // by the next draw
+        void endVisibility() {
+            if (m_instanceCount == (int) m_instances.size())
+                m_instances.emplace_back();
+            VisibilityInstance &instance = m_instances[m_instanceCount++];
+            instance.vertices.swap(m_vertices);
+            instance.primitives.swap(m_primitives);
+            instance.setups.swap(m_setups);
+        }
+
+        // shade the pixels of row y that have a triangle, one run of pixels of the same triangle at a time,
+        // and clear their ids
+        void resolveVisibilityRow(int y, CustomFrameBuffer <uint32_t> &fb) {
+            std::uint32_t *ids = m_visibility.data() + y * m_visibilityWidth;
+            for (int x = 0; x < m_visibilityWidth; ) {
+                std::uint32_t id = ids[x];
+                int end = x + 1;
+                while (end < m_visibilityWidth && ids[end] == id)
+                    end++;
+                if (id != noTriangle) {
+                    shadeVisibleRun(m_instances[id >> triangleBits], int(id & triangleMask), x, end, y, fb);
+                    std::fill(ids + x, ids + end, std::uint32_t(noTriangle));
+                }
+                x = end;
+            }
+        }
+
+        // shade the pixels [xBegin, xEnd) of row y, which are all covered by primitive prim of the instance.
+        // The attributes are interpolated as in streamTriangle, so the depth of a pixel matches the one written
+        void shadeVisibleRun(const VisibilityInstance &instance, int prim, int xBegin, int xEnd, int y,
+                             CustomFrameBuffer <uint32_t> &fb) const {
+            if (m_planeInterpolation) {
+                PlaneInterpolator<TriangleSetup::valueCount> interp(instance.setups[prim]);
+                for (int x = xBegin; x < xEnd; x++) {
+                    fragment frag{};
+                    frag.pos = glm::ivec2(x, y);
+                    frag.depth = interp.moveTo(frag.pos);
+                    interpolateAttributes(interp, frag);
+                    processFragment(frag);
+                    fb.paintAt(x, y, Colors::toRGBA32(frag.col));
+                }
+                return;
+            }
+            // barycentric coordinates of the pixels, from the vertices of the triangle
+            const indexedTriangle &p = instance.primitives[prim];
+            triangle tri;
+            tri.v1 = instance.vertices[p.v1];
+            tri.v2 = instance.vertices[p.v2];
+            tri.v3 = instance.vertices[p.v3];
+            for (int x = xBegin; x < xEnd; x++) {
+                fragment frag = triangleFragment(tri, glm::ivec2(x, y));
+                processFragment(frag);
+                fb.paintAt(x, y, Colors::toRGBA32(frag.col));
+            }
+        }
+
+
+        // lists of triangle primitives and of the vertices they refer to (including the vertices added by clipping),
+        // part of the class so that we avoid reallocating memory every frame
+        std::vector<indexedTriangle> m_primitives;
+        std::vector<vertex> m_vertices;
+
+        // plane equations of each primitive, computed by setupPrimitives
+        std::vector<TriangleSetup> m_setups;
+
+        // outcodes of the vertices, and planes each triangle has to be clipped against
+        std::vector<unsigned int> m_outcodes;
+        std::vector<unsigned int> m_clipCodes;
+        // what each chunk of the primitives added when clipped
+        std::vector<ClipChunk> m_clipChunks;
+
+        // indices of the triangles overlapping each tile, and fragments of the tile being rasterized by each worker
+        std::vector<std::vector<int>> m_tileBins;
+        // triangles of each chunk of the primitives in each tile, while binning with m_parallelGeometry
+        std::vector<int> m_binCounts;
+        std::vector<std::vector<fragment>> m_tileFragments;
+        int m_tileCountX = 0, m_tileCountY = 0;
+        // fragments counted by each worker during a tiled draw
+        std::vector<FragmentCounters> m_workerCounters;
+
+        // sample coverage of the triangles, one per worker
+        std::vector<MultisampleRasterizer> m_multisampleRasterizers;
+
+        // depth pyramid used by m_hierarchicalZ, and whether it is in use in the current draw
+        HierarchicalZBuffer m_hiZ;
+        bool m_hiZActive = false;
+
+        // ids of the visibility buffer: the instance (draw) in the high bits and the primitive in the low bits.
+        // noTriangle marks the pixels without a triangle, primitive index triangleMask is never used so that no id
+        // is equal to it
+        static const int triangleBits = 22;
+        static const std::uint32_t triangleMask = (1u << triangleBits) - 1u, noTriangle = 0xFFFFFFFFu;
+        static const int maxInstances = 1 << (32 - triangleBits);
+        std::vector<VisibilityInstance> m_instances;
+        int m_instanceCount = 0;
+
+        // id of the nearest triangle of each pixel, id of the instance of the current draw (shifted to the high bits)
+        // and whether the current draw writes ids
+        std::vector<std::uint32_t> m_visibility;
+        int m_visibilityWidth = 0, m_visibilityHeight = 0;
+        std::uint32_t m_instanceId = 0;
+        bool m_visibilityActive = false;
 
-        // lists of triangle primitives, part of the class so that we avoid reallocating memory every frame
-        std::vector<triangle> m_primitives;
+        // translucent fragments of m_orderIndependentTransparency, the chunks of it filled by each worker, and
+        // whether the current draw adds to them
+        TransparencyBuffer m_transparency;
+        std::vector<TransparencyBuffer::Chunk> m_transparencyChunks;
+        bool m_transparencyActive = false;
     };
 
 }
@@ -0,0 +1,157 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_SRL_TRIANGLE_SETUP_H
+#define ITU_GRAPHICS_PROGRAMMING_SRL_TRIANGLE_SETUP_H
+
+#include <limits>
+#include "glm/glm.hpp"
+#include "srl_types.h"
+
+namespace srl {
+
+    // plane equations of the values interpolated over a triangle, computed once per triangle (triangle setup)
+    // after the perspective division, the depth (z/w^2), 1/w and the attributes (divided by w) are all linear in
+    // screen space, so each of them is a plane v(x, y) = v0 + dx * (x - x0) + dy * (y - y0), with (x0, y0) the window
+    // position of the first vertex. The perspective correct value of a fragment is its plane divided by the 1/w plane
+    template<int Count>
+    struct PlaneEquations {
+        // value 0 is the depth, value 1 is 1/w (hypInterp), and the attributes follow
+        static const int depth = 0, hypInterp = 1, firstAttribute = 2, valueCount = Count;
+
+        float x0, y0;
+        float v0[Count];
+        float dx[Count];
+        float dy[Count];
+
+        // planes with values f1, f2 and f3 at the window positions p1, p2 and p3
+        // returns false if the triangle has no area on the screen, in which case the planes are undefined
+        bool setup(const glm::vec4 &p1, const glm::vec4 &p2, const glm::vec4 &p3,
+                   const float *f1, const float *f2, const float *f3) {
+            // twice the signed area of the triangle, the planes are solved in double precision since it is done
+            // only once per triangle and thin triangles have a very small area
+            double ex1 = double(p2.x) - p1.x, ey1 = double(p2.y) - p1.y;
+            double ex2 = double(p3.x) - p1.x, ey2 = double(p3.y) - p1.y;
+            double area = ex1 * ey2 - ex2 * ey1;
+            if (area == 0.0)
+                return false;
+
+            x0 = p1.x;
+            y0 = p1.y;
+            for (int i = 0; i < Count; i++) {
+                double d1 = double(f2[i]) - f1[i], d2 = double(f3[i]) - f1[i];
+                v0[i] = f1[i];
+                dx[i] = float((d1 * ey2 - d2 * ey1) / area);
+                dy[i] = float((d2 * ex1 - d1 * ex2) / area);
+            }
+            return true;
+        }
+    };
+
+    // plane equations of the attributes of srl::vertex, in the same order as in srl::vertex
+    struct TriangleSetup : PlaneEquations<12> {
+        enum Attribute {
+            normX = firstAttribute, normY, normZ, normW,
+            colR, colG, colB, colA,
+            uvX, uvY
+        };
+
+        bool setup(const triangle &tri) {
+            float f1[valueCount], f2[valueCount], f3[valueCount];
+            values(tri.v1, f1);
+            values(tri.v2, f2);
+            values(tri.v3, f3);
+            return PlaneEquations::setup(tri.v1.pos, tri.v2.pos, tri.v3.pos, f1, f2, f3);
+        }
+
+        // fill the attributes of the fragment, from the values firstAttribute to valueCount - 1
+        static void toFragment(const float *attributes, fragment &frag) {
+            const float *v = attributes - firstAttribute;
+            frag.norm = glm::vec4(v[normX], v[normY], v[normZ], v[normW]);
+            frag.col = glm::vec4(v[colR], v[colG], v[colB], v[colA]);
+            frag.uv = glm::vec2(v[uvX], v[uvY]);
+        }
+
+    private:
+        static void values(const vertex &v, float out[valueCount]) {
+            out[depth] = v.pos.z;
+            out[hypInterp] = v.hypInterp;
+            for (int k = 0; k < 4; k++) {
+                out[normX + k] = v.norm[k];
+                out[colR + k] = v.col[k];
+            }
+            out[uvX] = v.uv.x;
+            out[uvY] = v.uv.y;
+        }
+    };
+
+    // evaluates plane equations at the pixels of a triangle, which must be visited left to right along each row
+    // (as both rasterizers do). The planes are evaluated at the start of every span of spanLength pixels (aligned to
+    // multiples of spanLength), then depth and 1/w are stepped one pixel at a time with an addition, and the
+    // attributes are only computed, from the start of the span, for the fragments that are kept.
+    // Since the spans don't depend on how the triangle is split into blocks or tiles, every pixel gets the same
+    // values whatever the rasterization mode, and the rounding error of the steps can't build up across the screen
+    template<int Count>
+    class PlaneInterpolator {
+    public:
+        typedef PlaneEquations<Count> Planes;
+        static const int spanLength = 8;
+
+        explicit PlaneInterpolator(const Planes &planes) : m_planes(planes) {}
+
+        // move to pixel pxl, and return the perspective correct depth there
+        float moveTo(glm::ivec2 pxl) {
+            const Planes &p = m_planes;
+            if (pxl.y != m_y || pxl.x < m_x || pxl.x >= m_spanStart + spanLength) {
+                // start of a new span, evaluate the planes
+                m_spanStart = m_x = pxl.x & ~(spanLength - 1);
+                m_y = pxl.y;
+                float ox = float(m_x) - p.x0, oy = float(m_y) - p.y0;
+                for (int i = 0; i < Count; i++)
+                    m_span[i] = p.v0[i] + p.dx[i] * ox + p.dy[i] * oy;
+                m_depth = m_span[Planes::depth];
+                m_hypInterp = m_span[Planes::hypInterp];
+            }
+            for (; m_x < pxl.x; m_x++) {
+                m_depth += p.dx[Planes::depth];
+                m_hypInterp += p.dx[Planes::hypInterp];
+            }
+
+            // the single reciprocal of the pixel
+            m_w = 1.0f / m_hypInterp;
+            return m_depth * m_w;
+        }
+
+        // perspective correct depth at an offset (in pixels) from the current pixel, e.g. at one of its samples
+        float depthAt(glm::vec2 offset) const {
+            const Planes &p = m_planes;
+            float depth = m_depth + p.dx[Planes::depth] * offset.x + p.dy[Planes::depth] * offset.y;
+            float hypInterp = m_hypInterp + p.dx[Planes::hypInterp] * offset.x + p.dy[Planes::hypInterp] * offset.y;
+            return depth / hypInterp;
+        }
+
+        // perspective correct attributes at the current pixel, out receives Count - firstAttribute values
+        void attributes(float *out) const {
+            const Planes &p = m_planes;
+            float steps = float(m_x - m_spanStart);
+            for (int i = Planes::firstAttribute; i < Count; i++)
+                out[i - Planes::firstAttribute] = (m_span[i] + p.dx[i] * steps) * m_w;
+        }
+
+        // screen space derivatives, along x and along y, of the attribute i (from firstAttribute), which has the
+        // perspective correct value value at the current pixel. The attribute is a / h, with a and h = 1/w planes,
+        // so its derivative along x is (dx(a) - value * dx(h)) * w, and the same along y
+        glm::vec2 derivatives(int i, float value) const {
+            const Planes &p = m_planes;
+            return glm::vec2(p.dx[i] - value * p.dx[Planes::hypInterp], p.dy[i] - value * p.dy[Planes::hypInterp]) * m_w;
+        }
+
+    private:
+        const Planes &m_planes;
+        // current pixel and start of its span, no span has been evaluated yet
+        int m_x = 0, m_y = std::numeric_limits<int>::min(), m_spanStart = 0;
+        // values of the planes at the start of the span
+        float m_span[Count];
+        // depth and 1/w planes at the current pixel, and w
+        float m_depth = 0.0f, m_hypInterp = 1.0f, m_w = 1.0f;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SRL_TRIANGLE_SETUP_H
@@ -5,38 +5,568 @@
 #ifndef ITU_GRAPHICS_PROGRAMMING_SRL_TYPES_H
 #define ITU_GRAPHICS_PROGRAMMING_SRL_TYPES_H
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
+#if defined(__AVX__)
+#define SRL_FRAME_BUFFER_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SRL_FRAME_BUFFER_SSE
+#include <emmintrin.h>
+#endif
 
 namespace srl {
 
+    // storage of the values of a depth buffer: 32 bits floats, or unsigned normalized integers of 24 or 16 bits
+    // (packed in 3 or 2 bytes) that map the depth range [-1, 1] to [0, 2^n - 1]. The depth is rounded to the
+    // closest representable value when it is written
+    enum class DepthFormat { float32, unorm24, unorm16 };
+
+    // the values of a frame buffer are stored in rows of P values (the pitch), which start 64 bytes aligned.
+    // The buffer is split in tiles of tileSize x tileSize pixels, and clearBuffer only marks the tiles as cleared:
+    // a cleared tile receives the clear value the first time one of its pixels is read or written through the
+    // methods of the class, so a clear doesn't depend on the resolution, and tiles that are not drawn are only
+    // written by copyTo/convertTo, in the destination. Code that accesses buffer, samples or compressed directly
+    // must call materialize (or check cleared) first.
+    // Depth buffers (T = float) with one sample per pixel can also store their values in a compact DepthFormat
+    // (buffer is then released, and nullptr until the format is float32 again), and compress blocks of pixels to
+    // the plane of the triangle that covers them (see setPlaneCompression)
     template<class T>
     class CustomFrameBuffer {
     public:
-        unsigned int W, H;
+        // width, height and pitch (P >= W, the padding at the end of the rows can be read and written)
+        unsigned int W, H, P;
         T *buffer;
 
+        // multisample anti-aliasing: number of samples per pixel (1, 2, 4 or 8). With more than one sample,
+        // the samples are stored in samples (S consecutive values per pixel), and buffer receives the resolved image.
+        // A pixel is compressed when all its samples have the value of its first sample (the other samples are not
+        // stored), so pixels covered by a single primitive cost one value to write and to resolve
+        unsigned int S = 1;
+        T *samples = nullptr;
+        std::uint8_t *compressed = nullptr;
+
+        // width and height of the tiles that are cleared together, in pixels
+        static const unsigned int tileSize = 32;
+
+        // width and height of the blocks of pixels that can be compressed to a plane, in pixels
+        static const unsigned int planeBlockSize = 8;
+
         CustomFrameBuffer(unsigned int width, unsigned int height): W(width), H(height) {
-            buffer = new T[W * H];
+            static_assert(alignment % sizeof(T) == 0, "frame buffer values must divide the alignment");
+            P = (W + padding - 1) / padding * padding;
+            buffer = allocate(P * H, m_buffer);
+            m_tilesX = (W + tileSize - 1) / tileSize;
+            m_tilesY = (H + tileSize - 1) / tileSize;
+            m_tiles.reset(new std::atomic<std::uint8_t>[m_tilesX * m_tilesY]);
+            for (unsigned int t = 0; t < m_tilesX * m_tilesY; t++)
+                m_tiles[t].store(tileReady, std::memory_order_relaxed);
+            m_blocksX = (W + planeBlockSize - 1) / planeBlockSize;
+            m_blocksY = (H + planeBlockSize - 1) / planeBlockSize;
         }
 
-        ~CustomFrameBuffer(){delete[] buffer;} // clean our memory
+        // store the values in format, the buffer is then cleared to its last clear value (the values are not
+        // converted). The compact formats replace the floats of buffer, which is only allocated for float32.
+        // Only depth buffers have a format, and it is not used by the samples
+        void setDepthFormat(DepthFormat format){
+            static_assert(std::is_same<T, float>::value, "only depth buffers have a depth format");
+            m_format = format;
+            m_packedBytes = format == DepthFormat::unorm24 ? 3 : format == DepthFormat::unorm16 ? 2 : 0;
+            m_packed.reset();
+            m_packedValues = nullptr;
+            if (m_packedBytes > 0) {
+                m_buffer.reset();
+                buffer = nullptr;
+                m_packed.reset(new std::uint8_t[P * H * m_packedBytes + alignment]);
+                m_packedValues = m_packed.get() + (alignment - std::uintptr_t(m_packed.get()) % alignment) % alignment;
+                m_packedMax = double((1u << (8 * m_packedBytes)) - 1);
+            } else if (!buffer) {
+                buffer = allocate(P * H, m_buffer);
+            }
+            clearBuffer(m_clearValue);
+        }
+
+        DepthFormat depthFormat() const { return m_format; }
+
+        // bytes used to store a value of buffer
+        unsigned int bytesPerValue() const { return m_packedBytes > 0 ? m_packedBytes : sizeof(T); }
 
+        // depth compression: a block of planeBlockSize x planeBlockSize pixels covered by a single triangle can store
+        // the plane of its depth instead of its values (see paintPlane). The block is decompressed, its values
+        // written from the plane, the first time one of its pixels is read or written through the methods of the
+        // class, which usually means that a second triangle touches it. A clear compresses every block to the
+        // plane of the clear value, instead of marking the tiles as cleared. Only used with one sample per pixel
+        void setPlaneCompression(bool on){
+            static_assert(std::is_same<T, float>::value, "only depth buffers can be compressed to planes");
+            if (on == planeCompression())
+                return;
+            if (!on) {
+                materialize();
+                m_blockStates.reset();
+                m_blockPlanes.reset();
+                return;
+            }
+            m_blockStates.reset(new std::atomic<std::uint8_t>[m_blocksX * m_blocksY]);
+            m_blockPlanes.reset(new BlockPlane[m_blocksX * m_blocksY]);
+            for (unsigned int b = 0; b < m_blocksX * m_blocksY; b++)
+                m_blockStates[b].store(blockPixels, std::memory_order_relaxed);
+        }
+
+        bool planeCompression() const { return m_blockStates != nullptr; }
+
+        // store the plane value(x0 + dx, y0 + dy) = c + a * dx + b * dy as the values of the block of pixel (x, y),
+        // with (x0, y0) the first pixel of the block. Every pixel of the block must be covered, and the caller must
+        // be the only one using the block (e.g. the thread that owns the tile of the screen it is in)
+        void paintPlane(unsigned int x, unsigned int y, float a, float b, float c){
+            assert (x < W && y < H && planeCompression() && S == 1);
+            unsigned int block = x / planeBlockSize + y / planeBlockSize * m_blocksX;
+            m_blockPlanes[block] = BlockPlane{a, b, c};
+            m_blockStates[block].store(blockPlane, std::memory_order_release);
+        }
+
+        // smallest and largest value of the block of pixel (x, y), if they are known without reading its pixels:
+        // the block holds a plane, or its tile is still cleared. Returns false otherwise
+        bool blockRange(unsigned int x, unsigned int y, T &minValue, T &maxValue) const {
+            assert (x < W && y < H);
+            unsigned int bx = x / planeBlockSize, by = y / planeBlockSize;
+            if (m_blockStates && m_blockStates[bx + by * m_blocksX].load(std::memory_order_acquire) == blockPlane) {
+                // the values are rounded in the same direction as the plane, so the extremes are at the corners
+                const BlockPlane &plane = m_blockPlanes[bx + by * m_blocksX];
+                unsigned int x0 = bx * planeBlockSize, y0 = by * planeBlockSize;
+                unsigned int lastX = std::min(x0 + planeBlockSize, W) - 1 - x0;
+                unsigned int lastY = std::min(y0 + planeBlockSize, H) - 1 - y0;
+                minValue = maxValue = stored(planeValue(plane, 0, 0));
+                for (int corner = 1; corner < 4; corner++) {
+                    T value = stored(planeValue(plane, corner & 1 ? lastX : 0, corner & 2 ? lastY : 0));
+                    minValue = std::min(minValue, value);
+                    maxValue = std::max(maxValue, value);
+                }
+                return true;
+            }
+            if (tileState(x, y).load(std::memory_order_acquire) != tileReady) {
+                minValue = maxValue = stored(m_clearValue);
+                return true;
+            }
+            return false;
+        }
+
+        // number of blocks, blocks that hold a plane, and blocks that were decompressed since the last clear
+        unsigned int blockCount() const { return m_blocksX * m_blocksY; }
+
+        unsigned int compressedBlockCount() const {
+            unsigned int count = 0;
+            if (m_blockStates)
+                for (unsigned int b = 0; b < m_blocksX * m_blocksY; b++)
+                    count += m_blockStates[b].load(std::memory_order_relaxed) == blockPlane;
+            return count;
+        }
+
+        long long decompressedBlockCount() const { return m_decompressedBlocks.load(std::memory_order_relaxed); }
+
+        // change the number of samples per pixel, the samples start compressed with value T()
+        void setSampleCount(unsigned int sampleCount){
+            m_samples.reset();
+            m_compressed.reset();
+            samples = nullptr;
+            compressed = nullptr;
+            S = sampleCount;
+            if (S > 1) {
+                samples = allocate(P * H * S, m_samples);
+                std::fill(samples, samples + P * H * S, T());
+                m_compressed.reset(new std::uint8_t[P * H]);
+                compressed = m_compressed.get();
+                std::memset(compressed, 1, P * H);
+            }
+        }
+
+        // mark every tile as cleared to value, with more than one sample per pixel only the first sample of each
+        // pixel is cleared (and the pixel compressed) when the tile is materialized
         void clearBuffer(T value){
-            int size = W * H;
-            for (int i = 0; i < size; i++)
-                buffer[i] = value;
+            m_clearValue = value;
+            // with plane compression, the blocks are cleared instead of the tiles, to the plane of value
+            bool clearBlocks = planeCompression() && S == 1;
+            for (unsigned int t = 0; t < m_tilesX * m_tilesY; t++)
+                m_tiles[t].store(clearBlocks ? tileReady : tileCleared, std::memory_order_relaxed);
+            resetBlocks(clearBlocks);
+        }
+
+        // clear the whole buffer to value now, with non-temporal SIMD stores
+        void fill(T value){
+            m_clearValue = value;
+            if (m_packedValues)
+                fillPacked(0, P * H, value);
+            else
+                fillValues(buffer, P * H, value, true);
+            if (S > 1) {
+                for (unsigned int i = 0; i < P * H; i++)
+                    samples[i * S] = value;
+                std::memset(compressed, 1, P * H);
+            }
+            for (unsigned int t = 0; t < m_tilesX * m_tilesY; t++)
+                m_tiles[t].store(tileReady, std::memory_order_relaxed);
+            resetBlocks(false);
+        }
+
+        // whether pixel (x, y) still has the clear value because its tile was not materialized yet
+        bool cleared(unsigned int x, unsigned int y) const {
+            return tileState(x, y).load(std::memory_order_acquire) != tileReady;
+        }
+
+        T clearValue() const { return m_clearValue; }
+
+        // give the clear value to the cleared tiles that overlap the rectangle [xMin, xMax] x [yMin, yMax], and
+        // decompress the blocks that hold a plane. Different threads can materialize the same tiles at the same time
+        void materialize(unsigned int xMin, unsigned int yMin, unsigned int xMax, unsigned int yMax){
+            assert (xMin <= xMax && xMax < W && yMin <= yMax && yMax < H);
+            for (unsigned int ty = yMin / tileSize; ty <= yMax / tileSize; ty++)
+                for (unsigned int tx = xMin / tileSize; tx <= xMax / tileSize; tx++)
+                    materializeTile(tx, ty);
+            if (m_blockStates)
+                for (unsigned int by = yMin / planeBlockSize; by <= yMax / planeBlockSize; by++)
+                    for (unsigned int bx = xMin / planeBlockSize; bx <= xMax / planeBlockSize; bx++)
+                        decompressBlock(bx, by);
+        }
+
+        void materialize(){
+            materialize(0, 0, W - 1, H - 1);
         }
 
         void paintAt(unsigned int x, unsigned int y, T value){
             assert (x < W && y < H); // ensure valid position, crash if not (sooo dramatic!)
-            buffer[x + y * W] = value;
+            touch(x, y);
+            store(x + y * P, value);
         }
 
         T valueAt(unsigned int x, unsigned int y){
             assert (x < W && y < H);
-            return buffer[x + y * W];
+            touch(x, y);
+            return load(x + y * P);
+        }
+
+        // value of sample s of pixel (x, y), only valid with more than one sample per pixel
+        T sampleAt(unsigned int x, unsigned int y, unsigned int s) const {
+            assert (x < W && y < H && s < S);
+            touch(x, y);
+            unsigned int i = x + y * P;
+            return samples[i * S + (compressed[i] ? 0 : s)];
+        }
+
+        void paintSample(unsigned int x, unsigned int y, unsigned int s, T value){
+            assert (x < W && y < H && s < S);
+            touch(x, y);
+            unsigned int i = x + y * P;
+            T *pixel = samples + i * S;
+            if (compressed[i]) {
+                std::fill(pixel + 1, pixel + S, pixel[0]);
+                compressed[i] = 0;
+            }
+            pixel[s] = value;
+        }
+
+        // paint all the samples of pixel (x, y), which becomes compressed
+        void paintSamples(unsigned int x, unsigned int y, T value){
+            assert (x < W && y < H);
+            touch(x, y);
+            unsigned int i = x + y * P;
+            samples[i * S] = value;
+            compressed[i] = 1;
+        }
+
+        // average the samples of each pixel into buffer (compressed pixels are copied), or into the values of
+        // the depth format
+        void resolve(){
+            if (S == 1)
+                return;
+            materialize();
+            for (unsigned int y = 0; y < H; y++)
+                for (unsigned int i = y * P; i < y * P + W; i++)
+                    store(i, compressed[i] ? samples[i * S] : average(samples + i * S, S));
+        }
+
+        // copy the W x H values to dst, in rows of dstRowLength values, without materializing the cleared tiles
+        void copyTo(T *dst, unsigned int dstRowLength) const {
+            if (m_packedValues || m_blockStates) {
+                for (unsigned int y = 0; y < H; y++)
+                    for (unsigned int x = 0; x < W; x++)
+                        dst[x + y * dstRowLength] = peek(x, y);
+                return;
+            }
+            forEachSpan([&](unsigned int x0, unsigned int x1, unsigned int y, bool isCleared) {
+                T *out = dst + x0 + y * dstRowLength;
+                if (isCleared)
+                    fillValues(out, x1 - x0, m_clearValue, false);
+                else
+                    std::memcpy(out, buffer + x0 + y * P, (x1 - x0) * sizeof(T));
+            });
         }
 
+        // write convert(value) of the W x H values to dst, in rows of dstRowLength values, without materializing
+        // the cleared tiles (the clear value is converted once)
+        template<class U, class Convert>
+        void convertTo(U *dst, unsigned int dstRowLength, Convert &&convert) const {
+            if (m_packedValues || m_blockStates) {
+                for (unsigned int y = 0; y < H; y++)
+                    for (unsigned int x = 0; x < W; x++)
+                        dst[x + y * dstRowLength] = convert(peek(x, y));
+                return;
+            }
+            U clearConverted = convert(m_clearValue);
+            forEachSpan([&](unsigned int x0, unsigned int x1, unsigned int y, bool isCleared) {
+                U *out = dst + y * dstRowLength;
+                if (isCleared) {
+                    std::fill(out + x0, out + x1, clearConverted);
+                } else {
+                    const T *in = buffer + y * P;
+                    for (unsigned int x = x0; x < x1; x++)
+                        out[x] = convert(in[x]);
+                }
+            });
+        }
+
+    private:
+        // alignment of the rows, in bytes, and in values
+        static const unsigned int alignment = 64;
+        static const unsigned int padding = alignment / sizeof(T);
+
+        // a tile is cleared until a thread starts materializing it, and ready once it is done
+        enum TileState : std::uint8_t { tileReady, tileCleared, tileMaterializing };
+
+        // a block holds a plane until a thread starts decompressing it, and its pixels once it is done
+        enum BlockState : std::uint8_t { blockPixels, blockPlane, blockDecompressing };
+
+        // value(x0 + dx, y0 + dy) = c + a * dx + b * dy, with (x0, y0) the first pixel of the block
+        struct BlockPlane {
+            float a, b, c;
+        };
+
+        static T planeValue(const BlockPlane &plane, unsigned int dx, unsigned int dy) {
+            return T((plane.c + plane.a * float(dx)) + plane.b * float(dy));
+        }
+
+        // the value of buffer at index i, and store value there, in the format of the buffer
+        T load(unsigned int i) const {
+            if (!m_packedValues)
+                return buffer[i];
+            const std::uint8_t *bytes = m_packedValues + i * m_packedBytes;
+            std::uint32_t q = bytes[0] | std::uint32_t(bytes[1]) << 8;
+            if (m_packedBytes == 3)
+                q |= std::uint32_t(bytes[2]) << 16;
+            return T(double(q) / m_packedMax * 2.0 - 1.0);
+        }
+
+        void store(unsigned int i, T value) const {
+            if (!m_packedValues) {
+                buffer[i] = value;
+                return;
+            }
+            std::uint32_t q = quantize(value);
+            std::uint8_t *bytes = m_packedValues + i * m_packedBytes;
+            bytes[0] = std::uint8_t(q);
+            bytes[1] = std::uint8_t(q >> 8);
+            if (m_packedBytes == 3)
+                bytes[2] = std::uint8_t(q >> 16);
+        }
+
+        std::uint32_t quantize(T value) const {
+            double unit = std::min(std::max((double(value) + 1.0) * 0.5, 0.0), 1.0);
+            return std::uint32_t(unit * m_packedMax + 0.5);
+        }
+
+        // value as it reads back once it is stored
+        T stored(T value) const {
+            return m_packedValues ? T(double(quantize(value)) / m_packedMax * 2.0 - 1.0) : value;
+        }
+
+        // store value at the count indices from i, in a compact format
+        void fillPacked(unsigned int i, unsigned int count, T value) const {
+            std::uint32_t q = quantize(value);
+            std::uint8_t bytes[3] = {std::uint8_t(q), std::uint8_t(q >> 8), std::uint8_t(q >> 16)};
+            std::uint8_t *out = m_packedValues + i * m_packedBytes;
+            for (unsigned int k = 0; k < count; k++, out += m_packedBytes)
+                std::memcpy(out, bytes, m_packedBytes);
+        }
+
+        // value of pixel (x, y), without materializing its tile or decompressing its block
+        T peek(unsigned int x, unsigned int y) const {
+            unsigned int bx = x / planeBlockSize, by = y / planeBlockSize;
+            if (m_blockStates && m_blockStates[bx + by * m_blocksX].load(std::memory_order_acquire) == blockPlane)
+                return stored(planeValue(m_blockPlanes[bx + by * m_blocksX], x - bx * planeBlockSize,
+                                         y - by * planeBlockSize));
+            if (tileState(x, y).load(std::memory_order_acquire) != tileReady)
+                return stored(m_clearValue);
+            return load(x + y * P);
+        }
+
+        // mark every block as holding its pixels, or the constant plane of the clear value
+        void resetBlocks(bool cleared) {
+            m_decompressedBlocks.store(0, std::memory_order_relaxed);
+            if (!m_blockStates)
+                return;
+            for (unsigned int b = 0; b < m_blocksX * m_blocksY; b++) {
+                if (cleared)
+                    m_blockPlanes[b] = BlockPlane{0.0f, 0.0f, float(m_clearValue)};
+                m_blockStates[b].store(cleared ? blockPlane : blockPixels, std::memory_order_relaxed);
+            }
+        }
+
+        // 64 bytes aligned array of count values, allocated in memory
+        static T *allocate(unsigned int count, std::unique_ptr<T[]> &memory) {
+            memory.reset(new T[count + padding]);
+            return memory.get() + (padding - (std::uintptr_t(memory.get()) / sizeof(T)) % padding) % padding;
+        }
+
+        // set count values from dst to value, 4 bytes values are stored 8 (AVX) or 4 (SSE) at a time.
+        // Non-temporal stores skip the cache, for buffers larger than it, and need a 16 (SSE) or 32 (AVX) bytes
+        // aligned dst
+        static void fillValues(T *dst, unsigned int count, T value, bool nonTemporal) {
+            unsigned int i = 0;
+#if defined(SRL_FRAME_BUFFER_AVX) || defined(SRL_FRAME_BUFFER_SSE)
+            if (sizeof(T) == 4) {
+                std::int32_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+#if defined(SRL_FRAME_BUFFER_AVX)
+                __m256i values = _mm256_set1_epi32(bits);
+                if (nonTemporal) {
+                    assert (std::uintptr_t(dst) % 32 == 0);
+                    for (; i + 8 <= count; i += 8)
+                        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + i), values);
+                    _mm_sfence();
+                } else {
+                    for (; i + 8 <= count; i += 8)
+                        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), values);
+                }
+#else
+                __m128i values = _mm_set1_epi32(bits);
+                if (nonTemporal) {
+                    assert (std::uintptr_t(dst) % 16 == 0);
+                    for (; i + 4 <= count; i += 4)
+                        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + i), values);
+                    _mm_sfence();
+                } else {
+                    for (; i + 4 <= count; i += 4)
+                        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), values);
+                }
+#endif
+            }
+#endif
+            std::fill(dst + i, dst + count, value);
+        }
+
+        std::atomic<std::uint8_t> &tileState(unsigned int x, unsigned int y) const {
+            return m_tiles[x / tileSize + y / tileSize * m_tilesX];
+        }
+
+        // materialize the tile of pixel (x, y) if it is cleared, then decompress its block if it holds a plane.
+        // The checks are all a pixel access pays once the tile is ready
+        void touch(unsigned int x, unsigned int y) const {
+            if (tileState(x, y).load(std::memory_order_acquire) != tileReady)
+                materializeTile(x / tileSize, y / tileSize);
+            if (m_blockStates)
+                decompressBlock(x / planeBlockSize, y / planeBlockSize);
+        }
+
+        // the first thread to find the block compressed writes its values from the plane, the others wait for it.
+        // The tile of the block must be ready, or its clear would overwrite the values
+        void decompressBlock(unsigned int bx, unsigned int by) const {
+            std::atomic<std::uint8_t> &state = m_blockStates[bx + by * m_blocksX];
+            if (state.load(std::memory_order_acquire) == blockPixels)
+                return;
+            std::uint8_t expected = blockPlane;
+            if (!state.compare_exchange_strong(expected, std::uint8_t(blockDecompressing), std::memory_order_acquire)) {
+                while (state.load(std::memory_order_acquire) != blockPixels)
+                    std::this_thread::yield();
+                return;
+            }
+            const BlockPlane &plane = m_blockPlanes[bx + by * m_blocksX];
+            unsigned int x0 = bx * planeBlockSize, x1 = std::min(x0 + planeBlockSize, W);
+            unsigned int y0 = by * planeBlockSize, y1 = std::min(y0 + planeBlockSize, H);
+            for (unsigned int y = y0; y < y1; y++)
+                for (unsigned int x = x0; x < x1; x++)
+                    store(x + y * P, planeValue(plane, x - x0, y - y0));
+            m_decompressedBlocks.fetch_add(1, std::memory_order_relaxed);
+            state.store(blockPixels, std::memory_order_release);
+        }
+
+        // the first thread to find the tile cleared writes the clear value, the others wait for it. The last tiles
+        // of the rows include the padding, so the rows of a tile are whole multiples of 64 bytes
+        void materializeTile(unsigned int tx, unsigned int ty) const {
+            std::atomic<std::uint8_t> &state = m_tiles[tx + ty * m_tilesX];
+            std::uint8_t expected = tileCleared;
+            if (!state.compare_exchange_strong(expected, std::uint8_t(tileMaterializing), std::memory_order_acquire)) {
+                while (state.load(std::memory_order_acquire) != tileReady)
+                    std::this_thread::yield();
+                return;
+            }
+            unsigned int x0 = tx * tileSize, x1 = std::min(x0 + tileSize, P);
+            unsigned int y0 = ty * tileSize, y1 = std::min(y0 + tileSize, H);
+            for (unsigned int y = y0; y < y1; y++) {
+                if (m_packedValues)
+                    fillPacked(x0 + y * P, x1 - x0, m_clearValue);
+                else
+                    fillValues(buffer + x0 + y * P, x1 - x0, m_clearValue, false);
+                if (S > 1) {
+                    for (unsigned int i = x0 + y * P; i < x1 + y * P; i++)
+                        samples[i * S] = m_clearValue;
+                    std::memset(compressed + x0 + y * P, 1, x1 - x0);
+                }
+            }
+            state.store(tileReady, std::memory_order_release);
+        }
+
+        // call spanFunc(x0, x1, y, isCleared) for the spans [x0, x1) of each row that belong to the same tile
+        template<class SpanFunc>
+        void forEachSpan(SpanFunc &&spanFunc) const {
+            for (unsigned int y = 0; y < H; y++)
+                for (unsigned int tx = 0; tx < m_tilesX; tx++) {
+                    unsigned int x0 = tx * tileSize, x1 = std::min(x0 + tileSize, W);
+                    spanFunc(x0, x1, y, m_tiles[tx + y / tileSize * m_tilesX].load(std::memory_order_acquire) != tileReady);
+                }
+        }
+
+        // average of count colors, each channel of the 8 bits RGBA colors separately
+        static std::uint32_t average(const std::uint32_t *values, unsigned int count) {
+            std::uint32_t result = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                std::uint32_t sum = 0;
+                for (unsigned int k = 0; k < count; k++)
+                    sum += (values[k] >> shift) & 0xFFu;
+                result |= ((sum + count / 2) / count) << shift;
+            }
+            return result;
+        }
+
+        static float average(const float *values, unsigned int count) {
+            float sum = 0;
+            for (unsigned int k = 0; k < count; k++)
+                sum += values[k];
+            return sum / count;
+        }
+
+        std::unique_ptr<T[]> m_buffer, m_samples;
+        std::unique_ptr<std::uint8_t[]> m_compressed;
+        std::unique_ptr<std::atomic<std::uint8_t>[]> m_tiles;
+        unsigned int m_tilesX, m_tilesY;
+        T m_clearValue = T();
+
+        // values in a compact depth format, 64 bytes aligned
+        DepthFormat m_format = DepthFormat::float32;
+        std::unique_ptr<std::uint8_t[]> m_packed;
+        std::uint8_t *m_packedValues = nullptr;
+        unsigned int m_packedBytes = 0;
+        double m_packedMax = 0.0;
+
+        // state and plane of the blocks, with plane compression
+        std::unique_ptr<std::atomic<std::uint8_t>[]> m_blockStates;
+        std::unique_ptr<BlockPlane[]> m_blockPlanes;
+        unsigned int m_blocksX, m_blocksY;
+        mutable std::atomic<long long> m_decompressedBlocks{0};
     };
 
     namespace Colors {
@@ -60,6 +590,21 @@ namespace srl {
             return (uint32_t(255 * c.r)) + (uint32_t(255 * c.g) << 8) +
                    (uint32_t(255 * c.b) << 16) + (uint32_t(255 * c.a) << 24);
         }
+
+        // src over dst, with the alpha of src, of colors in the format of toRGBA32:
+        // (src * alpha + dst * (255 - alpha)) / 255, rounded, for each channel (the alpha channel is covered as if
+        // src was opaque). Two channels are computed at a time, red and blue, and green and alpha, in 16 bits lanes
+        // of a 32 bits int
+        inline std::uint32_t blend(std::uint32_t src, std::uint32_t dst) {
+            std::uint32_t alpha = src >> 24, inverse = 255u - alpha;
+            src |= 0xFF000000u;
+            std::uint32_t rb = (src & 0x00FF00FFu) * alpha + (dst & 0x00FF00FFu) * inverse + 0x00800080u;
+            std::uint32_t ga = ((src >> 8) & 0x00FF00FFu) * alpha + ((dst >> 8) & 0x00FF00FFu) * inverse + 0x00800080u;
+            // x / 255 rounded is (x + 128 + ((x + 128) >> 8)) >> 8, for x up to 255 * 255
+            rb = ((rb + ((rb >> 8) & 0x00FF00FFu)) >> 8) & 0x00FF00FFu;
+            ga = (ga + ((ga >> 8) & 0x00FF00FFu)) & 0xFF00FF00u;
+            return rb | ga;
+        }
     }
 
     // VERTEX AND FRAGMENT
@@ -106,12 +651,40 @@ namespace srl {
         bool rejected = false;
     };
 
+    // points with only a position and a color (in the format of Colors::toRGBA32), 16 bytes per point instead of
+    // the size of a vertex, for the point clouds of PointRenderer
+    struct PointCloud {
+        std::vector<glm::vec3> positions;
+        std::vector<std::uint32_t> colors;
+    };
+
     struct line {
         vertex v1;
         vertex v2;
         bool rejected = false;
     };
 
+    // line that refers to its vertices by their index in a vertex buffer, so that vertices shared by several lines
+    // are only stored and processed once
+    struct indexedLine {
+        unsigned int v1, v2;
+        bool rejected = false;
+    };
+
+    // triangle that refers to its vertices by their index in a vertex buffer,
+    // so that vertices shared by several triangles are only stored and processed once
+    struct indexedTriangle {
+        unsigned int v1, v2, v3;
+        bool rejected = false;
+    };
+
+    // how the indices of an indexed draw are grouped into triangles
+    enum class Topology {
+        triangleList,   // every 3 indices make a triangle
+        triangleStrip,  // every index after the second makes a triangle with the two indices before it
+        triangleFan     // every index after the second makes a triangle with the first index and the index before it
+    };
+
     struct triangle {
         vertex v1;
         vertex v2;
@@ -128,6 +701,7 @@ namespace srl {
                 inverse[0] = glm::vec2(v1.pos.x - v3.pos.x, v1.pos.y - v3.pos.y);
                 inverse[1] = glm::vec2(v2.pos.x - v3.pos.x, v2.pos.y - v3.pos.y);
                 inverse = glm::inverse(inverse);
+                inverseReady = true;
             }
             glm::vec3 barycentric = glm::vec3(inverse * (at - glm::vec2(v3.pos.x, v3.pos.y)), 0);
             barycentric.z = 1.0f - barycentric.x - barycentric.y;
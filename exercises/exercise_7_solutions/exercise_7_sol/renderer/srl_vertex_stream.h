@@ -0,0 +1,240 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_SRL_VERTEX_STREAM_H
+#define ITU_GRAPHICS_PROGRAMMING_SRL_VERTEX_STREAM_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "glm/glm.hpp"
+#include "srl_types.h"
+
+#if defined(__AVX__)
+#define SRL_VERTEX_STREAM_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SRL_VERTEX_STREAM_SSE
+#include <emmintrin.h>
+#endif
+
+namespace srl {
+
+    // structure of arrays version of a std::vector<vertex>
+    // each component of the vertices (pos.x, pos.y, ..., hypInterp) is stored in its own array, so the vertex stages
+    // can load 4 (SSE) or 8 (AVX) vertices at once and process them with a single instruction.
+    // The arrays are 64 bytes aligned and padded to a multiple of 16 floats, the padding can be read and written
+    class VertexStream {
+    public:
+        // the arrays of the stream, in the same order as the members of srl::vertex
+        enum Component {
+            posX, posY, posZ, posW,
+            normX, normY, normZ, normW,
+            colR, colG, colB, colA,
+            uvX, uvY,
+            hypInterp,
+            componentCount
+        };
+
+        VertexStream() = default;
+
+        explicit VertexStream(const std::vector<vertex> &vts) {
+            assign(vts);
+        }
+
+        VertexStream(const VertexStream &other) {
+            *this = other;
+        }
+
+        VertexStream &operator=(const VertexStream &other) {
+            if (this != &other) {
+                resize(other.m_size);
+                if (m_size > 0)
+                    std::memcpy(m_data, other.m_data, sizeof(float) * componentCount * m_stride);
+            }
+            return *this;
+        }
+
+        int size() const { return m_size; }
+
+        // memory is only reallocated when the stream grows, the existing vertices are kept
+        void resize(int size) {
+            if (size > m_capacity) {
+                int stride = (size + padding - 1) / padding * padding;
+                std::unique_ptr<float[]> memory(new float[componentCount * stride + padding]);
+                // first 64 bytes aligned float of the allocation
+                float *data = memory.get() + (padding - (std::uintptr_t(memory.get()) / sizeof(float)) % padding) % padding;
+                for (int c = 0; c < componentCount; c++) {
+                    if (m_size > 0)
+                        std::memcpy(data + c * stride, m_data + c * m_stride, sizeof(float) * m_size);
+                }
+                m_memory = std::move(memory);
+                m_data = data;
+                m_stride = stride;
+                m_capacity = stride;
+            }
+            m_size = size;
+            clearPadding();
+        }
+
+        float *data(Component c) { return m_data + c * m_stride; }
+        const float *data(Component c) const { return m_data + c * m_stride; }
+
+        void assign(const std::vector<vertex> &vts) {
+            resize((int) vts.size());
+            for (int i = 0; i < m_size; i++)
+                setVertex(i, vts[i]);
+        }
+
+        void setVertex(int i, const vertex &vtx) {
+            for (int k = 0; k < 4; k++) {
+                data(Component(posX + k))[i] = vtx.pos[k];
+                data(Component(normX + k))[i] = vtx.norm[k];
+                data(Component(colR + k))[i] = vtx.col[k];
+            }
+            data(uvX)[i] = vtx.uv.x;
+            data(uvY)[i] = vtx.uv.y;
+            data(hypInterp)[i] = vtx.hypInterp;
+        }
+
+        vertex vertexAt(int i) const {
+            vertex vtx;
+            for (int k = 0; k < 4; k++) {
+                vtx.pos[k] = data(Component(posX + k))[i];
+                vtx.norm[k] = data(Component(normX + k))[i];
+                vtx.col[k] = data(Component(colR + k))[i];
+            }
+            vtx.uv = glm::vec2(data(uvX)[i], data(uvY)[i]);
+            vtx.hypInterp = data(hypInterp)[i];
+            return vtx;
+        }
+
+        // convert back to an array of vertices, vts is resized to the size of the stream
+        void toVertices(std::vector<vertex> &vts) const {
+            vts.resize(m_size);
+            for (int i = 0; i < m_size; i++)
+                vts[i] = vertexAt(i);
+        }
+
+        // pos = m * pos, for all the vertices
+        // the operations are done in the same order as glm's mat4 * vec4, so the results are the same
+        void transform(const glm::mat4 &m) {
+            float *x = data(posX), *y = data(posY), *z = data(posZ), *w = data(posW);
+            for (int i = 0; i < m_size; i += batchSize) {
+                Batch bx = load(x + i), by = load(y + i), bz = load(z + i), bw = load(w + i);
+                for (int r = 0; r < 4; r++) {
+                    Batch xy = add(mul(set(m[0][r]), bx), mul(set(m[1][r]), by));
+                    Batch zw = add(mul(set(m[2][r]), bz), mul(set(m[3][r]), bw));
+                    store(data(Component(posX + r)) + i, add(xy, zw));
+                }
+            }
+            clearPadding();
+        }
+
+        // true if all the vertices are inside the clipping volume -w <= x, y, z <= w,
+        // in which case clipping the primitives would not change them
+        bool insideClipVolume() const {
+            const float *w = data(posW);
+            for (int i = 0; i < m_size; i += batchSize) {
+                Batch bw = load(w + i);
+                Batch outside = greater(bw, bw); // all false
+                for (int k = 0; k < 3; k++) {
+                    Batch p = load(data(Component(posX + k)) + i);
+                    outside = either(outside, either(greater(p, bw), greater(neg(p), bw)));
+                }
+                if (any(outside))
+                    return false;
+            }
+            return true;
+        }
+
+        // perspective division of all the vertices, the same as the divideByW stage of the renderers:
+        // pos.z is divided twice and every other component once, to perform hyperbolic interpolation later on
+        void divideByW() {
+            float *w = data(posW);
+            for (int i = 0; i < m_size; i += batchSize) {
+                Batch bw = load(w + i);
+                float *z = data(posZ) + i;
+                store(z, div(load(z), bw));
+                for (int c = 0; c < componentCount; c++) {
+                    float *comp = data(Component(c)) + i;
+                    store(comp, div(load(comp), bw));
+                }
+            }
+        }
+
+        // normalized device coordinates to window coordinates, the same as the toScreenSpace stage of the renderers
+        // (w must be 1, i.e. divideByW has been called)
+        void toScreenSpace(int width, int height) {
+            float halfW = width / 2;
+            float halfH = height / 2;
+            Batch bHalfW = set(halfW), bHalfH = set(halfH);
+            float *x = data(posX), *y = data(posY);
+            for (int i = 0; i < m_size; i += batchSize) {
+                store(x + i, add(mul(bHalfW, load(x + i)), bHalfW));
+                store(y + i, add(mul(bHalfH, load(y + i)), bHalfH));
+            }
+        }
+
+    private:
+        // alignment and padding of the arrays, in floats
+        static const int padding = 16;
+
+        // the last batch can include vertices past the end of the stream, give them a position inside the
+        // clipping volume (w = 1), so that they don't make insideClipVolume fail or divideByW divide by zero
+        void clearPadding() {
+            for (int c = 0; c < componentCount; c++)
+                std::fill(data(Component(c)) + m_size, data(Component(c)) + m_stride, c == posW ? 1.0f : 0.0f);
+        }
+
+        // SIMD register with batchSize floats
+#if defined(SRL_VERTEX_STREAM_AVX)
+        typedef __m256 Batch;
+        static const int batchSize = 8;
+        static Batch load(const float *p) { return _mm256_load_ps(p); }
+        static void store(float *p, Batch a) { _mm256_store_ps(p, a); }
+        static Batch set(float f) { return _mm256_set1_ps(f); }
+        static Batch add(Batch a, Batch b) { return _mm256_add_ps(a, b); }
+        static Batch mul(Batch a, Batch b) { return _mm256_mul_ps(a, b); }
+        static Batch div(Batch a, Batch b) { return _mm256_div_ps(a, b); }
+        static Batch neg(Batch a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+        static Batch greater(Batch a, Batch b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+        static Batch either(Batch a, Batch b) { return _mm256_or_ps(a, b); }
+        static bool any(Batch a) { return _mm256_movemask_ps(a) != 0; }
+#elif defined(SRL_VERTEX_STREAM_SSE)
+        typedef __m128 Batch;
+        static const int batchSize = 4;
+        static Batch load(const float *p) { return _mm_load_ps(p); }
+        static void store(float *p, Batch a) { _mm_store_ps(p, a); }
+        static Batch set(float f) { return _mm_set1_ps(f); }
+        static Batch add(Batch a, Batch b) { return _mm_add_ps(a, b); }
+        static Batch mul(Batch a, Batch b) { return _mm_mul_ps(a, b); }
+        static Batch div(Batch a, Batch b) { return _mm_div_ps(a, b); }
+        static Batch neg(Batch a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+        static Batch greater(Batch a, Batch b) { return _mm_cmpgt_ps(a, b); }
+        static Batch either(Batch a, Batch b) { return _mm_or_ps(a, b); }
+        static bool any(Batch a) { return _mm_movemask_ps(a) != 0; }
+#else
+        // no SIMD, one vertex at a time
+        typedef float Batch;
+        static const int batchSize = 1;
+        static Batch load(const float *p) { return *p; }
+        static void store(float *p, Batch a) { *p = a; }
+        static Batch set(float f) { return f; }
+        static Batch add(Batch a, Batch b) { return a + b; }
+        static Batch mul(Batch a, Batch b) { return a * b; }
+        static Batch div(Batch a, Batch b) { return a / b; }
+        static Batch neg(Batch a) { return -a; }
+        static Batch greater(Batch a, Batch b) { return a > b ? 1.0f : 0.0f; }
+        static Batch either(Batch a, Batch b) { return a != 0.0f || b != 0.0f ? 1.0f : 0.0f; }
+        static bool any(Batch a) { return a != 0.0f; }
+#endif
+
+        std::unique_ptr<float[]> m_memory;
+        float *m_data = nullptr;
+        // distance between the arrays of two components, in floats
+        int m_stride = 0;
+        int m_size = 0, m_capacity = 0;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SRL_VERTEX_STREAM_H